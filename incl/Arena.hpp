@@ -0,0 +1,49 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <vector>
+
+// Bump allocator for data that lives exactly as long as one request.
+// Allocation is a pointer increment inside a chunk; nothing is freed one
+// by one. A user takes a mark() when it starts and rewind()s to it when
+// it is done, which is O(1) and keeps the chunks for the next request.
+// Marks must be rewound in reverse order, as scopes on a stack are.
+class Arena
+{
+public:
+    struct Mark
+    {
+        size_t chunk;
+        size_t offset;
+    };
+
+    explicit Arena(size_t chunkSize = 16384);
+    ~Arena();
+
+    void* allocate(size_t size);
+    char* copy(const char* data, size_t length);
+    Mark mark() const;
+    void rewind(const Mark& mark);
+    size_t capacity() const;
+
+    static Arena& requests();
+
+private:
+    struct Chunk
+    {
+        char*   data;
+        size_t  size;
+    };
+
+    std::vector<Chunk>  _chunks;
+    size_t              _chunkSize;
+    size_t              _capacity;
+    size_t              _current;
+    size_t              _offset;
+
+    Arena(const Arena&);
+    Arena& operator=(const Arena&);
+};
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef CHUNKEDPARSER_HPP
+#define CHUNKEDPARSER_HPP
+
+#include <string>
+#include <cstddef>
+
+// Incremental parser for "Transfer-Encoding: chunked" bodies. Bytes can be
+// fed in arbitrary pieces; when an output string is given the de-chunked
+// payload is appended to it.
+class ChunkedParser
+{
+public:
+    ChunkedParser();
+
+    size_t feed(const char* data, size_t length, std::string* decoded = NULL);
+    bool isDone() const;
+    bool hasError() const;
+    size_t getDecodedSize() const;
+    void reset();
+
+private:
+    enum State { CHUNK_SIZE, CHUNK_EXTENSION, CHUNK_DATA, CHUNK_DATA_END, TRAILER_START, TRAILER_LINE, DONE, ERROR };
+
+    State   _state;
+    size_t  _chunkSize;
+    size_t  _decodedSize;
+    bool    _sawDigit;
+
+    void endOfSizeLine();
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef CLIENTLIMITER_HPP
+#define CLIENTLIMITER_HPP
+
+#include <vector>
+#include <cstddef>
+#include <sys/socket.h>
+
+// Per-client-address connection counts and token-bucket request limits.
+// Entries live in a flat open-addressing table (linear probing) keyed by
+// the 16-byte address (IPv4 is stored v4-mapped), and are reclaimed once
+// the client has no open connection and its bucket has refilled.
+class ClientLimiter
+{
+public:
+    struct Key
+    {
+        unsigned char bytes[16];
+    };
+
+    ClientLimiter();
+
+    void configure(size_t maxConnections, double rate, double burst);
+    bool acquireConnection(const Key& key, double now);
+    void releaseConnection(const Key& key, double now);
+    bool allowRequest(const Key& key, double now);
+    size_t size() const;
+
+    static Key keyFromAddress(const sockaddr* address);
+    static double now();
+
+private:
+    enum SlotState { EMPTY, USED, DELETED };
+
+    struct Slot
+    {
+        Key             key;
+        unsigned int    connections;
+        double          tokens;
+        double          lastSeen;
+        unsigned char   state;
+    };
+
+    std::vector<Slot>   _slots;
+    size_t              _used;
+    size_t              _deleted;
+    size_t              _maxConnections;
+    double              _rate;
+    double              _burst;
+
+    static size_t hash(const Key& key);
+    static bool sameKey(const Key& a, const Key& b);
+
+    Slot* find(const Key& key);
+    Slot* insert(const Key& key, double now);
+    void refill(Slot& slot, double now) const;
+    bool isExpired(const Slot& slot, double now) const;
+    void expire(double now);
+    void rehash(size_t capacity);
+};
+
+#endif
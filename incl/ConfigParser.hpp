@@ -0,0 +1,71 @@
+#ifndef CONFIGPARSER_HPP
+#define CONFIGPARSER_HPP
+
+#include <string>
+#include <vector>
+
+// One directive of the configuration file: "name arg...;" or, with
+// block set, "name arg... { children }". The file itself is the root,
+// an unnamed block.
+struct ConfigNode {
+    std::string                 name;
+    std::vector<std::string>    args;
+    std::vector<ConfigNode>     children;
+    bool                        block;
+    std::string                 file;
+    int                         line;
+    int                         column;
+
+    ConfigNode();
+    void swap(ConfigNode& other);
+    ConfigNode& appendChild();
+    std::string value() const;
+    std::string where() const;
+    std::string toString(int depth = 0) const;
+};
+
+// Turns a configuration file, and the files it includes, into a
+// ConfigNode tree in a single pass. Errors carry the file, line and
+// column they were found at. With "config_cache on;" at the top level,
+// the tree is also written to a compiled file next to the configuration,
+// reused as long as the sources it was built from are unchanged; load()
+// returns true when it was.
+class ConfigParser {
+public:
+    static bool load(const std::string& path, ConfigNode& root);
+
+private:
+    enum TokenType { WORD, OPEN, CLOSE, SEMICOLON, END };
+
+    struct Token {
+        TokenType   type;
+        std::string text;
+        int         line;
+        int         column;
+    };
+
+    const std::string&          _text;
+    const std::string&          _file;
+    const std::string&          _base;
+    std::vector<std::string>&   _includes;
+    int                         _depth;
+    size_t                      _pos;
+    int                         _line;
+    size_t                      _lineStart;
+
+    ConfigParser(const std::string& text, const std::string& file, const std::string& base, std::vector<std::string>& includes, int depth);
+    void next(Token& token);
+    void readQuoted(Token& token);
+    void parseBlock(ConfigNode& parent, bool topLevel);
+    void include(ConfigNode& parent, const ConfigNode& directive);
+    void fail(int line, int column, const std::string& message) const;
+
+    static bool expand(const std::string& pattern, std::vector<std::string>& paths);
+    static std::string compiledPath(const std::string& path);
+    static unsigned long long hash(const std::string& text, unsigned long long value);
+    static unsigned long long fingerprint(const std::string& text, const std::vector<std::string>& includes);
+    static bool readCompiled(const std::string& path, const std::string& text, ConfigNode& root);
+    static void writeCompiled(const std::string& path, unsigned long long sourceHash, const std::vector<std::string>& includes, const ConfigNode& root);
+};
+
+#endif
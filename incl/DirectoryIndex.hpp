@@ -0,0 +1,33 @@
+#ifndef DIRECTORYINDEX_HPP
+#define DIRECTORYINDEX_HPP
+
+#include <string>
+#include <vector>
+#include <ctime>
+#include <sys/types.h>
+
+// Listings for "autoindex on" locations. Directories are read with
+// getdents64 into a large buffer instead of one readdir() call per entry,
+// and a rendered listing is reused until the directory's mtime changes.
+class DirectoryIndex
+{
+public:
+    enum Format { HTML, JSON };
+
+    struct Entry
+    {
+        std::string name;
+        bool        directory;
+        off_t       size;
+        time_t      mtime;
+    };
+
+    static bool render(const std::string& directory, const std::string& uri, Format format, std::string& body);
+    static bool scan(const std::string& directory, std::vector<Entry>& entries);
+
+private:
+    static void renderHtml(const std::string& uri, const std::vector<Entry>& entries, std::string& body);
+    static void renderJson(const std::vector<Entry>& entries, std::string& body);
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef GLOBALCONFIG_HPP
+#define GLOBALCONFIG_HPP
+
+#include <string>
+#include <map>
+#include <cstddef>
+#include "Upstream.hpp"
+#include "ConfigParser.hpp"
+
+// Directives that appear outside of any server { } block and apply to the
+// whole process rather than to a single virtual host.
+class GlobalConfig {
+private:
+    size_t  _workerConnections;
+    size_t  _limitConnPerIp;
+    double  _limitReqRate;
+    double  _limitReqBurst;
+    unsigned long _clientHeaderTimeout;
+    unsigned long _clientBodyTimeout;
+    unsigned long _sendTimeout;
+    unsigned long _keepaliveTimeout;
+    unsigned long _proxyConnectTimeout;
+    unsigned long _proxyReadTimeout;
+    unsigned long _cgiTimeout;
+    size_t  _clientHeaderBufferSize;
+    size_t  _sslSessionCache;
+    unsigned long _sslSessionTimeout;
+    bool    _sslSessionTickets;
+    size_t  _cacheMemSize;
+    std::string _cachePath;
+    size_t  _cacheMaxSize;
+    size_t  _openFileCacheMax;
+    unsigned long _openFileCacheInactive;
+    unsigned long _openFileCacheValid;
+    std::map<std::string, UpstreamConfig> _upstreams;
+
+public:
+    GlobalConfig();
+
+    void parseDirective(const ConfigNode& directive);
+    void parseUpstreamBlock(const ConfigNode& block);
+    void print() const;
+
+    size_t getWorkerConnections() const;
+    size_t getLimitConnPerIp() const;
+    double getLimitReqRate() const;
+    double getLimitReqBurst() const;
+
+    // Timeouts, in milliseconds
+    unsigned long getClientHeaderTimeout() const;
+    unsigned long getClientBodyTimeout() const;
+    unsigned long getSendTimeout() const;
+    unsigned long getKeepaliveTimeout() const;
+    unsigned long getProxyConnectTimeout() const;
+    unsigned long getProxyReadTimeout() const;
+    unsigned long getCgiTimeout() const;
+
+    // Largest request head accepted, in bytes
+    size_t getClientHeaderBufferSize() const;
+
+    // TLS session resumption
+    size_t getSslSessionCache() const;
+    unsigned long getSslSessionTimeout() const;
+    bool getSslSessionTickets() const;
+
+    // Response cache, sizes in bytes
+    size_t getCacheMemSize() const;
+    const std::string& getCachePath() const;
+    size_t getCacheMaxSize() const;
+
+    // Open file cache: entries (0 when off), durations in milliseconds
+    size_t getOpenFileCacheMax() const;
+    unsigned long getOpenFileCacheInactive() const;
+    unsigned long getOpenFileCacheValid() const;
+
+    const std::map<std::string, UpstreamConfig>& getUpstreams() const;
+
+    static unsigned long parseDuration(const std::string& value, const std::string& name);
+    static size_t parseSize(const std::string& value, const std::string& name);
+};
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef HEADERSCANNER_HPP
+#define HEADERSCANNER_HPP
+
+#include <cstddef>
+#include <string>
+
+// Byte scanning for request heads. Line ends and ':' are located 32 bytes
+// at a time with AVX2 or 16 with SSE2, picked once at startup from what
+// the CPU supports, with a scalar loop elsewhere. Token and target
+// characters are checked against 256-entry tables.
+class HeaderScanner
+{
+public:
+    static const size_t npos = static_cast<size_t>(-1);
+
+    static size_t findHeadEnd(const char* data, size_t length);
+    static size_t findLineEnd(const char* data, size_t length, size_t& colon);
+
+    static bool isToken(const char* data, size_t length);
+    static bool isTarget(const char* data, size_t length);
+    static bool isVersion(const char* data, size_t length);
+
+    static const char* implementation();
+    static bool useImplementation(const std::string& name);
+};
+
+#endif
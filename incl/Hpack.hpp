@@ -0,0 +1,61 @@
+#ifndef HPACK_HPP
+#define HPACK_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstddef>
+
+typedef std::pair<std::string, std::string> HeaderField;
+
+// Static plus dynamic table of RFC 7541. Indices are 1-based, the 61
+// static entries first, then the dynamic ones from newest to oldest.
+class HpackTable
+{
+public:
+    HpackTable();
+
+    bool get(size_t index, HeaderField& field) const;
+    size_t find(const HeaderField& field, bool& nameOnly) const;
+    void add(const HeaderField& field);
+    void setMaxSize(size_t size);
+    size_t getMaxSize() const;
+
+private:
+    std::deque<HeaderField> _entries;
+    size_t  _size;
+    size_t  _maxSize;
+
+    void evict(size_t needed);
+};
+
+// Each direction of a connection has its own dynamic table: the decoder
+// follows the client's request headers, the encoder our response headers.
+class HpackDecoder
+{
+public:
+    static const size_t MAX_HEADER_LIST_SIZE = 65536;
+
+    HpackDecoder();
+
+    bool decode(const std::string& block, std::vector<HeaderField>& headers);
+
+private:
+    HpackTable  _table;
+};
+
+class HpackEncoder
+{
+public:
+    HpackEncoder();
+
+    void encode(const std::vector<HeaderField>& headers, std::string& block);
+    void setMaxTableSize(size_t size);
+
+private:
+    HpackTable  _table;
+    size_t      _pendingSize;
+    bool        _sizeChanged;
+};
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef HTTP2CONNECTION_HPP
+#define HTTP2CONNECTION_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <cstddef>
+#include "Hpack.hpp"
+#include "ChunkedParser.hpp"
+
+// Server side of one HTTP/2 connection (RFC 9113), without any I/O: bytes
+// read from the socket go to feed(), frames to write come out of
+// produce(). Requests are handed out as HTTP/1.1 style messages so they
+// go through the same routing and handlers as HTTP/1.1 clients, and the
+// HTTP/1.1 responses produced for them are fed back with respond() and
+// turned into HEADERS and DATA frames.
+//
+// A request with a body is first handed out by its head alone, so the
+// caller can set the body's size limit with limitBody(). The stream gets
+// window credit only for body bytes accepted under that limit. A body
+// that goes over it is dropped and the stream reported by nextOversized().
+//
+// DATA is scheduled by urgency (RFC 9218 "priority" header), then by the
+// RFC 7540 dependency tree: a stream waits while an ancestor has data
+// ready, and siblings share the connection by weight.
+class Http2Connection
+{
+public:
+    Http2Connection();
+
+    bool feed(const char* data, size_t length);
+    bool nextRequestHead(unsigned int& stream, std::string& head);
+    void limitBody(unsigned int stream, size_t limit);
+    bool nextOversized(unsigned int& stream, std::string& head);
+    bool nextRequest(unsigned int& stream, std::string& rawRequest);
+    bool nextReset(unsigned int& stream);
+
+    void respond(unsigned int stream, const char* data, size_t length);
+    void endResponse(unsigned int stream);
+    void resetStream(unsigned int stream);
+
+    size_t produce(std::string& out, size_t budget);
+    bool wantsWrite() const;
+    void goAway();
+    bool isFinished() const;
+    size_t activeStreams() const;
+    bool awaitingClient() const;
+
+    static const char* const PREFACE;
+
+private:
+    enum FrameType { DATA, HEADERS, PRIORITY, RST_STREAM, SETTINGS, PUSH_PROMISE, PING, GOAWAY, WINDOW_UPDATE, CONTINUATION };
+    enum ErrorCode { NO_ERROR, PROTOCOL_ERROR, INTERNAL_ERROR, FLOW_CONTROL_ERROR, SETTINGS_TIMEOUT,
+        STREAM_CLOSED, FRAME_SIZE_ERROR, REFUSED_STREAM, CANCEL, COMPRESSION_ERROR, CONNECT_ERROR, ENHANCE_YOUR_CALM };
+
+    struct Stream
+    {
+        bool            requestDone;
+        bool            dispatched;
+        std::string     method;
+        std::string     request;
+        std::string     body;
+        size_t          bodyLimit;
+        bool            awaitingLimit;
+        bool            oversized;
+        size_t          unacked;
+        long            sendWindow;
+
+        std::string     head;
+        bool            headersSent;
+        bool            chunked;
+        bool            untilEnd;
+        size_t          remaining;
+        ChunkedParser   chunks;
+        std::string     data;
+        size_t          dataOffset;
+        bool            ended;
+        bool            endSent;
+        int             urgency;
+        unsigned long   pass;
+
+        Stream();
+    };
+
+    struct Priority
+    {
+        unsigned int    parent;
+        int             weight;
+    };
+
+    std::string                         _input;
+    bool                                _prefaceSeen;
+    bool                                _settingsSeen;
+    std::map<unsigned int, Stream>      _streams;
+    std::map<unsigned int, Priority>    _tree;
+    std::deque<unsigned int>            _heads;
+    std::deque<unsigned int>            _oversized;
+    std::deque<unsigned int>            _ready;
+    std::deque<unsigned int>            _resets;
+    std::string                         _control;
+    HpackDecoder                        _decoder;
+    HpackEncoder                        _encoder;
+    std::string                         _headerBlock;
+    unsigned int                        _headerStream;
+    bool                                _headerEndStream;
+    unsigned int                        _lastStream;
+    long                                _sendWindow;
+    size_t                              _recvUnacked;
+    long                                _peerInitialWindow;
+    size_t                              _peerMaxFrame;
+    unsigned long                       _virtualTime;
+    bool                                _goingAway;
+    bool                                _failed;
+
+    bool processFrame(unsigned char type, unsigned char flags, unsigned int stream, const char* payload, size_t length);
+    bool onData(unsigned char flags, unsigned int stream, const char* payload, size_t length);
+    bool onHeaders(unsigned char flags, unsigned int stream, const char* payload, size_t length);
+    bool onHeaderBlock();
+    bool onSettings(unsigned char flags, const char* payload, size_t length);
+    bool onWindowUpdate(unsigned int stream, const char* payload, size_t length);
+    bool buildRequest(Stream& stream, const std::vector<HeaderField>& headers);
+    void finishRequest(unsigned int id, Stream& stream);
+    void rejectBody(unsigned int id, Stream& stream);
+    void creditStream(unsigned int id, Stream& stream);
+    void completeStream(unsigned int id);
+    void setPriority(unsigned int stream, unsigned int parent, int weight, bool exclusive);
+    bool blockedByAncestor(unsigned int stream, const std::vector<unsigned int>& ready) const;
+    void closeStream(unsigned int stream);
+    void abortStream(unsigned int stream, ErrorCode code);
+    void sendResponseHeaders(unsigned int id, Stream& stream);
+    void writeFrame(std::string& out, unsigned char type, unsigned char flags, unsigned int stream, const char* payload, size_t length) const;
+    void writeWindowUpdate(unsigned int stream, size_t increment);
+    void writeReset(unsigned int stream, ErrorCode code);
+    bool fail(ErrorCode code);
+    bool sendable(const Stream& stream) const;
+};
+
+#endif
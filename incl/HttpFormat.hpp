@@ -0,0 +1,25 @@
+#ifndef HTTPFORMAT_HPP
+#define HTTPFORMAT_HPP
+
+#include <string>
+#include <cstddef>
+#include <ctime>
+
+// Number and date formatting for response heads, without streams or
+// temporary strings. The "Date:" and "Server:" lines are rendered at
+// most once per second and shared by every response built in it.
+class HttpFormat
+{
+public:
+    enum { MAX_DIGITS = 20, DATE_LENGTH = 29 };
+
+    static size_t formatUnsigned(unsigned long long value, char* out);
+    static size_t formatSigned(long long value, char* out);
+    static void appendUnsigned(std::string& out, unsigned long long value);
+    static std::string toString(long long value);
+
+    static void formatDate(time_t when, char* out);
+    static const std::string& commonHeaders();
+};
+
+#endif
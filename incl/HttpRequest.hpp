@@ -16,6 +16,10 @@
 #include "ServerConfig.hpp"
 #include <sys/stat.h>
 #include "ServerLocation.hpp"
+#include "UploadSink.hpp"
+#include "OpenFileCache.hpp"
+#include "Arena.hpp"
+#include "HttpFormat.hpp"
 #include <ctime>
 
 class HttpRequest
@@ -25,30 +29,78 @@ private:
     std::string _path;
     std::string _httpVersion;
     std::string _body;
-    std::map<std::string, std::string> _headers;
+    std::string _cgiScript;
+
+public:
+    // Headers the server itself looks at, resolved once while parsing.
+    enum KnownHeader
+    {
+        HOST,
+        CONTENT_LENGTH,
+        CONTENT_TYPE,
+        CONNECTION,
+        TRANSFER_ENCODING,
+        RANGE,
+        IF_NONE_MATCH,
+        KNOWN_HEADER_COUNT
+    };
+
+private:
+    // Header names and values point into a copy of the request head kept
+    // in the request arena, released when the request is destroyed. Names
+    // are matched case-insensitively; hash is over the lowercased name.
+    struct Header
+    {
+        const char* name;
+        size_t      nameLength;
+        const char* value;
+        size_t      valueLength;
+        unsigned    hash;
+    };
+    Arena&          _arena;
+    Arena::Mark     _mark;
+    Header*         _headers;
+    size_t          _headerCount;
+    const Header*   _known[KNOWN_HEADER_COUNT];
+    bool            _malformed;
+
+    HttpRequest(const HttpRequest&);
+    HttpRequest& operator=(const HttpRequest&);
+
+    size_t parseHead(const std::string& rawRequest);
+    const Header* findHeader(const char* name) const;
+    bool headerIs(KnownHeader id, const char* value) const;
 	
 public:
-	HttpRequest(const std::string rawRequest);
+	HttpRequest(const std::string& rawRequest);
 	~HttpRequest();
 
 	std::string handleRequest(ServerConfig& config);
 	std::string resolveFilePath(const ServerConfig& config);
 	std::string readFile(const std::string& filePath);
 	std::string handleGet(ServerConfig& config);
+	bool handlePacked(const ServerLocation& location, std::string& response);
+	std::string handleAutoindex(ServerConfig& config, const ServerLocation& location, const std::string& directory);
+	std::string redirectToDirectory(const std::string& location);
 	std::string	handlePost(ServerConfig& config);
 	std::string handleDownload(ServerConfig& config, std::string& response);
-	std::string uploadTxt(ServerConfig& config, std::string response);
-	std::string uploadFile(ServerConfig& config, std::string response, std::string contentType);
+	std::string uploadTxt(ServerConfig& config);
+	std::string uploadFile(ServerConfig& config, const std::string& contentType);
+	std::string storeUpload(ServerConfig& config, const std::string& fileName, const char* data, size_t length);
 	std::string handleDelete(ServerConfig& config);
 	std::string findErrorPage(ServerConfig& config, int errorCode);
-	std::string getMimeType(const std::string& filePath);
+	const char* getMimeType(const ServerConfig& config, const std::string& filePath);
 	std::string getPath() const;
 	std::string getMethod() const;
+	const std::string& getBody() const;
+	const std::string& getCGIScript() const;
 	std::string getHeaderValue(const std::string& headerName) const;
+	const char* headerValue(KnownHeader id) const;
+	const char* headerValue(const char* name) const;
 	std::string getHttpVersion(void);
-	std::string handleParentProcess(int outputPipe[2], int inputPipe[2], pid_t pid);
+	bool isMalformed() const;
 	std::string constructCGIResponse(const std::string& output);
-	std::string executeCGI(const std::string& scriptPath, ServerConfig& config);
+	std::string prepareCGI(const std::string& scriptPath);
 	std::string generateDefaultErrorPage(int errorCode);
 	std::string intToString(int value);
 	std::string extractJsonValue(const std::string& json, const std::string& key);
@@ -57,7 +109,7 @@ public:
 	void setupChildProcess(int outputPipe[2], int inputPipe[2], const std::string& scriptPath);
 	std::vector<char*> setupCGIEnvironment(const std::string& scriptPath);
 
-	bool ensureUploadDirectoryExists();
+	bool ensureUploadDirectoryExists(const std::string& directory);
 	bool isFileAccessible(const std::string& filePath);
 
 	int extractStatusCode(const std::string& response);
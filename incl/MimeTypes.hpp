@@ -0,0 +1,19 @@
+#ifndef MIMETYPES_HPP
+#define MIMETYPES_HPP
+
+#include <cstddef>
+
+// Built-in extension -> MIME type table. The entries live in a sorted,
+// read-only array so a lookup is a binary search that never allocates.
+class MimeTypes
+{
+public:
+    static const char* lookup(const char* extension, size_t length);
+    static const char* fromPath(const char* path, size_t length);
+    static const char* defaultType();
+
+    static int compareExtension(const char* a, size_t aLength, const char* b, size_t bLength);
+    static bool extensionOf(const char* path, size_t length, const char*& extension, size_t& extLength);
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef OPENFILECACHE_HPP
+#define OPENFILECACHE_HPP
+
+#include <string>
+#include <map>
+#include <list>
+#include <ctime>
+#include <sys/types.h>
+
+// "open_file_cache max=N inactive=T valid=T": keeps the stat result and an
+// open descriptor for recently used paths, including paths that were not
+// found. An entry is checked against the filesystem again once it is
+// older than valid, and closed after going unused for inactive; past max
+// entries the least recently used one goes. With the cache off every call
+// goes to the filesystem as before.
+class OpenFileCache
+{
+public:
+    struct Info
+    {
+        int     error;
+        mode_t  mode;
+        off_t   size;
+        time_t  mtime;
+        bool    readable;
+        bool    writable;
+    };
+
+    struct Counters
+    {
+        unsigned long hits;
+        unsigned long misses;
+        unsigned long revalidated;
+        unsigned long evicted;
+    };
+
+    static void configure(size_t max, unsigned long inactiveMs, unsigned long validMs);
+    static bool stat(const std::string& path, Info& info);
+    static bool read(const std::string& path, std::string& content);
+    static void invalidate(const std::string& path);
+    static void clear();
+    static const Counters& counters();
+
+private:
+    struct Entry
+    {
+        Info                                info;
+        int                                 fd;
+        dev_t                               device;
+        ino_t                               inode;
+        unsigned long                       validated;
+        unsigned long                       used;
+        std::list<std::string>::iterator    lru;
+    };
+
+    static std::map<std::string, Entry> _entries;
+    static std::list<std::string> _lru;
+
+    static std::string normalize(const std::string& path);
+    static Entry* lookup(const std::string& requested);
+    static void fill(const std::string& path, Entry& entry, bool keepOpen);
+    static void release(Entry& entry);
+    static void evictInactive(unsigned long now);
+    static void erase(std::map<std::string, Entry>::iterator it);
+    static bool readAll(int fd, size_t size, std::string& content);
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef RESPONSECACHE_HPP
+#define RESPONSECACHE_HPP
+
+#include <string>
+#include <map>
+#include <list>
+#include <vector>
+#include <ctime>
+#include <cstddef>
+
+class HttpRequest;
+
+// Shared cache for CGI and proxied responses, keyed by method, scope
+// (scheme and listening port), Host and URI, plus the request headers
+// named by the response's Vary. Only
+// responses that carry an explicit lifetime (Cache-Control max-age /
+// s-maxage or Expires) are stored. Hot entries live in an LRU memory
+// tier; entries evicted from it, or too large for it, go to files under
+// cache_path that are read back in on a hit.
+class ResponseCache
+{
+public:
+    ResponseCache();
+    ~ResponseCache();
+
+    bool configure(size_t memoryLimit, const std::string& diskPath, size_t diskLimit);
+    bool isEnabled() const;
+    size_t maxObjectSize() const;
+    bool lookup(const HttpRequest& request, const std::string& scope, std::string& response);
+    bool store(const HttpRequest& request, const std::string& scope, const std::string& head, const std::string& body);
+    void clear();
+
+    static bool isCacheableRequest(const HttpRequest& request);
+    static std::string primaryKey(const HttpRequest& request, const std::string& scope);
+    static long freshnessLifetime(const std::string& head, std::time_t now);
+    static std::string headerValue(const std::string& head, const std::string& name);
+
+private:
+    struct Entry
+    {
+        std::string     head;
+        std::string     body;
+        std::time_t     stored;
+        std::time_t     expires;
+        std::list<std::string>::iterator lru;
+    };
+
+    struct DiskEntry
+    {
+        std::string     file;
+        size_t          size;
+        std::time_t     expires;
+        std::list<std::string>::iterator lru;
+    };
+
+    // Vary names of a primary key, and how many entries (memory or disk)
+    // are stored under it; dropped along with the last of them.
+    struct Variants
+    {
+        std::vector<std::string> names;
+        size_t          entries;
+
+        Variants() : entries(0) {}
+    };
+
+    size_t                          _memoryLimit;
+    size_t                          _memoryUsed;
+    size_t                          _diskLimit;
+    size_t                          _diskUsed;
+    unsigned long                   _fileSequence;
+    std::string                     _diskPath;
+    std::map<std::string, Entry>    _memory;
+    std::list<std::string>          _memoryLru;
+    std::map<std::string, DiskEntry> _disk;
+    std::list<std::string>          _diskLru;
+    std::map<std::string, Variants> _vary;
+
+    ResponseCache(const ResponseCache&);
+    ResponseCache& operator=(const ResponseCache&);
+
+    void countVariant(const std::string& key, bool added);
+    size_t maxMemoryObject() const;
+    void insertMemory(const std::string& key, const Entry& entry);
+    void evictMemory(size_t needed);
+    void removeMemory(std::map<std::string, Entry>::iterator it);
+    bool writeDisk(const std::string& key, const Entry& entry);
+    bool readDisk(std::map<std::string, DiskEntry>::iterator it, Entry& entry);
+    void evictDisk(size_t needed);
+    void removeDisk(std::map<std::string, DiskEntry>::iterator it);
+    void removeStaleFiles() const;
+    std::string nextFile();
+
+    static std::string variantKey(const std::string& primary, const std::vector<std::string>& names, const HttpRequest& request);
+    static std::string render(const Entry& entry, std::time_t now);
+    static size_t sizeOf(const std::string& key, const Entry& entry);
+};
+
+#endif
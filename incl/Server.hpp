@@ -30,7 +30,103 @@
 #include <ctime>
 #include <memory>
 #include <iomanip>
+#include <cerrno>
+#include <set>
+#include <map>
+#include <list>
 #include "ServerConfig.hpp"
+#include "GlobalConfig.hpp"
+#include "ClientLimiter.hpp"
+#include "TimerWheel.hpp"
+#include "Upstream.hpp"
+#include "ChunkedParser.hpp"
+#include "ResponseCache.hpp"
+#include "TlsContext.hpp"
+#include "Http2Connection.hpp"
+#include "ServerLocation.hpp"
+#include "VirtualHostIndex.hpp"
+#include "OpenFileCache.hpp"
+#include "HttpFormat.hpp"
+#include "HeaderScanner.hpp"
+
+class HttpRequest;
+
+struct ProxySession {
+    int             clientFd;
+    int             upstreamFd;
+    std::string     upstream;
+    unsigned int    generation;
+    std::string     peer;
+    std::vector<int> tried;
+    bool            connected;
+    bool            reused;
+    std::string     request;
+    size_t          sent;
+    std::string     head;
+    bool            headersDone;
+    bool            noBody;
+    bool            chunked;
+    bool            untilClose;
+    bool            keepAlive;
+    size_t          remaining;
+    size_t          received;
+    int             status;
+    ChunkedParser   chunkParser;
+    std::string     logLine;
+    std::string     hashKey;
+    bool            headRequest;
+    bool            safeMethod;
+    bool            complete;
+    std::string     cacheRequest;
+    std::string     cacheScope;
+    std::string     cacheBody;
+    std::string     cacheLeader;
+
+    ProxySession();
+};
+
+struct CgiSession {
+    pid_t           pid;
+    int             outputFd;
+    int             inputFd;
+    std::string     input;
+    size_t          written;
+    std::string     output;
+    std::string     rawRequest;
+    std::string     flightKey;
+    std::vector<int> clients;
+    bool            cacheable;
+    std::string     cacheScope;
+    bool            outputDone;
+    int             status;
+
+    CgiSession();
+};
+
+// A request whose head has arrived, held to the body size limit of the
+// server and location it resolved to while the body is still coming in.
+// Only the limit is kept: a reload may replace the server meanwhile.
+struct PendingBody {
+    size_t          headEnd;
+    size_t          limit;
+    bool            chunked;
+    size_t          contentLength;
+    size_t          consumed;
+    ChunkedParser   chunks;
+
+    PendingBody();
+};
+
+// A configuration generation replaced by a reload. It stays alive, with
+// its upstream pools, until the last connection open at the time of the
+// reload is gone, so requests already under way finish on it.
+struct RetiredConfig {
+    unsigned int                    generation;
+    std::vector<ServerConfig>       configs;
+    std::vector<ConfigNode>         blocks;
+    std::map<std::string, Upstream> upstreams;
+    std::set<int>                   clients;
+};
 
 class Server {
 private:
@@ -38,40 +134,184 @@ private:
     bool parseConfigFile(std::string configFile);
     void printServerBlocks() const;
     bool parseFileInBlock(std::string configFile);
+    void reloadConfiguration();
+    void releaseRetiredConfigs(int client_fd);
+    void applyGlobalConfig();
+
+    // Signals, graceful drain and binary upgrade
+    bool handleSignals();
+    void openSignalPipe();
+    void drainSignalPipe();
+    void beginDrain();
+    void spawnUpgrade();
+    void adoptInheritedListeners();
+    void notifyUpgradeParent();
 
     // Sockets
-    int createSocket();
-    void configureSocket(int server_fd);
-    void bindSocket(int server_fd, int port);
-    void listenOnSocket(int server_fd);
+    int createSocket(int family);
+    void configureSocket(int server_fd, int family, const ListenOptions& options);
+    int bindSocket(const ListenOptions& options);
+    void tuneSocket(int server_fd, const ListenOptions& options);
+    void listenOnSocket(int server_fd, int backlog);
     void addServerSocketToPoll(int server_fd);
+    void closeListener(int server_fd);
     void cleanupSockets();
     void cleanup();
     bool isServerSocket(int fd) const;
 
     // Handle connections
     void handleNewConnection(int server_fd);
+    void acceptClient(int server_fd, int client_fd, const sockaddr_storage& client_addr);
+    void shedConnection(int server_fd);
     void handleClientRequest(int clientIndex);
+    void dispatchRequest(int client_fd, const std::string& rawRequest, bool coalesce);
     void logResponseDetails(const std::string& response, const std::string& path);
     std::string readClientRequest(int client_fd, int clientIndex);
-    void unchunk();
-    std::string chunkedToBody(int client_fd, int clientIndex, std::string buffer, size_t transferEncodingPos);
+    ServerConfig* resolveConfig(int client_fd, const HttpRequest& request);
+    int beginRequestBody(int client_fd, size_t headEnd);
+    int receiveRequestBody(PendingBody& body, const std::string& pending);
+    std::string dechunkRequest(const std::string& pending, const PendingBody& body);
+    void rejectRequest(int clientIndex, int status);
+    void lingerClient(int clientIndex);
+    void discardClientInput(int clientIndex);
     void removeClient(int index);
+    void sendClientResponse(int clientIndex);
+    void setCork(int client_fd, bool corked);
+
+    // TLS
+    void buildTlsContexts(std::map<std::string, TlsContext>& contexts);
+    void attachTlsListener(int server_fd, const ServerConfig& config, const ListenOptions& options);
+    bool startTls(int client_fd, int server_fd);
+    void continueTlsHandshake(int clientIndex);
+    int markTlsPending();
+    ssize_t clientRecv(int client_fd, char* buffer, size_t length);
+    ssize_t clientSend(int client_fd, const char* data, size_t length);
+
+    // HTTP/2; each stream is a client of its own, identified by a negative
+    // handle so it never collides with a socket
+    void startHttp2(int clientIndex, const std::string& received);
+    void readHttp2(int clientIndex);
+    int openStreamHandle(int client_fd, unsigned int stream);
+    void dispatchHttp2Requests(int client_fd);
+    void flushHttp2(int client_fd);
+    void settleHttp2(int clientIndex);
+    void dropHttp2Stream(int handle);
+    void closeHttp2Streams(int client_fd);
+    void endClientResponse(int client_fd);
+    void abortClient(int client_fd);
+    int connectionFd(int client_fd) const;
+    bool isClientAlive(int client_fd) const;
+    static bool isStreamHandle(int client_fd);
+
+    // Poll set bookkeeping
+    int findPollIndex(int fd) const;
+    void addToPoll(int fd, short events);
+    void releasePollSlot(int index);
+    void compactPollFds();
+
+    // Reverse proxy
+    void buildUpstreams(std::map<std::string, Upstream>& upstreams);
+    Upstream* findUpstream(const ProxySession& session);
+    void startProxy(int client_fd, HttpRequest& request, const std::string& rawRequest, const ServerLocation& location, ServerConfig& config, const std::string& cacheLeader);
+    bool connectProxySession(ProxySession& session);
+    void handleUpstreamEvent(int index);
+    void onUpstreamData(ProxySession& session, const char* data, size_t length);
+    void parseUpstreamHead(ProxySession& session);
+    void failProxySession(int upstreamFd, int status, bool retry);
+    void finishProxySession(int upstreamFd, bool reusable);
+    void queueClientData(int client_fd, const std::string& data);
+    std::string buildUpstreamRequest(const std::string& rawRequest, int client_fd, const std::string& upstreamHost);
+
+    // CGI, run asynchronously; identical concurrent GETs share one run
+    void startCGI(int client_fd, HttpRequest& request, const std::string& rawRequest, const ServerConfig& config);
+    void handleCgiEvent(int index);
+    void reapCgiSessions();
+    void finishCgiSession(int outputFd, bool aborted);
+    void detachCgiClient(int client_fd);
+
+    // Response cache
+    std::string cacheScope(int client_fd);
+    void storeResponse(const HttpRequest& request, const std::string& scope, const std::string& response);
+    void releaseCacheWaiters(const std::string& key);
+    void forgetCacheWaiter(int client_fd);
+
+    // Per-connection deadlines
+    void armClientTimer(int client_fd, int kind, unsigned long delay = 0);
+    void cancelClientTimer(int client_fd);
+    void handleTimeouts();
+    void rejectConnection(int client_fd, const char* response);
+    bool allowClientRequest(int client_fd);
     void validateServerConfigurations();
     void displayConfigs(const std::vector<ServerConfig>& configs);
     
     // Variables
     bool running;
+    std::string _configFile;
+    std::string _binaryPath;
+    unsigned int _generation;
+    bool _draining;
+    std::time_t _drainDeadline;
+    pid_t _upgradePid;
     std::vector<int> _server_fds;
     std::vector<int> _ports;
-    std::vector<sockaddr_in> _addresses;
     std::vector<pollfd> _poll_fds;
-    std::vector<std::string> serverBlocks;
+    std::vector<ConfigNode> serverBlocks;
     std::vector<ServerConfig> _configs;
+    std::list<RetiredConfig> _retiredConfigs;
+    VirtualHostIndex _virtualHosts;
+    GlobalConfig _global;
+    ClientLimiter _limiter;
+    std::map<int, ClientLimiter::Key> _clientAddresses;
+    TimerWheel _timers;
+    std::map<int, TimerWheel::Timer> _clientTimers;
+    std::map<std::string, Upstream> _upstreams;
+    std::map<int, ProxySession> _proxySessions;
+    std::map<int, int> _clientProxy;
+    std::set<int> _closeAfterSend;
+    std::set<int> _lingering;
+    ResponseCache _cache;
+    std::map<std::string, std::vector<std::pair<int, std::string> > > _cacheWaiters;
+    std::map<int, CgiSession> _cgiSessions;
+    std::map<int, int> _cgiInputs;
+    std::map<int, int> _clientCgi;
+    std::map<std::string, int> _cgiFlights;
+    std::map<std::string, TlsContext> _tlsContexts;
+    std::map<int, TlsContext> _tlsListeners;
+    std::map<int, SSL*> _tlsClients;
+    std::set<int> _tlsPending;
+    std::set<int> _h2Listeners;
+    std::map<int, Http2Connection> _h2Connections;
+    std::map<int, std::pair<int, unsigned int> > _h2Streams;
+    int _nextStreamHandle;
     std::map<int, ServerConfig*> _socketToConfig;
+    std::map<std::pair<std::string, int>, int> _listeners;
+    std::map<int, ListenOptions> _listenerOptions;
+    std::set<int> _corkedClients;
+    std::map<int, int> _clientToServer;
+    std::map<int, int> _clientPorts;
+    int _reserveFd;
+    std::set<int> _idleClients;
     std::map<int, std::string> responseBuffer;
     std::map<int, std::string> clientBuffers;
+    std::map<int, size_t> _headScanned;
+    std::map<int, PendingBody> _pendingBodies;
     static volatile sig_atomic_t signal_received;
+    static volatile sig_atomic_t reload_requested;
+    static volatile sig_atomic_t drain_requested;
+    static volatile sig_atomic_t upgrade_requested;
+    static volatile sig_atomic_t child_exited;
+    static int signal_pipe[2];
+    static const int DRAIN_TIMEOUT = 30;
+    static const unsigned long LINGER_TIMEOUT = 5000;
+    static const size_t HTTP2_WRITE_BUDGET = 65536;
+    static const size_t ACCEPT_BUDGET = 64;
+    static const char* const LISTEN_FDS_ENV;
+    static const char* const PARENT_PID_ENV;
+    static const char* const SERVICE_UNAVAILABLE_RESPONSE;
+    static const char* const TOO_MANY_REQUESTS_RESPONSE;
+    static const char* const REQUEST_TIMEOUT_RESPONSE;
+
+    enum TimerKind { TIMER_HEADER, TIMER_BODY, TIMER_SEND, TIMER_KEEPALIVE, TIMER_PROXY, TIMER_CGI, TIMER_LINGER };
 public:
     Server(const std::string configFile);
     ~Server();
@@ -82,6 +322,7 @@ public:
     void stop();
     bool isRunning() const;
     void setRunning(bool status);
+    void setBinaryPath(const std::string& path);
 
     static void signalHandler(int signal);
 
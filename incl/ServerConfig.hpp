@@ -2,6 +2,7 @@
 #define SERVERCONFIG_HPP
 
 #include "ServerLocation.hpp"
+#include "ConfigParser.hpp"
 #include <string>
 #include <vector>
 #include <map>
@@ -14,24 +15,51 @@
 #include <cstdlib>
 #include <unistd.h>
 
+// One "listen" directive: a TCP address (IPv4 or IPv6) or a Unix-domain
+// socket path, with the options of the socket bound for it.
+struct ListenOptions {
+    std::string host;
+    int port;
+    std::string path;
+    bool ipv6only;
+    int backlog;
+    bool ssl;
+    bool http2;
+    bool deferred;
+    int fastopen;
+    size_t rcvbuf;
+    size_t sndbuf;
+
+    ListenOptions();
+    bool isUnix() const;
+    std::string address() const;
+};
+
 class ServerConfig {
 private:
     std::vector<int>               _ports;                   
+    std::vector<ListenOptions>     _listens;
     std::string                    _root;
     std::string                    _index;
     std::map<int, std::string>     _error_pages;
     std::vector<ServerLocation>    _locations;
     std::string                    _serverName;
+    std::vector<std::string>       _serverNames;
     std::string                    _host;
     size_t                         _clientMaxBodySize;
+    std::string                    _sslCertificate;
+    std::string                    _sslCertificateKey;
+    std::vector<std::pair<std::string, std::string> > _mimeTypes;
     std::string rawBlock;
 public:
     // Default constructor
     ServerConfig();
-    void parseServerBlock(const std::string& serverBlock);
-    void parseLocationBlock(const std::string& locationBlock, ServerLocation& location);
-    void handleErrorPageDirective(const std::string& line);
-    void handleLocationDirective(const std::string& line, const std::string& serverBlock, size_t& pos);
+    void parseServerBlock(const ConfigNode& serverBlock);
+    void parseLocationBlock(const ConfigNode& locationBlock, ServerLocation& location);
+    void handleErrorPageDirective(const ConfigNode& directive);
+    void handleLocationDirective(const ConfigNode& directive);
+    void handleTypesDirective(const ConfigNode& directive);
+    void handleListenDirective(const ConfigNode& directive);
 
     void print() const;
     void clear();
@@ -41,8 +69,14 @@ public:
     // Getters and Setters
     void setPort(int serverPort);
     const std::vector<int>& getPorts() const;
+    const std::vector<ListenOptions>& getListens() const;
+    bool listensOn(const std::string& host, int port) const;
+    bool hasSslListener() const;
+    const std::string& getSslCertificate() const;
+    const std::string& getSslCertificateKey() const;
 
     size_t getClientMaxBodySize() const;
+    size_t getClientMaxBodySize(const std::string& path) const;
     void setClientMaxBodySize(size_t size);
 
     void setRoot(const std::string& rootPath);
@@ -54,14 +88,21 @@ public:
     void setErrorPage(int code, const std::string& path);
     std::string getErrorPage(int errorCode) const;
 
-    void setServerName(const std::string& name);
+    void addServerName(const std::string& name);
     const std::string& getServerName(void);
+    const std::vector<std::string>& getServerNames() const;
+    bool sharesServerName(const ServerConfig& other) const;
 
     void setHost(const std::string& host);
     const std::string& getHost() const;
 
     void addLocation(const ServerLocation& location);
     const std::vector<ServerLocation>& getLocations() const;
+    const ServerLocation* findProxyLocation(const std::string& path) const;
+    const ServerLocation* findLocation(const std::string& path) const;
+
+    void addMimeType(const std::string& extension, const std::string& type);
+    const char* getMimeType(const std::string& filePath) const;
 
 	int	getValid() const;
     std::string toString() const;
@@ -3,6 +3,8 @@
 
 #include <string>
 #include <map>
+#include "DirectoryIndex.hpp"
+#include "UploadSink.hpp"
 
 class ServerLocation {
 private:
@@ -12,6 +14,15 @@ private:
     bool _getAllowed;
     bool _postAllowed;
     bool _deleteAllowed;
+    std::string _proxyPass;
+    bool _autoindex;
+    DirectoryIndex::Format _autoindexFormat;
+    std::string _uploadStore;
+    UploadSink::SyncPolicy _uploadSync;
+    bool _uploadDirect;
+    std::string _staticPack;
+    bool _hasClientMaxBodySize;
+    size_t _clientMaxBodySize;
 
 public:
     // Constructor
@@ -36,6 +47,29 @@ public:
     bool isDeleteAllowed() const;
 
     void setAllowedMethods(const std::string& methodsLine);
+    bool isMethodAllowed(const std::string& method) const;
+
+    void setProxyPass(const std::string& target);
+    const std::string& getProxyPass() const;
+
+    void setAutoindex(bool enabled);
+    bool getAutoindex() const;
+    void setAutoindexFormat(DirectoryIndex::Format format);
+    DirectoryIndex::Format getAutoindexFormat() const;
+
+    void setUploadStore(const std::string& directory);
+    const std::string& getUploadStore() const;
+    void setUploadSync(UploadSink::SyncPolicy policy);
+    UploadSink::SyncPolicy getUploadSync() const;
+    void setUploadDirect(bool enabled);
+    bool getUploadDirect() const;
+
+    void setStaticPack(const std::string& path);
+    const std::string& getStaticPack() const;
+
+    void setClientMaxBodySize(size_t size);
+    bool hasClientMaxBodySize() const;
+    size_t getClientMaxBodySize() const;
 
     void display() const;
 };
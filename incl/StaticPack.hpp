@@ -0,0 +1,87 @@
+#ifndef STATICPACK_HPP
+#define STATICPACK_HPP
+
+#include <string>
+#include <map>
+#include <stdint.h>
+#include <sys/types.h>
+
+// A document root baked into one read-only file by "make pack" and mapped
+// at startup by "static_pack" locations. Each entry carries its response
+// head ready to send, the body, and optionally a gzip variant; URIs are
+// found through a hash-and-displace perfect hash, so a lookup is two
+// hashes, one compare and no system call.
+//
+// Layout, in native byte order, offsets from the start of the file:
+//   Header, uint32_t displacements[bucketCount],
+//   uint32_t slots[slotCount] (entry index or EMPTY_SLOT),
+//   Entry entries[entryCount], then the strings and bodies they point at.
+class StaticPack
+{
+public:
+    static const char MAGIC[8];
+    static const uint32_t EMPTY_SLOT = 0xffffffffu;
+
+    struct Header
+    {
+        char        magic[8];
+        uint32_t    entryCount;
+        uint32_t    bucketCount;
+        uint32_t    slotCount;
+        uint32_t    reserved;
+        uint64_t    fileSize;
+    };
+
+    struct Entry
+    {
+        uint32_t    pathOffset;
+        uint32_t    pathLength;
+        uint32_t    headOffset;
+        uint32_t    headLength;
+        uint32_t    gzipHeadOffset;
+        uint32_t    gzipHeadLength;
+        uint64_t    bodyOffset;
+        uint64_t    bodyLength;
+        uint64_t    gzipOffset;
+        uint64_t    gzipLength;
+    };
+
+    struct Hit
+    {
+        const char* head;
+        size_t      headLength;
+        const char* body;
+        size_t      bodyLength;
+    };
+
+    static uint32_t hash(uint32_t seed, const char* data, size_t length);
+    static size_t tableOffset(uint32_t bucketCount, uint32_t slotCount);
+
+    static void load(const std::string& path);
+    static const StaticPack* find(const std::string& path);
+
+    bool lookup(const char* uri, size_t length, bool gzip, Hit& hit) const;
+    uint32_t size() const;
+
+private:
+    const char*     _data;
+    size_t          _size;
+    dev_t           _device;
+    ino_t           _inode;
+    time_t          _mtime;
+    Header          _header;
+    const char*     _entries;
+
+    StaticPack();
+    ~StaticPack();
+    StaticPack(const StaticPack&);
+    StaticPack& operator=(const StaticPack&);
+
+    void map(const std::string& path);
+    uint32_t word(size_t offset) const;
+    bool inBounds(uint64_t offset, uint64_t length) const;
+
+    static std::map<std::string, StaticPack*>& registry();
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef TIMERWHEEL_HPP
+#define TIMERWHEEL_HPP
+
+#include <vector>
+#include <cstddef>
+
+// Hierarchical timing wheel (3 levels of 64 slots). Timers are intrusive
+// list nodes owned by the caller, so arming and cancelling are O(1) and
+// never allocate; expiry cost is proportional to the timers that fire.
+class TimerWheel
+{
+public:
+    enum { LEVELS = 3, SLOT_BITS = 6, SLOTS = 1 << SLOT_BITS };
+
+    struct Timer
+    {
+        int             fd;
+        int             kind;
+        unsigned long   expires;
+        Timer*          prev;
+        Timer*          next;
+
+        Timer();
+        bool isArmed() const;
+    };
+
+    explicit TimerWheel(unsigned long tickMs = 100);
+
+    void arm(Timer& timer, unsigned long delayMs);
+    void cancel(Timer& timer);
+    void advance(std::vector<Timer*>& expired);
+    int nextTimeout() const;
+    size_t size() const;
+
+    static unsigned long nowMs();
+
+private:
+    unsigned long   _tickMs;
+    unsigned long   _current;
+    size_t          _count;
+    Timer           _slots[LEVELS][SLOTS];
+
+    TimerWheel(const TimerWheel&);
+    TimerWheel& operator=(const TimerWheel&);
+
+    void place(Timer& timer);
+    void cascade(int level);
+    static void link(Timer& head, Timer& timer);
+    static void unlink(Timer& timer);
+};
+
+#endif
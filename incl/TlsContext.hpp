@@ -0,0 +1,40 @@
+#ifndef TLSCONTEXT_HPP
+#define TLSCONTEXT_HPP
+
+#include <string>
+#include <cstddef>
+#include <sys/types.h>
+#include <openssl/ssl.h>
+
+// Shared handle on an SSL_CTX holding one certificate/key pair. Copies
+// share the same SSL_CTX (reference counted), so listeners and the config
+// generation that built them can each keep one. Sessions are resumable
+// through the server-side cache and through session tickets, and kernel
+// TLS is requested so record encryption can be offloaded when the kernel
+// and cipher allow it. ALPN offers "h2" on connections accepted for an
+// http2 listener, "http/1.1" otherwise.
+class TlsContext
+{
+public:
+    TlsContext();
+    TlsContext(const std::string& certificate, const std::string& key,
+               size_t sessionCache, unsigned long sessionTimeout, bool sessionTickets);
+    TlsContext(const TlsContext& other);
+    TlsContext& operator=(const TlsContext& other);
+    ~TlsContext();
+
+    bool isValid() const;
+    SSL* accept(int fd, bool http2) const;
+
+    // recv()/send() semantics: -1 with errno EAGAIN while the record layer
+    // waits for the socket, 0 once the peer closed the session.
+    static ssize_t read(SSL* ssl, char* buffer, size_t length);
+    static ssize_t write(SSL* ssl, const char* data, size_t length);
+    static bool negotiatedHttp2(SSL* ssl);
+    static std::string lastError();
+
+private:
+    SSL_CTX*    _ctx;
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef UPLOADSINK_HPP
+#define UPLOADSINK_HPP
+
+#include <string>
+#include <cstddef>
+
+// Writes one uploaded file into an upload store. Data goes to a hidden
+// temporary file next to its destination, preallocated to the expected
+// size, and is renamed into place once complete, so readers never see a
+// partial upload. With "direct", writes bypass the page cache (O_DIRECT
+// through an aligned buffer) so large uploads do not evict hot files.
+class UploadSink
+{
+public:
+    enum SyncPolicy { SYNC_OFF, SYNC_FILE, SYNC_FULL };
+
+    struct Counters
+    {
+        unsigned long   started;
+        unsigned long   completed;
+        unsigned long   failed;
+        unsigned long   active;
+        unsigned long long bytes;
+    };
+
+    UploadSink();
+    ~UploadSink();
+
+    bool open(const std::string& directory, const std::string& name, size_t expected, SyncPolicy sync, bool direct);
+    bool write(const char* data, size_t length);
+    bool commit();
+    void abort();
+    size_t written() const;
+
+    static bool isValidName(const std::string& name);
+    static bool parseSyncPolicy(const std::string& value, SyncPolicy& policy);
+    static const Counters& counters();
+
+private:
+    int             _fd;
+    std::string     _directory;
+    std::string     _tempPath;
+    std::string     _finalPath;
+    SyncPolicy      _sync;
+    bool            _direct;
+    char*           _buffer;
+    size_t          _buffered;
+    size_t          _written;
+
+    bool flushAligned(bool final);
+    bool writeAll(const char* data, size_t length);
+
+    UploadSink(const UploadSink&);
+    UploadSink& operator=(const UploadSink&);
+};
+
+#endif
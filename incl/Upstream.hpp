@@ -0,0 +1,76 @@
+#ifndef UPSTREAM_HPP
+#define UPSTREAM_HPP
+
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+#include "ConfigParser.hpp"
+
+struct UpstreamServer {
+    std::string     host;
+    int             port;
+    int             maxFails;
+    unsigned long   failTimeout;
+
+    UpstreamServer();
+    std::string address() const;
+};
+
+struct UpstreamConfig {
+    enum Balance { ROUND_ROBIN, LEAST_CONN, CONSISTENT_HASH };
+
+    std::string                 name;
+    std::vector<UpstreamServer> servers;
+    Balance                     balance;
+    size_t                      keepalive;
+
+    UpstreamConfig();
+    void parseBlock(const ConfigNode& block);
+    static UpstreamServer parseServer(const std::string& value);
+};
+
+// Runtime state of an upstream group: peer selection, passive health
+// tracking (max_fails within fail_timeout marks a peer down for
+// fail_timeout) and a pool of idle keep-alive connections per peer.
+class Upstream {
+public:
+    struct Peer {
+        UpstreamServer      server;
+        sockaddr_storage    address;
+        socklen_t           addressLength;
+        int                 fails;
+        unsigned long       firstFailure;
+        unsigned long       downUntil;
+        int                 active;
+        std::vector<int>    idle;
+    };
+
+    Upstream();
+    explicit Upstream(const UpstreamConfig& config);
+
+    const std::string& getName() const;
+    size_t peerCount() const;
+    Peer& getPeer(size_t index);
+    int findPeer(const std::string& address) const;
+
+    int selectPeer(const std::string& hashKey, unsigned long now, const std::vector<int>& exclude);
+    int connectPeer(size_t index, bool& reused);
+    void releaseConnection(size_t index, int fd, bool reusable);
+    void reportFailure(size_t index, unsigned long now);
+    void reportSuccess(size_t index);
+    void closeIdle();
+
+private:
+    std::string                                     _name;
+    UpstreamConfig::Balance                         _balance;
+    size_t                                          _keepalive;
+    std::vector<Peer>                               _peers;
+    size_t                                          _next;
+    std::vector<std::pair<unsigned int, size_t> >   _ring;
+
+    bool isAvailable(size_t index, unsigned long now, const std::vector<int>& exclude) const;
+    static unsigned int hash(const std::string& key);
+    static void resolve(Peer& peer);
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef VIRTUALHOSTINDEX_HPP
+#define VIRTUALHOSTINDEX_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include "ServerConfig.hpp"
+
+// Picks the server block for a Host header. Every server_name is stored
+// in a trie keyed by labels, last label first, so a lookup walks at most
+// one node per label of the host:
+//   - an exact name wins;
+//   - then the longest matching "*.example.com" (or ".example.com");
+//   - then a block listening on that literal address and port;
+//   - then the first block listening on the port.
+// Candidates for the same name are kept in configuration order and
+// skipped unless they listen on the requested port.
+class VirtualHostIndex
+{
+public:
+    void build(const std::vector<ServerConfig>& configs);
+    int find(const std::string& host, int port) const;
+
+private:
+    struct Node
+    {
+        std::map<std::string, size_t>  children;
+        std::vector<size_t>             exact;
+        std::vector<size_t>             wildcard;
+    };
+
+    std::vector<Node>                           _nodes;
+    std::vector<std::vector<int> >              _ports;
+    std::map<std::pair<std::string, int>, size_t> _addresses;
+    std::map<int, size_t>                       _defaults;
+
+    size_t nodeFor(const std::string& name);
+    int pick(const std::vector<size_t>& candidates, int port) const;
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include "Arena.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace
+{
+    const size_t kAlignment = 8;
+    // Past this, a full rewind hands every chunk back, so one huge request
+    // does not pin its memory for the life of the process.
+    const size_t kRetained = 256 * 1024;
+}
+
+Arena::Arena(size_t chunkSize) : _chunkSize(chunkSize), _capacity(0), _current(0), _offset(0)
+{
+}
+
+Arena::~Arena()
+{
+    for (size_t i = 0; i < _chunks.size(); ++i)
+        std::free(_chunks[i].data);
+}
+
+// The event loop is single-threaded and every HttpRequest is scoped to
+// the call that handles it, so one arena serves all of them.
+Arena& Arena::requests()
+{
+    static Arena arena;
+    return arena;
+}
+
+// Chunks that turn out too small for a request are skipped rather than
+// split, and a request larger than a chunk gets a chunk of its own.
+void* Arena::allocate(size_t size)
+{
+    size = (size + kAlignment - 1) & ~(kAlignment - 1);
+    while (_current < _chunks.size())
+    {
+        Chunk& chunk = _chunks[_current];
+        if (chunk.size - _offset >= size)
+        {
+            void* block = chunk.data + _offset;
+            _offset += size;
+            return block;
+        }
+        ++_current;
+        _offset = 0;
+    }
+    Chunk chunk;
+    chunk.size = std::max(_chunkSize, size);
+    chunk.data = static_cast<char*>(std::malloc(chunk.size));
+    if (!chunk.data)
+        throw std::bad_alloc();
+    _chunks.push_back(chunk);
+    _capacity += chunk.size;
+    _current = _chunks.size() - 1;
+    _offset = size;
+    return chunk.data;
+}
+
+char* Arena::copy(const char* data, size_t length)
+{
+    char* block = static_cast<char*>(allocate(length + 1));
+    std::memcpy(block, data, length);
+    block[length] = '\0';
+    return block;
+}
+
+Arena::Mark Arena::mark() const
+{
+    Mark mark;
+    mark.chunk = _current;
+    mark.offset = _offset;
+    return mark;
+}
+
+void Arena::rewind(const Mark& mark)
+{
+    _current = mark.chunk;
+    _offset = mark.offset;
+    if (_current == 0 && _offset == 0 && _capacity > kRetained)
+    {
+        for (size_t i = 0; i < _chunks.size(); ++i)
+            std::free(_chunks[i].data);
+        _chunks.clear();
+        _capacity = 0;
+    }
+}
+
+size_t Arena::capacity() const
+{
+    return _capacity;
+}
@@ -0,0 +1,122 @@
+#include "ChunkedParser.hpp"
+
+ChunkedParser::ChunkedParser()
+{
+    reset();
+}
+
+void ChunkedParser::reset()
+{
+    _state = CHUNK_SIZE;
+    _chunkSize = 0;
+    _decodedSize = 0;
+    _sawDigit = false;
+}
+
+bool ChunkedParser::isDone() const
+{
+    return _state == DONE;
+}
+
+bool ChunkedParser::hasError() const
+{
+    return _state == ERROR;
+}
+
+size_t ChunkedParser::getDecodedSize() const
+{
+    return _decodedSize;
+}
+
+void ChunkedParser::endOfSizeLine()
+{
+    if (!_sawDigit)
+        _state = ERROR;
+    else if (_chunkSize == 0)
+        _state = TRAILER_START;
+    else
+        _state = CHUNK_DATA;
+}
+
+// Returns the number of bytes consumed; parsing stops at the end of the
+// body, so anything after it (a pipelined message) is left to the caller.
+size_t ChunkedParser::feed(const char* data, size_t length, std::string* decoded)
+{
+    size_t i = 0;
+
+    while (i < length && _state != DONE && _state != ERROR)
+    {
+        char c = data[i];
+        switch (_state)
+        {
+            case CHUNK_SIZE:
+            {
+                int digit = -1;
+                if (c >= '0' && c <= '9')
+                    digit = c - '0';
+                else if (c >= 'a' && c <= 'f')
+                    digit = c - 'a' + 10;
+                else if (c >= 'A' && c <= 'F')
+                    digit = c - 'A' + 10;
+
+                if (digit >= 0)
+                {
+                    if (_chunkSize > (static_cast<size_t>(-1) >> 4))
+                        _state = ERROR;
+                    _chunkSize = _chunkSize * 16 + digit;
+                    _sawDigit = true;
+                }
+                else if (c == '\n')
+                    endOfSizeLine();
+                else if (c == ';' || c == ' ' || c == '\t')
+                    _state = CHUNK_EXTENSION;
+                else if (c != '\r')
+                    _state = ERROR;
+                ++i;
+                break;
+            }
+            case CHUNK_EXTENSION:
+                if (c == '\n')
+                    endOfSizeLine();
+                ++i;
+                break;
+            case CHUNK_DATA:
+            {
+                size_t take = length - i < _chunkSize ? length - i : _chunkSize;
+                if (decoded)
+                    decoded->append(data + i, take);
+                _decodedSize += take;
+                _chunkSize -= take;
+                i += take;
+                if (_chunkSize == 0)
+                    _state = CHUNK_DATA_END;
+                break;
+            }
+            case CHUNK_DATA_END:
+                if (c == '\n')
+                {
+                    _state = CHUNK_SIZE;
+                    _sawDigit = false;
+                }
+                else if (c != '\r')
+                    _state = ERROR;
+                ++i;
+                break;
+            case TRAILER_START:
+                if (c == '\n')
+                    _state = DONE;
+                else if (c != '\r')
+                    _state = TRAILER_LINE;
+                ++i;
+                break;
+            case TRAILER_LINE:
+                if (c == '\n')
+                    _state = TRAILER_START;
+                ++i;
+                break;
+            default:
+                break;
+        }
+    }
+    return i;
+}
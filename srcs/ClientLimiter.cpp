@@ -0,0 +1,209 @@
+#include "ClientLimiter.hpp"
+#include <cstring>
+#include <ctime>
+#include <netinet/in.h>
+
+namespace
+{
+    const size_t kInitialCapacity = 256;
+}
+
+ClientLimiter::ClientLimiter() : _used(0), _deleted(0), _maxConnections(0), _rate(0), _burst(0)
+{
+    rehash(kInitialCapacity);
+}
+
+void ClientLimiter::configure(size_t maxConnections, double rate, double burst)
+{
+    _maxConnections = maxConnections;
+    _rate = rate;
+    _burst = burst;
+}
+
+ClientLimiter::Key ClientLimiter::keyFromAddress(const sockaddr* address)
+{
+    Key key;
+    std::memset(key.bytes, 0, sizeof(key.bytes));
+    if (address->sa_family == AF_INET)
+    {
+        const sockaddr_in* in4 = reinterpret_cast<const sockaddr_in*>(address);
+        key.bytes[10] = 0xff;
+        key.bytes[11] = 0xff;
+        std::memcpy(key.bytes + 12, &in4->sin_addr, 4);
+    }
+    else if (address->sa_family == AF_INET6)
+    {
+        const sockaddr_in6* in6 = reinterpret_cast<const sockaddr_in6*>(address);
+        std::memcpy(key.bytes, &in6->sin6_addr, 16);
+    }
+    return key;
+}
+
+double ClientLimiter::now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+size_t ClientLimiter::hash(const Key& key)
+{
+    size_t h = 2166136261u;
+    for (size_t i = 0; i < sizeof(key.bytes); ++i)
+    {
+        h ^= key.bytes[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+bool ClientLimiter::sameKey(const Key& a, const Key& b)
+{
+    return std::memcmp(a.bytes, b.bytes, sizeof(a.bytes)) == 0;
+}
+
+ClientLimiter::Slot* ClientLimiter::find(const Key& key)
+{
+    size_t mask = _slots.size() - 1;
+    for (size_t i = hash(key) & mask, probes = 0; probes < _slots.size(); i = (i + 1) & mask, ++probes)
+    {
+        if (_slots[i].state == EMPTY)
+            return NULL;
+        if (_slots[i].state == USED && sameKey(_slots[i].key, key))
+            return &_slots[i];
+    }
+    return NULL;
+}
+
+ClientLimiter::Slot* ClientLimiter::insert(const Key& key, double now)
+{
+    Slot* slot = find(key);
+    if (slot)
+        return slot;
+
+    if ((_used + _deleted + 1) * 4 > _slots.size() * 3)
+    {
+        expire(now);
+        if ((_used + 1) * 2 > _slots.size())
+            rehash(_slots.size() * 2);
+        else
+            rehash(_slots.size());
+    }
+
+    size_t mask = _slots.size() - 1;
+    size_t i = hash(key) & mask;
+    while (_slots[i].state == USED)
+        i = (i + 1) & mask;
+    if (_slots[i].state == DELETED)
+        --_deleted;
+    slot = &_slots[i];
+    slot->key = key;
+    slot->connections = 0;
+    slot->tokens = _burst;
+    slot->lastSeen = now;
+    slot->state = USED;
+    ++_used;
+    return slot;
+}
+
+void ClientLimiter::refill(Slot& slot, double now) const
+{
+    if (_rate > 0)
+    {
+        slot.tokens += (now - slot.lastSeen) * _rate;
+        if (slot.tokens > _burst)
+            slot.tokens = _burst;
+    }
+    slot.lastSeen = now;
+}
+
+bool ClientLimiter::isExpired(const Slot& slot, double now) const
+{
+    if (slot.connections > 0)
+        return false;
+    if (_rate <= 0)
+        return true;
+    return slot.tokens + (now - slot.lastSeen) * _rate >= _burst;
+}
+
+void ClientLimiter::expire(double now)
+{
+    for (size_t i = 0; i < _slots.size(); ++i)
+    {
+        if (_slots[i].state == USED && isExpired(_slots[i], now))
+        {
+            _slots[i].state = DELETED;
+            --_used;
+            ++_deleted;
+        }
+    }
+}
+
+void ClientLimiter::rehash(size_t capacity)
+{
+    std::vector<Slot> previous;
+    previous.swap(_slots);
+
+    Slot empty;
+    std::memset(&empty, 0, sizeof(empty));
+    empty.state = EMPTY;
+    _slots.assign(capacity, empty);
+    _used = 0;
+    _deleted = 0;
+
+    size_t mask = capacity - 1;
+    for (size_t j = 0; j < previous.size(); ++j)
+    {
+        if (previous[j].state != USED)
+            continue;
+        size_t i = hash(previous[j].key) & mask;
+        while (_slots[i].state == USED)
+            i = (i + 1) & mask;
+        _slots[i] = previous[j];
+        ++_used;
+    }
+}
+
+bool ClientLimiter::acquireConnection(const Key& key, double now)
+{
+    if (_maxConnections == 0 && _rate <= 0)
+        return true;
+    Slot* slot = insert(key, now);
+    refill(*slot, now);
+    if (_maxConnections > 0 && slot->connections >= _maxConnections)
+        return false;
+    ++slot->connections;
+    return true;
+}
+
+void ClientLimiter::releaseConnection(const Key& key, double now)
+{
+    Slot* slot = find(key);
+    if (!slot)
+        return;
+    if (slot->connections > 0)
+        --slot->connections;
+    if (isExpired(*slot, now))
+    {
+        slot->state = DELETED;
+        --_used;
+        ++_deleted;
+    }
+}
+
+bool ClientLimiter::allowRequest(const Key& key, double now)
+{
+    if (_rate <= 0)
+        return true;
+    Slot* slot = insert(key, now);
+    refill(*slot, now);
+    if (slot->tokens < 1)
+        return false;
+    slot->tokens -= 1;
+    return true;
+}
+
+size_t ClientLimiter::size() const
+{
+    return _used;
+}
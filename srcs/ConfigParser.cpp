@@ -0,0 +1,497 @@
+#include "ConfigParser.hpp"
+#include <fstream>
+#include <map>
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <cstdio>
+#include <unistd.h>
+#include <glob.h>
+
+namespace
+{
+    const int kMaxIncludeDepth = 16;
+    const unsigned long long kHashSeed = 14695981039346656037ULL;
+    const char kCompiledMagic[8] = { 'W', 'S', 'C', 'O', 'N', 'F', '0', '3' };
+
+    void putNumber(std::string& out, unsigned long long value, int bytes)
+    {
+        for (int i = 0; i < bytes; ++i)
+            out += static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+
+    void putString(std::string& out, const std::string& value)
+    {
+        putNumber(out, value.size(), 4);
+        out += value;
+    }
+
+    // File names are written once, in a table ahead of the nodes, which
+    // refer to them by index.
+    struct Writer {
+        std::map<std::string, unsigned int>  fileIndex;
+        std::vector<const std::string*>      files;
+        std::string                          nodes;
+
+        void node(const ConfigNode& node)
+        {
+            std::map<std::string, unsigned int>::iterator file = fileIndex.find(node.file);
+            if (file == fileIndex.end())
+            {
+                file = fileIndex.insert(std::make_pair(node.file, static_cast<unsigned int>(files.size()))).first;
+                files.push_back(&file->first);
+            }
+            putString(nodes, node.name);
+            putNumber(nodes, file->second, 4);
+            putNumber(nodes, node.line, 4);
+            putNumber(nodes, node.column, 4);
+            putNumber(nodes, node.block, 1);
+            putNumber(nodes, node.args.size(), 4);
+            for (size_t i = 0; i < node.args.size(); ++i)
+                putString(nodes, node.args[i]);
+            putNumber(nodes, node.children.size(), 4);
+            for (size_t i = 0; i < node.children.size(); ++i)
+                this->node(node.children[i]);
+        }
+    };
+
+    // Reads back what Writer wrote; any truncation, count or file index
+    // that runs past the end of the data fails the whole read.
+    struct Reader {
+        const std::string&          data;
+        size_t                      pos;
+        std::vector<std::string>    files;
+
+        Reader(const std::string& input, size_t start) : data(input), pos(start) {}
+
+        bool number(unsigned long long& value, int bytes)
+        {
+            if (data.size() - pos < static_cast<size_t>(bytes))
+                return false;
+            value = 0;
+            for (int i = 0; i < bytes; ++i)
+                value |= static_cast<unsigned long long>(static_cast<unsigned char>(data[pos + i])) << (8 * i);
+            pos += bytes;
+            return true;
+        }
+
+        bool string(std::string& value)
+        {
+            unsigned long long length;
+            if (!number(length, 4) || data.size() - pos < length)
+                return false;
+            value.assign(data, pos, length);
+            pos += length;
+            return true;
+        }
+
+        bool table(std::vector<std::string>& strings)
+        {
+            unsigned long long count;
+            if (!number(count, 4) || count > data.size() - pos)
+                return false;
+            strings.resize(count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (!string(strings[i]))
+                    return false;
+            }
+            return true;
+        }
+
+        bool node(ConfigNode& node)
+        {
+            unsigned long long file, line, column, block, count;
+            if (!string(node.name) || !number(file, 4) || file >= files.size() || !number(line, 4) || !number(column, 4)
+                || !number(block, 1) || !number(count, 4) || count > data.size() - pos)
+                return false;
+            node.file = files[file];
+            node.line = static_cast<int>(line);
+            node.column = static_cast<int>(column);
+            node.block = block != 0;
+            node.args.resize(count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (!string(node.args[i]))
+                    return false;
+            }
+            if (!number(count, 4) || count > data.size() - pos)
+                return false;
+            node.children.resize(count);
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (!this->node(node.children[i]))
+                    return false;
+            }
+            return true;
+        }
+    };
+
+    bool readWholeFile(const std::string& path, std::string& content)
+    {
+        std::ifstream file(path.c_str(), std::ios::binary);
+        if (!file.is_open())
+            return false;
+        std::ostringstream buffer;
+        buffer << file.rdbuf();
+        content = buffer.str();
+        return true;
+    }
+}
+
+ConfigNode::ConfigNode() : block(false), line(0), column(0)
+{
+}
+
+void ConfigNode::swap(ConfigNode& other)
+{
+    name.swap(other.name);
+    args.swap(other.args);
+    children.swap(other.children);
+    std::swap(block, other.block);
+    file.swap(other.file);
+    std::swap(line, other.line);
+    std::swap(column, other.column);
+}
+
+// Growing a vector of nodes would deep-copy every subtree already in
+// it; moving them over with swap() keeps appending linear.
+ConfigNode& ConfigNode::appendChild()
+{
+    if (children.size() == children.capacity())
+    {
+        std::vector<ConfigNode> grown;
+        grown.reserve(children.empty() ? 8 : children.size() * 2);
+        grown.resize(children.size());
+        for (size_t i = 0; i < children.size(); ++i)
+            grown[i].swap(children[i]);
+        children.swap(grown);
+    }
+    children.push_back(ConfigNode());
+    return children.back();
+}
+
+std::string ConfigNode::value() const
+{
+    std::string joined;
+    for (size_t i = 0; i < args.size(); ++i)
+    {
+        if (i)
+            joined += ' ';
+        joined += args[i];
+    }
+    return joined;
+}
+
+std::string ConfigNode::where() const
+{
+    std::ostringstream oss;
+    oss << file << ":" << line << ":" << column;
+    return oss.str();
+}
+
+std::string ConfigNode::toString(int depth) const
+{
+    std::string indent(depth * 4, ' ');
+    std::string out = indent + name;
+    for (size_t i = 0; i < args.size(); ++i)
+        out += " " + args[i];
+    if (!block)
+        return out + ";\n";
+    out += " {\n";
+    for (size_t i = 0; i < children.size(); ++i)
+        out += children[i].toString(depth + 1);
+    return out + indent + "}\n";
+}
+
+ConfigParser::ConfigParser(const std::string& text, const std::string& file, const std::string& base, std::vector<std::string>& includes, int depth)
+    : _text(text), _file(file), _base(base), _includes(includes), _depth(depth), _pos(0), _line(1), _lineStart(0)
+{
+}
+
+void ConfigParser::fail(int line, int column, const std::string& message) const
+{
+    std::ostringstream oss;
+    oss << _file << ":" << line << ":" << column << ": " << message;
+    throw std::runtime_error(oss.str());
+}
+
+// Words end at whitespace or at one of "{};". A '#' starts a comment only
+// where a token could start, so "a#b" stays one word.
+void ConfigParser::next(Token& token)
+{
+    for (;;)
+    {
+        while (_pos < _text.size() && (_text[_pos] == ' ' || _text[_pos] == '\t' || _text[_pos] == '\r' || _text[_pos] == '\n'))
+        {
+            if (_text[_pos] == '\n')
+            {
+                ++_line;
+                _lineStart = _pos + 1;
+            }
+            ++_pos;
+        }
+        if (_pos >= _text.size() || _text[_pos] != '#')
+            break;
+        while (_pos < _text.size() && _text[_pos] != '\n')
+            ++_pos;
+    }
+
+    token.line = _line;
+    token.column = static_cast<int>(_pos - _lineStart) + 1;
+    token.text.clear();
+    if (_pos >= _text.size())
+    {
+        token.type = END;
+        return;
+    }
+    char c = _text[_pos];
+    if (c == '{' || c == '}' || c == ';')
+    {
+        token.type = c == '{' ? OPEN : (c == '}' ? CLOSE : SEMICOLON);
+        ++_pos;
+        return;
+    }
+    token.type = WORD;
+    if (c == '"' || c == '\'')
+    {
+        readQuoted(token);
+        return;
+    }
+    size_t start = _pos;
+    while (_pos < _text.size())
+    {
+        c = _text[_pos];
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '{' || c == '}' || c == ';')
+            break;
+        ++_pos;
+    }
+    token.text.assign(_text, start, _pos - start);
+}
+
+void ConfigParser::readQuoted(Token& token)
+{
+    char quote = _text[_pos++];
+    while (_pos < _text.size() && _text[_pos] != quote)
+    {
+        char c = _text[_pos++];
+        if (c == '\\' && _pos < _text.size())
+            c = _text[_pos++];
+        else if (c == '\n')
+        {
+            ++_line;
+            _lineStart = _pos;
+        }
+        token.text += c;
+    }
+    if (_pos >= _text.size())
+        fail(token.line, token.column, "unterminated quoted string");
+    ++_pos;
+}
+
+// Children are appended in place and filled through a reference, so a
+// subtree is never copied once built. The top level of a file ends at
+// the end of the text, a block at its closing brace.
+void ConfigParser::parseBlock(ConfigNode& parent, bool topLevel)
+{
+    Token token;
+    for (;;)
+    {
+        next(token);
+        if (token.type == END)
+        {
+            if (topLevel)
+                return;
+            fail(parent.line, parent.column, "block '" + parent.name + "' is not closed by '}'");
+        }
+        if (token.type == CLOSE)
+        {
+            if (topLevel)
+                fail(token.line, token.column, "unexpected '}'");
+            return;
+        }
+        if (token.type != WORD)
+            fail(token.line, token.column, std::string("unexpected '") + (token.type == OPEN ? "{" : ";") + "'");
+
+        ConfigNode& node = parent.appendChild();
+        node.name.swap(token.text);
+        node.file = _file;
+        node.line = token.line;
+        node.column = token.column;
+        for (;;)
+        {
+            next(token);
+            if (token.type == WORD)
+            {
+                node.args.push_back(std::string());
+                node.args.back().swap(token.text);
+            }
+            else if (token.type == SEMICOLON)
+                break;
+            else if (token.type == OPEN)
+            {
+                node.block = true;
+                parseBlock(node, false);
+                break;
+            }
+            else
+                fail(node.line, node.column, "directive '" + node.name + "' is not terminated by ';'");
+        }
+        if (node.name == "include")
+        {
+            ConfigNode directive;
+            directive.swap(node);
+            parent.children.pop_back();
+            include(parent, directive);
+        }
+    }
+}
+
+// The files matched by "include" are parsed in place of the directive,
+// in name order. Relative patterns start from the directory of the main
+// configuration file.
+void ConfigParser::include(ConfigNode& parent, const ConfigNode& directive)
+{
+    if (directive.block || directive.args.size() != 1)
+        fail(directive.line, directive.column, "'include' expects one file or pattern");
+    if (_depth >= kMaxIncludeDepth)
+        fail(directive.line, directive.column, "includes nested too deeply");
+
+    std::string pattern = directive.args[0][0] == '/' ? directive.args[0] : _base + directive.args[0];
+    std::vector<std::string> paths;
+    if (!expand(pattern, paths))
+        fail(directive.line, directive.column, "no file matches include '" + pattern + "'");
+    _includes.push_back(pattern);
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        std::string text;
+        if (!readWholeFile(paths[i], text))
+            fail(directive.line, directive.column, "cannot read included file '" + paths[i] + "'");
+        ConfigParser included(text, paths[i], _base, _includes, _depth + 1);
+        included.parseBlock(parent, true);
+    }
+}
+
+// A pattern without wildcards names a file that has to exist; one with
+// wildcards may match nothing.
+bool ConfigParser::expand(const std::string& pattern, std::vector<std::string>& paths)
+{
+    glob_t matches;
+    int status = glob(pattern.c_str(), 0, NULL, &matches);
+    if (status == 0)
+    {
+        for (size_t i = 0; i < matches.gl_pathc; ++i)
+            paths.push_back(matches.gl_pathv[i]);
+    }
+    globfree(&matches);
+    return status == 0 || (status == GLOB_NOMATCH && pattern.find_first_of("*?[") != std::string::npos);
+}
+
+// What a compiled tree depends on: the main file's text, then every
+// include pattern with the files it matches now and their contents. A
+// file added to, removed from or edited in an included directory
+// changes it.
+unsigned long long ConfigParser::fingerprint(const std::string& text, const std::vector<std::string>& includes)
+{
+    unsigned long long value = hash(text, kHashSeed);
+    for (size_t i = 0; i < includes.size(); ++i)
+    {
+        std::vector<std::string> paths;
+        expand(includes[i], paths);
+        value = hash(includes[i], value);
+        for (size_t j = 0; j < paths.size(); ++j)
+        {
+            std::string content;
+            readWholeFile(paths[j], content);
+            value = hash(content, hash(paths[j], value));
+        }
+    }
+    return value;
+}
+
+bool ConfigParser::load(const std::string& path, ConfigNode& root)
+{
+    std::string text;
+    if (!readWholeFile(path, text))
+        throw std::runtime_error("Error: Unable to open config file: " + path);
+
+    if (readCompiled(compiledPath(path), text, root))
+        return true;
+
+    size_t slash = path.rfind('/');
+    std::string base = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+    std::vector<std::string> includes;
+    ConfigParser parser(text, path, base, includes, 0);
+    root = ConfigNode();
+    root.block = true;
+    root.file = path;
+    parser.parseBlock(root, true);
+    for (size_t i = 0; i < root.children.size(); ++i)
+    {
+        const ConfigNode& directive = root.children[i];
+        if (directive.name == "config_cache" && directive.value() == "on")
+            writeCompiled(compiledPath(path), fingerprint(text, includes), includes, root);
+    }
+    return false;
+}
+
+// "dir/name.conf" is compiled to "dir/.name.conf.compiled".
+std::string ConfigParser::compiledPath(const std::string& path)
+{
+    size_t slash = path.rfind('/');
+    size_t nameStart = slash == std::string::npos ? 0 : slash + 1;
+    return path.substr(0, nameStart) + "." + path.substr(nameStart) + ".compiled";
+}
+
+// FNV-1a, 64 bits, continuing from value.
+unsigned long long ConfigParser::hash(const std::string& text, unsigned long long value)
+{
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        value ^= static_cast<unsigned char>(text[i]);
+        value *= 1099511628211ULL;
+    }
+    return value;
+}
+
+bool ConfigParser::readCompiled(const std::string& path, const std::string& text, ConfigNode& root)
+{
+    root = ConfigNode();
+    std::string data;
+    if (!readWholeFile(path, data) || data.size() < 16 || data.compare(0, 8, kCompiledMagic, 8) != 0)
+        return false;
+    Reader reader(data, 8);
+    std::vector<std::string> includes;
+    unsigned long long storedHash;
+    if (!reader.table(includes) || !reader.number(storedHash, 8) || storedHash != fingerprint(text, includes))
+        return false;
+    return reader.table(reader.files) && reader.node(root) && reader.pos == data.size();
+}
+
+// Written to a temporary name and renamed, so a concurrent reader sees
+// either the old compiled file or the new one. Failing to write is not
+// an error: the next load simply parses again.
+void ConfigParser::writeCompiled(const std::string& path, unsigned long long sourceHash, const std::vector<std::string>& includes, const ConfigNode& root)
+{
+    Writer writer;
+    writer.node(root);
+    std::string data(kCompiledMagic, sizeof(kCompiledMagic));
+    putNumber(data, includes.size(), 4);
+    for (size_t i = 0; i < includes.size(); ++i)
+        putString(data, includes[i]);
+    putNumber(data, sourceHash, 8);
+    putNumber(data, writer.files.size(), 4);
+    for (size_t i = 0; i < writer.files.size(); ++i)
+        putString(data, *writer.files[i]);
+    data += writer.nodes;
+
+    std::ostringstream temporary;
+    temporary << path << "." << getpid();
+    std::ofstream out(temporary.str().c_str(), std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+        return;
+    out.write(data.data(), data.size());
+    out.close();
+    if (!out || std::rename(temporary.str().c_str(), path.c_str()) != 0)
+        std::remove(temporary.str().c_str());
+}
@@ -0,0 +1,257 @@
+#include "DirectoryIndex.hpp"
+#include <map>
+#include <list>
+#include <algorithm>
+#include <cstdio>
+#include <cctype>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+
+namespace
+{
+    struct LinuxDirent64
+    {
+        unsigned long long  d_ino;
+        long long           d_off;
+        unsigned short      d_reclen;
+        unsigned char       d_type;
+        char                d_name[1];
+    };
+
+    struct CachedListing
+    {
+        time_t          mtime;
+        long            mtimeNsec;
+        std::string     body;
+        std::list<std::string>::iterator lru;
+    };
+
+    const size_t kScanBuffer = 64 * 1024;
+    const size_t kCacheBytes = 32 * 1024 * 1024;
+
+    std::map<std::string, CachedListing> listingCache;
+    std::list<std::string> listingLru;
+    size_t listingCacheBytes = 0;
+
+    void forgetListing(std::map<std::string, CachedListing>::iterator it)
+    {
+        listingCacheBytes -= it->second.body.size();
+        listingLru.erase(it->second.lru);
+        listingCache.erase(it);
+    }
+
+    // Directories first, then by name.
+    bool entryLess(const DirectoryIndex::Entry& a, const DirectoryIndex::Entry& b)
+    {
+        if (a.directory != b.directory)
+            return a.directory;
+        return a.name < b.name;
+    }
+
+    void appendUriEscaped(std::string& out, const std::string& name)
+    {
+        static const char hex[] = "0123456789ABCDEF";
+        for (size_t i = 0; i < name.size(); ++i)
+        {
+            unsigned char c = name[i];
+            if (std::isalnum(c) || std::strchr("-._~!$'()*+,;=:@", c))
+                out += static_cast<char>(c);
+            else
+            {
+                out += '%';
+                out += hex[c >> 4];
+                out += hex[c & 15];
+            }
+        }
+    }
+
+    void appendHtmlEscaped(std::string& out, const std::string& text)
+    {
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            if (text[i] == '<')
+                out += "&lt;";
+            else if (text[i] == '>')
+                out += "&gt;";
+            else if (text[i] == '&')
+                out += "&amp;";
+            else if (text[i] == '"')
+                out += "&quot;";
+            else
+                out += text[i];
+        }
+    }
+
+    void appendJsonEscaped(std::string& out, const std::string& text)
+    {
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            unsigned char c = text[i];
+            if (c == '"' || c == '\\')
+            {
+                out += '\\';
+                out += static_cast<char>(c);
+            }
+            else if (c < 0x20)
+            {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+            }
+            else
+                out += static_cast<char>(c);
+        }
+    }
+}
+
+// Hidden entries (leading dot) are left out, as are entries that vanish
+// between the scan and their stat.
+bool DirectoryIndex::scan(const std::string& directory, std::vector<Entry>& entries)
+{
+    int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    std::vector<char> buffer(kScanBuffer);
+    for (;;)
+    {
+        long length = syscall(SYS_getdents64, fd, &buffer[0], buffer.size());
+        if (length < 0)
+        {
+            close(fd);
+            return false;
+        }
+        if (length == 0)
+            break;
+        for (long offset = 0; offset < length;)
+        {
+            const LinuxDirent64* record = reinterpret_cast<const LinuxDirent64*>(&buffer[offset]);
+            offset += record->d_reclen;
+            if (record->d_name[0] == '.')
+                continue;
+
+            struct stat info;
+            if (fstatat(fd, record->d_name, &info, 0) != 0)
+                continue;
+            Entry entry;
+            entry.name = record->d_name;
+            entry.directory = S_ISDIR(info.st_mode);
+            entry.size = info.st_size;
+            entry.mtime = info.st_mtime;
+            entries.push_back(entry);
+        }
+    }
+    close(fd);
+    std::sort(entries.begin(), entries.end(), entryLess);
+    return true;
+}
+
+// A listing is not cached while its directory was modified within the
+// last second: a change in the same mtime tick would go unnoticed. The
+// least recently served listings are dropped first when the cache is full.
+bool DirectoryIndex::render(const std::string& directory, const std::string& uri, Format format, std::string& body)
+{
+    struct stat info;
+    if (stat(directory.c_str(), &info) != 0 || !S_ISDIR(info.st_mode))
+        return false;
+
+    std::string key = (format == JSON ? "J" : "H") + uri + '\n' + directory;
+    std::map<std::string, CachedListing>::iterator cached = listingCache.find(key);
+    if (cached != listingCache.end())
+    {
+        if (cached->second.mtime == info.st_mtim.tv_sec && cached->second.mtimeNsec == info.st_mtim.tv_nsec)
+        {
+            listingLru.splice(listingLru.begin(), listingLru, cached->second.lru);
+            body = cached->second.body;
+            return true;
+        }
+        forgetListing(cached);
+    }
+
+    std::vector<Entry> entries;
+    if (!scan(directory, entries))
+        return false;
+    body.clear();
+    body.reserve(256 + entries.size() * (format == JSON ? 96 : 128));
+    if (format == JSON)
+        renderJson(entries, body);
+    else
+        renderHtml(uri, entries, body);
+
+    if (std::time(NULL) - info.st_mtim.tv_sec < 2 || body.size() > kCacheBytes / 4)
+        return true;
+    while (!listingLru.empty() && listingCacheBytes + body.size() > kCacheBytes)
+        forgetListing(listingCache.find(listingLru.back()));
+    listingLru.push_front(key);
+    CachedListing& stored = listingCache[key];
+    stored.mtime = info.st_mtim.tv_sec;
+    stored.mtimeNsec = info.st_mtim.tv_nsec;
+    stored.body = body;
+    stored.lru = listingLru.begin();
+    listingCacheBytes += body.size();
+    return true;
+}
+
+void DirectoryIndex::renderHtml(const std::string& uri, const std::vector<Entry>& entries, std::string& body)
+{
+    body += "<html>\r\n<head><title>Index of ";
+    appendHtmlEscaped(body, uri);
+    body += "</title></head>\r\n<body>\r\n<h1>Index of ";
+    appendHtmlEscaped(body, uri);
+    body += "</h1><hr><pre><a href=\"../\">../</a>\r\n";
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        const Entry& entry = entries[i];
+        std::string name = entry.directory ? entry.name + "/" : entry.name;
+        body += "<a href=\"";
+        appendUriEscaped(body, entry.name);
+        if (entry.directory)
+            body += '/';
+        body += "\">";
+        appendHtmlEscaped(body, name);
+        body += "</a>";
+        if (name.size() < 50)
+            body.append(51 - name.size(), ' ');
+        else
+            body += ' ';
+
+        char line[64];
+        struct tm modified;
+        gmtime_r(&entry.mtime, &modified);
+        size_t length = std::strftime(line, sizeof(line), "%d-%b-%Y %H:%M", &modified);
+        if (entry.directory)
+            length += std::snprintf(line + length, sizeof(line) - length, "%20s", "-");
+        else
+            length += std::snprintf(line + length, sizeof(line) - length, "%20lld", static_cast<long long>(entry.size));
+        body.append(line, length);
+        body += "\r\n";
+    }
+    body += "</pre><hr></body>\r\n</html>\r\n";
+}
+
+void DirectoryIndex::renderJson(const std::vector<Entry>& entries, std::string& body)
+{
+    body += "[";
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        const Entry& entry = entries[i];
+        char fields[96];
+        struct tm modified;
+        gmtime_r(&entry.mtime, &modified);
+
+        body += i ? ",\n" : "\n";
+        body += "{ \"name\":\"";
+        appendJsonEscaped(body, entry.name);
+        body += entry.directory ? "\", \"type\":\"directory\", \"mtime\":\"" : "\", \"type\":\"file\", \"mtime\":\"";
+        size_t length = std::strftime(fields, sizeof(fields), "%a, %d %b %Y %H:%M:%S GMT\"", &modified);
+        if (!entry.directory)
+            length += std::snprintf(fields + length, sizeof(fields) - length, ", \"size\":%lld", static_cast<long long>(entry.size));
+        body.append(fields, length);
+        body += " }";
+    }
+    body += "\n]\n";
+}
@@ -0,0 +1,324 @@
+#include "GlobalConfig.hpp"
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <cstdlib>
+
+GlobalConfig::GlobalConfig() : _workerConnections(1024), _limitConnPerIp(0), _limitReqRate(0), _limitReqBurst(0),
+    _clientHeaderTimeout(60000), _clientBodyTimeout(60000), _sendTimeout(60000), _keepaliveTimeout(75000),
+    _proxyConnectTimeout(5000), _proxyReadTimeout(60000), _cgiTimeout(5000), _clientHeaderBufferSize(4 * 8192), _sslSessionCache(20480), _sslSessionTimeout(300000), _sslSessionTickets(true), _cacheMemSize(0), _cacheMaxSize(256 * 1024 * 1024),
+    _openFileCacheMax(0), _openFileCacheInactive(60000), _openFileCacheValid(60000)
+{
+}
+
+static std::string directiveValue(const ConfigNode& directive)
+{
+    if (directive.args.empty())
+        throw std::runtime_error("Error: Missing value for '" + directive.name + "'");
+    return directive.value();
+}
+
+static double parsePositive(const std::string& value, const std::string& name)
+{
+    char* end = NULL;
+    double number = std::strtod(value.c_str(), &end);
+    if (end == value.c_str() || number < 0)
+        throw std::runtime_error("Error: Invalid value '" + value + "' for '" + name + "'");
+    return number;
+}
+
+void GlobalConfig::parseDirective(const ConfigNode& directive)
+{
+    const std::string& name = directive.name;
+
+    if (name == "worker_connections")
+    {
+        _workerConnections = static_cast<size_t>(parsePositive(directiveValue(directive), name));
+        if (_workerConnections == 0)
+            throw std::runtime_error("Error: 'worker_connections' must be at least 1");
+    }
+    else if (name == "limit_conn_per_ip")
+        _limitConnPerIp = static_cast<size_t>(parsePositive(directiveValue(directive), name));
+    else if (name == "limit_req")
+    {
+        // limit_req <rate>r/s [burst=<n>];
+        std::string value = directiveValue(directive);
+        std::istringstream params(value);
+        std::string rate;
+        std::string option;
+
+        params >> rate;
+        if (rate.size() > 4 && rate.compare(rate.size() - 3, 3, "r/s") == 0)
+            rate.erase(rate.size() - 3);
+        _limitReqRate = parsePositive(rate, name);
+        _limitReqBurst = _limitReqRate;
+        while (params >> option)
+        {
+            if (option.find("burst=") == 0)
+                _limitReqBurst = parsePositive(option.substr(6), name);
+            else
+                throw std::runtime_error("Error: Unknown 'limit_req' parameter '" + option + "'");
+        }
+        if (_limitReqBurst < 1)
+            _limitReqBurst = 1;
+    }
+    else if (name == "client_header_timeout")
+        _clientHeaderTimeout = parseDuration(directiveValue(directive), name);
+    else if (name == "client_body_timeout")
+        _clientBodyTimeout = parseDuration(directiveValue(directive), name);
+    else if (name == "send_timeout")
+        _sendTimeout = parseDuration(directiveValue(directive), name);
+    else if (name == "keepalive_timeout")
+        _keepaliveTimeout = parseDuration(directiveValue(directive), name);
+    else if (name == "proxy_connect_timeout")
+        _proxyConnectTimeout = parseDuration(directiveValue(directive), name);
+    else if (name == "proxy_read_timeout")
+        _proxyReadTimeout = parseDuration(directiveValue(directive), name);
+    else if (name == "cgi_timeout")
+        _cgiTimeout = parseDuration(directiveValue(directive), name);
+    else if (name == "large_client_header_buffers")
+    {
+        // large_client_header_buffers <number> <size>;
+        if (directive.args.size() != 2)
+            throw std::runtime_error("Error: 'large_client_header_buffers' expects a number and a size");
+        _clientHeaderBufferSize = static_cast<size_t>(parsePositive(directive.args[0], name)) * parseSize(directive.args[1], name);
+        if (_clientHeaderBufferSize == 0)
+            throw std::runtime_error("Error: 'large_client_header_buffers' must allow at least one byte");
+    }
+    else if (name == "ssl_session_cache")
+    {
+        std::string value = directiveValue(directive);
+        _sslSessionCache = value == "off" ? 0 : static_cast<size_t>(parsePositive(value, name));
+    }
+    else if (name == "ssl_session_timeout")
+        _sslSessionTimeout = parseDuration(directiveValue(directive), name);
+    else if (name == "ssl_session_tickets")
+    {
+        std::string value = directiveValue(directive);
+        if (value != "on" && value != "off")
+            throw std::runtime_error("Error: 'ssl_session_tickets' must be 'on' or 'off'");
+        _sslSessionTickets = value == "on";
+    }
+    else if (name == "cache_mem_size")
+        _cacheMemSize = parseSize(directiveValue(directive), name);
+    else if (name == "cache_path")
+    {
+        // cache_path <dir> [max_size=<size>];
+        std::istringstream params(directiveValue(directive));
+        std::string option;
+
+        params >> _cachePath;
+        while (params >> option)
+        {
+            if (option.find("max_size=") == 0)
+                _cacheMaxSize = parseSize(option.substr(9), name);
+            else
+                throw std::runtime_error("Error: Unknown 'cache_path' parameter '" + option + "'");
+        }
+    }
+    else if (name == "open_file_cache")
+    {
+        // open_file_cache off | max=<entries> [inactive=<time>] [valid=<time>];
+        std::istringstream params(directiveValue(directive));
+        std::string option;
+
+        _openFileCacheMax = 0;
+        while (params >> option)
+        {
+            if (option == "off" && directive.args.size() == 1)
+                return;
+            if (option.find("max=") == 0)
+                _openFileCacheMax = static_cast<size_t>(parsePositive(option.substr(4), name));
+            else if (option.find("inactive=") == 0)
+                _openFileCacheInactive = parseDuration(option.substr(9), name);
+            else if (option.find("valid=") == 0)
+                _openFileCacheValid = parseDuration(option.substr(6), name);
+            else
+                throw std::runtime_error("Error: Unknown 'open_file_cache' parameter '" + option + "'");
+        }
+        if (_openFileCacheMax == 0)
+            throw std::runtime_error("Error: 'open_file_cache' needs max=<entries> or off");
+    }
+    else if (name == "config_cache")
+    {
+        std::string value = directiveValue(directive);
+        if (value != "on" && value != "off")
+            throw std::runtime_error("Error: 'config_cache' must be 'on' or 'off'");
+    }
+    else
+        throw std::runtime_error("Error: Unknown global directive '" + name + "'");
+}
+
+void GlobalConfig::parseUpstreamBlock(const ConfigNode& block)
+{
+    UpstreamConfig upstream;
+
+    if (block.args.size() != 1)
+        throw std::runtime_error("Error: 'upstream' expects one name");
+    upstream.name = block.args[0];
+    if (_upstreams.find(upstream.name) != _upstreams.end())
+        throw std::runtime_error("Error: Duplicate upstream '" + upstream.name + "'");
+    upstream.parseBlock(block);
+    _upstreams[upstream.name] = upstream;
+}
+
+// Accepts "500ms", "30s", "2m" or a bare number of seconds.
+unsigned long GlobalConfig::parseDuration(const std::string& value, const std::string& name)
+{
+    char* end = NULL;
+    double number = std::strtod(value.c_str(), &end);
+    std::string unit(end);
+
+    if (end == value.c_str() || number <= 0)
+        throw std::runtime_error("Error: Invalid duration '" + value + "' for '" + name + "'");
+    if (unit == "ms")
+        return static_cast<unsigned long>(number);
+    if (unit.empty() || unit == "s")
+        return static_cast<unsigned long>(number * 1000);
+    if (unit == "m")
+        return static_cast<unsigned long>(number * 60000);
+    throw std::runtime_error("Error: Invalid duration '" + value + "' for '" + name + "'");
+}
+
+// Accepts a byte count with an optional k, m or g suffix.
+size_t GlobalConfig::parseSize(const std::string& value, const std::string& name)
+{
+    char* end = NULL;
+    double number = std::strtod(value.c_str(), &end);
+    std::string unit(end);
+
+    if (end == value.c_str() || number < 0)
+        throw std::runtime_error("Error: Invalid size '" + value + "' for '" + name + "'");
+    if (unit.empty())
+        return static_cast<size_t>(number);
+    if (unit == "k" || unit == "K")
+        return static_cast<size_t>(number * 1024);
+    if (unit == "m" || unit == "M")
+        return static_cast<size_t>(number * 1024 * 1024);
+    if (unit == "g" || unit == "G")
+        return static_cast<size_t>(number * 1024 * 1024 * 1024);
+    throw std::runtime_error("Error: Invalid size '" + value + "' for '" + name + "'");
+}
+
+void GlobalConfig::print() const
+{
+    std::cout << "Worker Connections: " << _workerConnections << std::endl;
+    std::cout << "Connections per IP: " << _limitConnPerIp << std::endl;
+    std::cout << "Request rate: " << _limitReqRate << "r/s burst=" << _limitReqBurst << std::endl;
+    std::cout << "Timeouts (ms): header " << _clientHeaderTimeout << ", body " << _clientBodyTimeout
+              << ", send " << _sendTimeout << ", keepalive " << _keepaliveTimeout << std::endl;
+    std::cout << "Response cache: memory " << _cacheMemSize << ", disk "
+              << (_cachePath.empty() ? "off" : _cachePath) << std::endl;
+    std::cout << "Open file cache: " << _openFileCacheMax << " entries, inactive " << _openFileCacheInactive
+              << "ms, valid " << _openFileCacheValid << "ms" << std::endl;
+}
+
+size_t GlobalConfig::getWorkerConnections() const
+{
+    return _workerConnections;
+}
+
+size_t GlobalConfig::getLimitConnPerIp() const
+{
+    return _limitConnPerIp;
+}
+
+double GlobalConfig::getLimitReqRate() const
+{
+    return _limitReqRate;
+}
+
+double GlobalConfig::getLimitReqBurst() const
+{
+    return _limitReqBurst;
+}
+
+unsigned long GlobalConfig::getClientHeaderTimeout() const
+{
+    return _clientHeaderTimeout;
+}
+
+unsigned long GlobalConfig::getClientBodyTimeout() const
+{
+    return _clientBodyTimeout;
+}
+
+unsigned long GlobalConfig::getSendTimeout() const
+{
+    return _sendTimeout;
+}
+
+unsigned long GlobalConfig::getKeepaliveTimeout() const
+{
+    return _keepaliveTimeout;
+}
+
+unsigned long GlobalConfig::getProxyConnectTimeout() const
+{
+    return _proxyConnectTimeout;
+}
+
+unsigned long GlobalConfig::getProxyReadTimeout() const
+{
+    return _proxyReadTimeout;
+}
+
+unsigned long GlobalConfig::getCgiTimeout() const
+{
+    return _cgiTimeout;
+}
+
+size_t GlobalConfig::getClientHeaderBufferSize() const
+{
+    return _clientHeaderBufferSize;
+}
+
+size_t GlobalConfig::getSslSessionCache() const
+{
+    return _sslSessionCache;
+}
+
+unsigned long GlobalConfig::getSslSessionTimeout() const
+{
+    return _sslSessionTimeout;
+}
+
+bool GlobalConfig::getSslSessionTickets() const
+{
+    return _sslSessionTickets;
+}
+
+size_t GlobalConfig::getCacheMemSize() const
+{
+    return _cacheMemSize;
+}
+
+const std::string& GlobalConfig::getCachePath() const
+{
+    return _cachePath;
+}
+
+size_t GlobalConfig::getCacheMaxSize() const
+{
+    return _cacheMaxSize;
+}
+
+size_t GlobalConfig::getOpenFileCacheMax() const
+{
+    return _openFileCacheMax;
+}
+
+unsigned long GlobalConfig::getOpenFileCacheInactive() const
+{
+    return _openFileCacheInactive;
+}
+
+unsigned long GlobalConfig::getOpenFileCacheValid() const
+{
+    return _openFileCacheValid;
+}
+
+const std::map<std::string, UpstreamConfig>& GlobalConfig::getUpstreams() const
+{
+    return _upstreams;
+}
@@ -0,0 +1,261 @@
+#include "HeaderScanner.hpp"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define HEADERSCANNER_X86 1
+#endif
+
+namespace
+{
+    typedef size_t (*NewlineScan)(const char*, size_t);
+    typedef size_t (*LineScan)(const char*, size_t, size_t&);
+
+    struct Implementation
+    {
+        const char*     name;
+        NewlineScan     newline;
+        LineScan        line;
+    };
+
+    size_t newlineScalar(const char* data, size_t length)
+    {
+        size_t i = 0;
+        while (i < length && data[i] != '\n')
+            ++i;
+        return i;
+    }
+
+    size_t lineScalar(const char* data, size_t length, size_t& colon)
+    {
+        for (size_t i = 0; i < length; ++i)
+        {
+            if (data[i] == '\n')
+                return i;
+            if (data[i] == ':' && colon == HeaderScanner::npos)
+                colon = i;
+        }
+        return length;
+    }
+
+#ifdef HEADERSCANNER_X86
+    // Finishes the bytes after the last full block with a narrower scan,
+    // whose colon offset is relative to where it started.
+    size_t tail(LineScan scan, const char* data, size_t start, size_t length, size_t& colon)
+    {
+        size_t rest = HeaderScanner::npos;
+        size_t end = scan(data + start, length - start, rest);
+        if (colon == HeaderScanner::npos && rest != HeaderScanner::npos)
+            colon = start + rest;
+        return end;
+    }
+
+    // Each block gives a bit mask of its '\n' bytes (and ':' bytes); the
+    // lowest set bit is the first match. Colons past the newline are
+    // masked off so they are not mistaken for this line's delimiter.
+    __attribute__((target("sse2")))
+    size_t newlineSse2(const char* data, size_t length)
+    {
+        const __m128i newline = _mm_set1_epi8('\n');
+        size_t i = 0;
+        for (; i + 16 <= length; i += 16)
+        {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+            if (mask)
+                return i + __builtin_ctz(mask);
+        }
+        return i + newlineScalar(data + i, length - i);
+    }
+
+    __attribute__((target("sse2")))
+    size_t lineSse2(const char* data, size_t length, size_t& colon)
+    {
+        const __m128i newline = _mm_set1_epi8('\n');
+        const __m128i separator = _mm_set1_epi8(':');
+        size_t i = 0;
+        for (; i + 16 <= length; i += 16)
+        {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            unsigned lines = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+            if (colon == HeaderScanner::npos)
+            {
+                unsigned colons = _mm_movemask_epi8(_mm_cmpeq_epi8(block, separator));
+                if (lines)
+                    colons &= (lines & -lines) - 1;
+                if (colons)
+                    colon = i + __builtin_ctz(colons);
+            }
+            if (lines)
+                return i + __builtin_ctz(lines);
+        }
+        return i + tail(lineScalar, data, i, length, colon);
+    }
+
+    __attribute__((target("avx2")))
+    size_t newlineAvx2(const char* data, size_t length)
+    {
+        const __m256i newline = _mm256_set1_epi8('\n');
+        size_t i = 0;
+        for (; i + 32 <= length; i += 32)
+        {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline));
+            if (mask)
+                return i + __builtin_ctz(mask);
+        }
+        // Clear the upper halves before the legacy-encoded SSE2 tail, which
+        // otherwise pays an AVX to SSE transition on every call.
+        _mm256_zeroupper();
+        return i + newlineSse2(data + i, length - i);
+    }
+
+    __attribute__((target("avx2")))
+    size_t lineAvx2(const char* data, size_t length, size_t& colon)
+    {
+        const __m256i newline = _mm256_set1_epi8('\n');
+        const __m256i separator = _mm256_set1_epi8(':');
+        size_t i = 0;
+        for (; i + 32 <= length; i += 32)
+        {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            unsigned lines = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline));
+            if (colon == HeaderScanner::npos)
+            {
+                unsigned colons = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, separator));
+                if (lines)
+                    colons &= (lines & -lines) - 1;
+                if (colons)
+                    colon = i + __builtin_ctz(colons);
+            }
+            if (lines)
+                return i + __builtin_ctz(lines);
+        }
+        _mm256_zeroupper();
+        return i + tail(lineSse2, data, i, length, colon);
+    }
+#endif
+
+    const Implementation kImplementations[] = {
+#ifdef HEADERSCANNER_X86
+        { "avx2", newlineAvx2, lineAvx2 },
+        { "sse2", newlineSse2, lineSse2 },
+#endif
+        { "scalar", newlineScalar, lineScalar },
+    };
+    const size_t kImplementationCount = sizeof(kImplementations) / sizeof(kImplementations[0]);
+
+    bool supported(const Implementation& implementation)
+    {
+#ifdef HEADERSCANNER_X86
+        __builtin_cpu_init();
+        if (std::strcmp(implementation.name, "avx2") == 0)
+            return __builtin_cpu_supports("avx2");
+        if (std::strcmp(implementation.name, "sse2") == 0)
+            return __builtin_cpu_supports("sse2");
+#endif
+        (void)implementation;
+        return true;
+    }
+
+    const Implementation* detect()
+    {
+        for (size_t i = 0; i < kImplementationCount; ++i)
+            if (supported(kImplementations[i]))
+                return &kImplementations[i];
+        return &kImplementations[kImplementationCount - 1];
+    }
+
+    const Implementation* active = detect();
+
+    enum { TOKEN = 1, TARGET = 2 };
+
+    // RFC 9110 tchar for tokens; any visible ASCII for a request target.
+    struct CharacterClasses
+    {
+        unsigned char flags[256];
+
+        CharacterClasses()
+        {
+            std::memset(flags, 0, sizeof(flags));
+            for (int c = 0x21; c < 0x7f; ++c)
+                flags[c] |= TARGET;
+            const char* token = "!#$%&'*+-.^_`|~0123456789"
+                "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+            for (; *token; ++token)
+                flags[static_cast<unsigned char>(*token)] |= TOKEN;
+        }
+    };
+
+    const CharacterClasses classes;
+
+    bool allOf(const char* data, size_t length, unsigned char flag)
+    {
+        if (length == 0)
+            return false;
+        for (size_t i = 0; i < length; ++i)
+            if (!(classes.flags[static_cast<unsigned char>(data[i])] & flag))
+                return false;
+        return true;
+    }
+}
+
+// Offset just past the blank line ("\r\n\r\n" or "\n\n") that ends the
+// head, or npos if it has not arrived yet.
+size_t HeaderScanner::findHeadEnd(const char* data, size_t length)
+{
+    size_t pos = 0;
+    while (pos < length)
+    {
+        size_t newline = pos + active->newline(data + pos, length - pos);
+        if (newline >= length)
+            break;
+        if (newline >= 1 && data[newline - 1] == '\n')
+            return newline + 1;
+        if (newline >= 2 && data[newline - 1] == '\r' && data[newline - 2] == '\n')
+            return newline + 1;
+        pos = newline + 1;
+    }
+    return npos;
+}
+
+// Offset of the first '\n' (length if there is none). colon, if still
+// npos, is set to the first ':' before that newline.
+size_t HeaderScanner::findLineEnd(const char* data, size_t length, size_t& colon)
+{
+    return active->line(data, length, colon);
+}
+
+bool HeaderScanner::isToken(const char* data, size_t length)
+{
+    return allOf(data, length, TOKEN);
+}
+
+bool HeaderScanner::isTarget(const char* data, size_t length)
+{
+    return allOf(data, length, TARGET);
+}
+
+bool HeaderScanner::isVersion(const char* data, size_t length)
+{
+    return length == 8 && std::memcmp(data, "HTTP/", 5) == 0
+        && data[5] >= '0' && data[5] <= '9' && data[6] == '.' && data[7] >= '0' && data[7] <= '9';
+}
+
+const char* HeaderScanner::implementation()
+{
+    return active->name;
+}
+
+bool HeaderScanner::useImplementation(const std::string& name)
+{
+    for (size_t i = 0; i < kImplementationCount; ++i)
+    {
+        if (name == kImplementations[i].name && supported(kImplementations[i]))
+        {
+            active = &kImplementations[i];
+            return true;
+        }
+    }
+    return false;
+}
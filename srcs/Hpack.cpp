@@ -0,0 +1,458 @@
+#include "Hpack.hpp"
+
+namespace
+{
+    struct HuffmanCode
+    {
+        unsigned int    code;
+        unsigned char   bits;
+    };
+
+    // RFC 7541 Appendix B; the last entry is EOS.
+    const HuffmanCode huffmanCodes[257] = {
+        {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+        {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+        {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+        {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+        {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+        {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+        {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+        {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+        {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+        {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+        {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+        {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+        {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+        {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+        {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+        {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+        {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+        {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+        {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+        {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+        {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+        {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+        {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+        {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+        {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+        {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+        {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+        {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+        {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+        {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+        {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+        {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+        {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+        {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+        {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+        {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+        {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+        {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+        {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+        {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+        {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+        {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+        {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+        {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+        {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+        {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+        {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+        {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+        {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+        {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+        {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+        {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+        {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+        {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+        {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+        {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+        {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+        {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+        {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+        {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+        {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+        {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+        {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+        {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+        {0x3fffffff, 30},
+    };
+
+    const char* const staticTable[][2] = {
+        {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"},
+        {":path", "/index.html"}, {":scheme", "http"}, {":scheme", "https"}, {":status", "200"},
+        {":status", "204"}, {":status", "206"}, {":status", "304"}, {":status", "400"},
+        {":status", "404"}, {":status", "500"}, {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"},
+        {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""}, {"access-control-allow-origin", ""},
+        {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+        {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+        {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""},
+        {"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""},
+        {"from", ""}, {"host", ""}, {"if-match", ""}, {"if-modified-since", ""},
+        {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""},
+        {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+        {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""},
+        {"retry-after", ""}, {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+        {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""}, {"via", ""},
+        {"www-authenticate", ""}
+    };
+    const size_t STATIC_ENTRIES = sizeof(staticTable) / sizeof(staticTable[0]);
+    const size_t DEFAULT_TABLE_SIZE = 4096;
+
+    // Binary tree over the codes: positive children are inner nodes,
+    // negative ones leaves holding -(symbol + 1).
+    struct HuffmanTree
+    {
+        int child[512][2];
+
+        HuffmanTree()
+        {
+            int nodes = 1;
+            for (int i = 0; i < 512; ++i)
+                child[i][0] = child[i][1] = 0;
+            for (int symbol = 0; symbol < 257; ++symbol)
+            {
+                int node = 0;
+                for (int bit = huffmanCodes[symbol].bits - 1; bit >= 0; --bit)
+                {
+                    int b = (huffmanCodes[symbol].code >> bit) & 1;
+                    if (bit == 0)
+                        child[node][b] = -(symbol + 1);
+                    else
+                    {
+                        if (child[node][b] == 0)
+                            child[node][b] = nodes++;
+                        node = child[node][b];
+                    }
+                }
+            }
+        }
+    };
+
+    bool decodeHuffman(const char* data, size_t length, std::string& out)
+    {
+        static const HuffmanTree tree;
+        int node = 0;
+        int depth = 0;
+        bool ones = true;
+
+        for (size_t i = 0; i < length; ++i)
+        {
+            unsigned char byte = data[i];
+            for (int bit = 7; bit >= 0; --bit)
+            {
+                int b = (byte >> bit) & 1;
+                int next = tree.child[node][b];
+                if (next == 0)
+                    return false;
+                ++depth;
+                ones = ones && b;
+                if (next > 0)
+                {
+                    node = next;
+                    continue;
+                }
+                if (next == -257)
+                    return false;
+                out += static_cast<char>(-next - 1);
+                node = 0;
+                depth = 0;
+                ones = true;
+            }
+        }
+        // Padding is the most significant bits of EOS, shorter than a byte.
+        return depth < 8 && ones;
+    }
+
+    void encodeHuffman(const std::string& value, std::string& out)
+    {
+        unsigned char current = 0;
+        int filled = 0;
+
+        for (size_t i = 0; i < value.size(); ++i)
+        {
+            const HuffmanCode& code = huffmanCodes[static_cast<unsigned char>(value[i])];
+            for (int bit = code.bits - 1; bit >= 0; --bit)
+            {
+                current = (current << 1) | ((code.code >> bit) & 1);
+                if (++filled == 8)
+                {
+                    out += static_cast<char>(current);
+                    current = 0;
+                    filled = 0;
+                }
+            }
+        }
+        if (filled)
+            out += static_cast<char>((current << (8 - filled)) | (0xff >> filled));
+    }
+
+    void encodeInteger(std::string& out, unsigned char flags, int prefix, size_t value)
+    {
+        size_t max = (1u << prefix) - 1;
+        if (value < max)
+        {
+            out += static_cast<char>(flags | value);
+            return;
+        }
+        out += static_cast<char>(flags | max);
+        value -= max;
+        while (value >= 128)
+        {
+            out += static_cast<char>((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        out += static_cast<char>(value);
+    }
+
+    bool decodeInteger(const std::string& in, size_t& pos, int prefix, size_t& value)
+    {
+        if (pos >= in.size())
+            return false;
+        size_t max = (1u << prefix) - 1;
+        value = static_cast<unsigned char>(in[pos++]) & max;
+        if (value < max)
+            return true;
+        for (int shift = 0; shift <= 21; shift += 7)
+        {
+            if (pos >= in.size())
+                return false;
+            unsigned char byte = in[pos++];
+            value += static_cast<size_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    void encodeString(std::string& out, const std::string& value)
+    {
+        size_t bits = 0;
+        for (size_t i = 0; i < value.size(); ++i)
+            bits += huffmanCodes[static_cast<unsigned char>(value[i])].bits;
+        if ((bits + 7) / 8 < value.size())
+        {
+            encodeInteger(out, 0x80, 7, (bits + 7) / 8);
+            encodeHuffman(value, out);
+            return;
+        }
+        encodeInteger(out, 0x00, 7, value.size());
+        out += value;
+    }
+
+    bool decodeString(const std::string& in, size_t& pos, std::string& out)
+    {
+        if (pos >= in.size())
+            return false;
+        bool huffman = in[pos] & 0x80;
+        size_t length;
+        if (!decodeInteger(in, pos, 7, length) || length > in.size() - pos)
+            return false;
+        out.clear();
+        if (huffman && !decodeHuffman(in.data() + pos, length, out))
+            return false;
+        if (!huffman)
+            out.assign(in, pos, length);
+        pos += length;
+        return true;
+    }
+
+    // Values that differ on nearly every response would only churn the
+    // dynamic table.
+    bool worthIndexing(const std::string& name)
+    {
+        static const char* const volatileHeaders[] = {"content-length", "age", "etag", "last-modified",
+            "location", "content-range", "set-cookie", NULL};
+        for (size_t i = 0; volatileHeaders[i]; ++i)
+        {
+            if (name == volatileHeaders[i])
+                return false;
+        }
+        return true;
+    }
+}
+
+HpackTable::HpackTable() : _size(0), _maxSize(DEFAULT_TABLE_SIZE)
+{
+}
+
+bool HpackTable::get(size_t index, HeaderField& field) const
+{
+    if (index == 0)
+        return false;
+    if (index <= STATIC_ENTRIES)
+    {
+        field.first = staticTable[index - 1][0];
+        field.second = staticTable[index - 1][1];
+        return true;
+    }
+    index -= STATIC_ENTRIES + 1;
+    if (index >= _entries.size())
+        return false;
+    field = _entries[index];
+    return true;
+}
+
+// Returns the index of an exact match, else of an entry with the same
+// name (nameOnly set), else 0.
+size_t HpackTable::find(const HeaderField& field, bool& nameOnly) const
+{
+    size_t nameIndex = 0;
+
+    for (size_t i = 0; i < STATIC_ENTRIES; ++i)
+    {
+        if (field.first != staticTable[i][0])
+            continue;
+        if (field.second == staticTable[i][1])
+        {
+            nameOnly = false;
+            return i + 1;
+        }
+        if (!nameIndex)
+            nameIndex = i + 1;
+    }
+    for (size_t i = 0; i < _entries.size(); ++i)
+    {
+        if (_entries[i].first != field.first)
+            continue;
+        if (_entries[i].second == field.second)
+        {
+            nameOnly = false;
+            return STATIC_ENTRIES + 1 + i;
+        }
+        if (!nameIndex)
+            nameIndex = STATIC_ENTRIES + 1 + i;
+    }
+    nameOnly = true;
+    return nameIndex;
+}
+
+void HpackTable::add(const HeaderField& field)
+{
+    size_t size = field.first.size() + field.second.size() + 32;
+    if (size > _maxSize)
+    {
+        _entries.clear();
+        _size = 0;
+        return;
+    }
+    evict(size);
+    _entries.push_front(field);
+    _size += size;
+}
+
+void HpackTable::setMaxSize(size_t size)
+{
+    _maxSize = size;
+    evict(0);
+}
+
+size_t HpackTable::getMaxSize() const
+{
+    return _maxSize;
+}
+
+void HpackTable::evict(size_t needed)
+{
+    while (!_entries.empty() && _size + needed > _maxSize)
+    {
+        _size -= _entries.back().first.size() + _entries.back().second.size() + 32;
+        _entries.pop_back();
+    }
+}
+
+HpackDecoder::HpackDecoder()
+{
+}
+
+bool HpackDecoder::decode(const std::string& block, std::vector<HeaderField>& headers)
+{
+    size_t pos = 0;
+    size_t listSize = 0;
+
+    while (pos < block.size())
+    {
+        unsigned char first = block[pos];
+        size_t index;
+        HeaderField field;
+
+        if (first & 0x80)
+        {
+            if (!decodeInteger(block, pos, 7, index) || !_table.get(index, field))
+                return false;
+        }
+        else if ((first & 0xe0) == 0x20)
+        {
+            if (!headers.empty() || !decodeInteger(block, pos, 5, index) || index > DEFAULT_TABLE_SIZE)
+                return false;
+            _table.setMaxSize(index);
+            continue;
+        }
+        else
+        {
+            bool indexed = first & 0x40;
+            if (!decodeInteger(block, pos, indexed ? 6 : 4, index))
+                return false;
+            if (index && !_table.get(index, field))
+                return false;
+            if (!index && !decodeString(block, pos, field.first))
+                return false;
+            if (!decodeString(block, pos, field.second))
+                return false;
+            if (indexed)
+                _table.add(field);
+        }
+        listSize += field.first.size() + field.second.size() + 32;
+        if (listSize > MAX_HEADER_LIST_SIZE)
+            return false;
+        headers.push_back(field);
+    }
+    return true;
+}
+
+HpackEncoder::HpackEncoder() : _pendingSize(DEFAULT_TABLE_SIZE), _sizeChanged(false)
+{
+}
+
+// Follows the peer's SETTINGS_HEADER_TABLE_SIZE, capped at the default;
+// the change is announced at the start of the next header block.
+void HpackEncoder::setMaxTableSize(size_t size)
+{
+    if (size > DEFAULT_TABLE_SIZE)
+        size = DEFAULT_TABLE_SIZE;
+    if (size == _table.getMaxSize())
+        return;
+    _table.setMaxSize(size);
+    _pendingSize = size;
+    _sizeChanged = true;
+}
+
+void HpackEncoder::encode(const std::vector<HeaderField>& headers, std::string& block)
+{
+    if (_sizeChanged)
+    {
+        encodeInteger(block, 0x20, 5, _pendingSize);
+        _sizeChanged = false;
+    }
+    for (size_t i = 0; i < headers.size(); ++i)
+    {
+        const HeaderField& field = headers[i];
+        bool nameOnly;
+        size_t index = _table.find(field, nameOnly);
+
+        if (index && !nameOnly)
+        {
+            encodeInteger(block, 0x80, 7, index);
+            continue;
+        }
+        bool indexed = worthIndexing(field.first);
+        if (indexed)
+            encodeInteger(block, 0x40, 6, index);
+        else
+            encodeInteger(block, field.first == "set-cookie" ? 0x10 : 0x00, 4, index);
+        if (!index)
+            encodeString(block, field.first);
+        encodeString(block, field.second);
+        if (indexed)
+            _table.add(field);
+    }
+}
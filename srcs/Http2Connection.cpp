@@ -0,0 +1,978 @@
+#include "Http2Connection.hpp"
+#include <sstream>
+#include <cstdlib>
+#include <algorithm>
+
+const char* const Http2Connection::PREFACE = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+namespace
+{
+    const size_t PREFACE_LENGTH = 24;
+    const size_t FRAME_HEADER = 9;
+    const size_t LOCAL_MAX_FRAME = 16384;
+    const unsigned int MAX_CONCURRENT_STREAMS = 128;
+    const size_t STREAM_WINDOW = 1 << 20;
+    const size_t CONNECTION_WINDOW = 1 << 24;
+    const long MAX_WINDOW = 0x7fffffffL;
+    const size_t MAX_TREE_NODES = 512;
+    const int MAX_TREE_DEPTH = 64;
+
+    const unsigned char FLAG_END_STREAM = 0x1;
+    const unsigned char FLAG_ACK = 0x1;
+    const unsigned char FLAG_END_HEADERS = 0x4;
+    const unsigned char FLAG_PADDED = 0x8;
+    const unsigned char FLAG_PRIORITY = 0x20;
+
+    unsigned int readUint32(const char* data)
+    {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+        return (static_cast<unsigned int>(bytes[0]) << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+    }
+
+    void appendUint32(std::string& out, unsigned int value)
+    {
+        out += static_cast<char>(value >> 24);
+        out += static_cast<char>(value >> 16);
+        out += static_cast<char>(value >> 8);
+        out += static_cast<char>(value);
+    }
+
+    std::string toString(size_t value)
+    {
+        std::ostringstream oss;
+        oss << value;
+        return oss.str();
+    }
+
+    // "content-type" -> "Content-Type", the spelling HttpRequest looks up.
+    std::string canonicalName(const std::string& name)
+    {
+        std::string result = name;
+        bool upper = true;
+        for (size_t i = 0; i < result.size(); ++i)
+        {
+            if (upper && result[i] >= 'a' && result[i] <= 'z')
+                result[i] = result[i] - 'a' + 'A';
+            upper = result[i] == '-';
+        }
+        return result;
+    }
+
+    bool isConnectionHeader(const std::string& name)
+    {
+        return name == "connection" || name == "keep-alive" || name == "proxy-connection"
+            || name == "transfer-encoding" || name == "upgrade";
+    }
+
+    // RFC 9218: "u=N" sets the urgency, 0 (highest) to 7, default 3.
+    int parseUrgency(const std::string& value)
+    {
+        size_t pos = value.find("u=");
+        if (pos == std::string::npos || pos + 2 >= value.size() || value[pos + 2] < '0' || value[pos + 2] > '7')
+            return 3;
+        return value[pos + 2] - '0';
+    }
+}
+
+Http2Connection::Stream::Stream() : requestDone(false), dispatched(false), bodyLimit(static_cast<size_t>(-1)),
+    awaitingLimit(false), oversized(false), unacked(0), sendWindow(0),
+    headersSent(false), chunked(false), untilEnd(false), remaining(0), dataOffset(0), ended(false),
+    endSent(false), urgency(3), pass(0)
+{
+}
+
+// The server preface (our SETTINGS and a larger connection window) can be
+// sent right away, before the client preface has arrived.
+Http2Connection::Http2Connection() : _prefaceSeen(false), _settingsSeen(false), _headerStream(0),
+    _headerEndStream(false), _lastStream(0), _sendWindow(65535), _recvUnacked(0), _peerInitialWindow(65535),
+    _peerMaxFrame(16384), _virtualTime(0), _goingAway(false), _failed(false)
+{
+    std::string settings;
+    settings += '\0';
+    settings += '\3';
+    appendUint32(settings, MAX_CONCURRENT_STREAMS);
+    settings += '\0';
+    settings += '\4';
+    appendUint32(settings, STREAM_WINDOW);
+    settings += '\0';
+    settings += '\6';
+    appendUint32(settings, HpackDecoder::MAX_HEADER_LIST_SIZE);
+    writeFrame(_control, SETTINGS, 0, 0, settings.data(), settings.size());
+    writeWindowUpdate(0, CONNECTION_WINDOW - 65535);
+}
+
+// Returns false on a connection error; a GOAWAY is then queued and the
+// connection should be closed once it is written.
+bool Http2Connection::feed(const char* data, size_t length)
+{
+    if (_failed)
+        return false;
+    _input.append(data, length);
+
+    size_t pos = 0;
+    if (!_prefaceSeen)
+    {
+        size_t compared = std::min(_input.size(), PREFACE_LENGTH);
+        if (_input.compare(0, compared, PREFACE, compared) != 0)
+            return fail(PROTOCOL_ERROR);
+        if (_input.size() < PREFACE_LENGTH)
+            return true;
+        _prefaceSeen = true;
+        pos = PREFACE_LENGTH;
+    }
+    while (_input.size() - pos >= FRAME_HEADER)
+    {
+        const unsigned char* header = reinterpret_cast<const unsigned char*>(_input.data() + pos);
+        size_t frameLength = (header[0] << 16) | (header[1] << 8) | header[2];
+        unsigned char type = header[3];
+        unsigned char flags = header[4];
+        unsigned int stream = readUint32(_input.data() + pos + 5) & 0x7fffffff;
+
+        if (frameLength > LOCAL_MAX_FRAME)
+            return fail(FRAME_SIZE_ERROR);
+        if (_input.size() - pos - FRAME_HEADER < frameLength)
+            break;
+        if (!_settingsSeen && type != SETTINGS)
+            return fail(PROTOCOL_ERROR);
+        if (!processFrame(type, flags, stream, _input.data() + pos + FRAME_HEADER, frameLength))
+        {
+            _input.clear();
+            return false;
+        }
+        pos += FRAME_HEADER + frameLength;
+    }
+    _input.erase(0, pos);
+    return true;
+}
+
+bool Http2Connection::processFrame(unsigned char type, unsigned char flags, unsigned int stream, const char* payload, size_t length)
+{
+    if (_headerStream && (type != CONTINUATION || stream != _headerStream))
+        return fail(PROTOCOL_ERROR);
+
+    switch (type)
+    {
+        case DATA:
+            return onData(flags, stream, payload, length);
+        case HEADERS:
+            return onHeaders(flags, stream, payload, length);
+        case PRIORITY:
+            if (stream == 0)
+                return fail(PROTOCOL_ERROR);
+            if (length != 5)
+                return fail(FRAME_SIZE_ERROR);
+            if ((readUint32(payload) & 0x7fffffff) == stream)
+                abortStream(stream, PROTOCOL_ERROR);
+            else
+                setPriority(stream, readUint32(payload) & 0x7fffffff, static_cast<unsigned char>(payload[4]) + 1, payload[0] & 0x80);
+            return true;
+        case RST_STREAM:
+            if (stream == 0 || stream > _lastStream)
+                return fail(PROTOCOL_ERROR);
+            if (length != 4)
+                return fail(FRAME_SIZE_ERROR);
+            {
+                std::map<unsigned int, Stream>::iterator it = _streams.find(stream);
+                if (it != _streams.end() && it->second.dispatched)
+                    _resets.push_back(stream);
+            }
+            closeStream(stream);
+            return true;
+        case SETTINGS:
+            if (stream != 0)
+                return fail(PROTOCOL_ERROR);
+            return onSettings(flags, payload, length);
+        case PUSH_PROMISE:
+            return fail(PROTOCOL_ERROR);
+        case PING:
+            if (stream != 0)
+                return fail(PROTOCOL_ERROR);
+            if (length != 8)
+                return fail(FRAME_SIZE_ERROR);
+            if (!(flags & FLAG_ACK))
+                writeFrame(_control, PING, FLAG_ACK, 0, payload, length);
+            return true;
+        case GOAWAY:
+            if (stream != 0)
+                return fail(PROTOCOL_ERROR);
+            _goingAway = true;
+            return true;
+        case WINDOW_UPDATE:
+            return onWindowUpdate(stream, payload, length);
+        case CONTINUATION:
+            if (!_headerStream)
+                return fail(PROTOCOL_ERROR);
+            // A block that cannot decode within the advertised header list
+            // size is refused before it is buffered any further.
+            if (_headerBlock.size() + length > HpackDecoder::MAX_HEADER_LIST_SIZE)
+                return fail(ENHANCE_YOUR_CALM);
+            _headerBlock.append(payload, length);
+            if (flags & FLAG_END_HEADERS)
+                return onHeaderBlock();
+            return true;
+        default:
+            return true;
+    }
+}
+
+bool Http2Connection::onData(unsigned char flags, unsigned int stream, const char* payload, size_t length)
+{
+    if (stream == 0)
+        return fail(PROTOCOL_ERROR);
+    size_t dataLength = length;
+    if (flags & FLAG_PADDED)
+    {
+        if (length == 0 || static_cast<unsigned char>(payload[0]) >= length)
+            return fail(PROTOCOL_ERROR);
+        dataLength = length - 1 - static_cast<unsigned char>(payload[0]);
+        ++payload;
+    }
+
+    // Flow control counts the whole payload, padding included, even for
+    // streams that are already gone.
+    _recvUnacked += length;
+    if (_recvUnacked > CONNECTION_WINDOW)
+        return fail(FLOW_CONTROL_ERROR);
+    if (_recvUnacked >= CONNECTION_WINDOW / 2)
+    {
+        writeWindowUpdate(0, _recvUnacked);
+        _recvUnacked = 0;
+    }
+
+    std::map<unsigned int, Stream>::iterator it = _streams.find(stream);
+    if (it == _streams.end() || it->second.requestDone)
+    {
+        if (stream > _lastStream)
+            return fail(PROTOCOL_ERROR);
+        abortStream(stream, STREAM_CLOSED);
+        return true;
+    }
+    Stream& s = it->second;
+    s.unacked += length;
+    if (s.unacked > STREAM_WINDOW)
+    {
+        abortStream(stream, FLOW_CONTROL_ERROR);
+        return true;
+    }
+    if (!s.oversized)
+    {
+        if (s.body.size() + dataLength > s.bodyLimit)
+            rejectBody(stream, s);
+        else
+            s.body.append(payload, dataLength);
+    }
+    if (flags & FLAG_END_STREAM)
+        finishRequest(stream, s);
+    else
+        creditStream(stream, s);
+    return true;
+}
+
+// No credit while the limit is unknown or once the body went over it, so
+// the client cannot send more than one stream window past the limit.
+void Http2Connection::creditStream(unsigned int id, Stream& stream)
+{
+    if (stream.awaitingLimit || stream.oversized || stream.unacked < STREAM_WINDOW / 2)
+        return;
+    writeWindowUpdate(id, stream.unacked);
+    stream.unacked = 0;
+}
+
+void Http2Connection::rejectBody(unsigned int id, Stream& stream)
+{
+    stream.oversized = true;
+    stream.dispatched = true;
+    std::string().swap(stream.body);
+    _oversized.push_back(id);
+}
+
+bool Http2Connection::onHeaders(unsigned char flags, unsigned int stream, const char* payload, size_t length)
+{
+    if (stream == 0)
+        return fail(PROTOCOL_ERROR);
+    size_t padding = 0;
+    if (flags & FLAG_PADDED)
+    {
+        if (length == 0)
+            return fail(PROTOCOL_ERROR);
+        padding = static_cast<unsigned char>(payload[0]);
+        ++payload;
+        --length;
+    }
+    if (flags & FLAG_PRIORITY)
+    {
+        if (length < 5)
+            return fail(PROTOCOL_ERROR);
+        unsigned int parent = readUint32(payload) & 0x7fffffff;
+        if (parent != stream)
+            setPriority(stream, parent, static_cast<unsigned char>(payload[4]) + 1, payload[0] & 0x80);
+        payload += 5;
+        length -= 5;
+    }
+    if (padding > length)
+        return fail(PROTOCOL_ERROR);
+
+    _headerBlock.assign(payload, length - padding);
+    _headerStream = stream;
+    _headerEndStream = flags & FLAG_END_STREAM;
+    if (flags & FLAG_END_HEADERS)
+        return onHeaderBlock();
+    return true;
+}
+
+// The block is always decoded, even for refused streams, to keep the
+// decoder's dynamic table in step with the client's.
+bool Http2Connection::onHeaderBlock()
+{
+    unsigned int id = _headerStream;
+    std::vector<HeaderField> headers;
+
+    _headerStream = 0;
+    if (!_decoder.decode(_headerBlock, headers))
+        return fail(COMPRESSION_ERROR);
+    _headerBlock.clear();
+
+    std::map<unsigned int, Stream>::iterator it = _streams.find(id);
+    if (it != _streams.end())
+    {
+        // Trailers: their fields are dropped, they only end the request.
+        if (it->second.requestDone || !_headerEndStream)
+            abortStream(id, it->second.requestDone ? STREAM_CLOSED : PROTOCOL_ERROR);
+        else
+            finishRequest(id, it->second);
+        return true;
+    }
+    if (id % 2 == 0 || id <= _lastStream)
+        return fail(PROTOCOL_ERROR);
+    _lastStream = id;
+    if (_goingAway)
+        return true;
+    if (_streams.size() >= MAX_CONCURRENT_STREAMS)
+    {
+        writeReset(id, REFUSED_STREAM);
+        return true;
+    }
+
+    Stream& s = _streams[id];
+    s.sendWindow = _peerInitialWindow;
+    s.pass = _virtualTime;
+    if (_tree.find(id) == _tree.end())
+        setPriority(id, 0, 16, false);
+    if (!buildRequest(s, headers))
+    {
+        abortStream(id, PROTOCOL_ERROR);
+        return true;
+    }
+    if (_headerEndStream)
+        finishRequest(id, s);
+    else
+    {
+        s.awaitingLimit = true;
+        _heads.push_back(id);
+    }
+    return true;
+}
+
+bool Http2Connection::buildRequest(Stream& stream, const std::vector<HeaderField>& headers)
+{
+    std::string method, path, scheme, authority;
+    std::vector<HeaderField> fields;
+    bool regular = false;
+    bool hasHost = false;
+
+    for (size_t i = 0; i < headers.size(); ++i)
+    {
+        const std::string& name = headers[i].first;
+        const std::string& value = headers[i].second;
+
+        if (name.empty() || name.find_first_of("ABCDEFGHIJKLMNOPQRSTUVWXYZ\r\n") != std::string::npos
+            || value.find_first_of("\r\n") != std::string::npos)
+            return false;
+        if (name[0] == ':')
+        {
+            std::string* target = NULL;
+            if (name == ":method")
+                target = &method;
+            else if (name == ":path")
+                target = &path;
+            else if (name == ":scheme")
+                target = &scheme;
+            else if (name == ":authority")
+                target = &authority;
+            if (regular || !target || !target->empty())
+                return false;
+            *target = value;
+            continue;
+        }
+        regular = true;
+        if (isConnectionHeader(name) || (name == "te" && value != "trailers"))
+            return false;
+        if (name == "content-length")
+            continue;
+        if (name == "priority")
+            stream.urgency = parseUrgency(value);
+        if (name == "host")
+            hasHost = true;
+
+        size_t j = 0;
+        while (j < fields.size() && fields[j].first != name)
+            ++j;
+        if (j == fields.size())
+            fields.push_back(headers[i]);
+        else
+            fields[j].second += (name == "cookie" ? "; " : ", ") + value;
+    }
+    if (method.empty() || path.empty() || scheme.empty())
+        return false;
+
+    stream.method = method;
+    stream.request = method + " " + path + " HTTP/2.0\r\n";
+    if (!hasHost && !authority.empty())
+        stream.request += "Host: " + authority + "\r\n";
+    for (size_t i = 0; i < fields.size(); ++i)
+        stream.request += canonicalName(fields[i].first) + ": " + fields[i].second + "\r\n";
+    return true;
+}
+
+// Content-Length is taken from the DATA actually received, never from
+// the client's header.
+void Http2Connection::finishRequest(unsigned int id, Stream& stream)
+{
+    stream.requestDone = true;
+    if (stream.awaitingLimit || stream.oversized)
+        return;
+    if (!stream.body.empty() || stream.method == "POST" || stream.method == "PUT")
+        stream.request += "Content-Length: " + toString(stream.body.size()) + "\r\n";
+    stream.request += "\r\n";
+    stream.request += stream.body;
+    std::string().swap(stream.body);
+    _ready.push_back(id);
+}
+
+bool Http2Connection::onSettings(unsigned char flags, const char* payload, size_t length)
+{
+    if (flags & FLAG_ACK)
+        return length == 0 ? true : fail(FRAME_SIZE_ERROR);
+    if (length % 6)
+        return fail(FRAME_SIZE_ERROR);
+
+    for (size_t i = 0; i < length; i += 6)
+    {
+        unsigned int id = (static_cast<unsigned char>(payload[i]) << 8) | static_cast<unsigned char>(payload[i + 1]);
+        unsigned int value = readUint32(payload + i + 2);
+
+        if (id == 1)
+            _encoder.setMaxTableSize(value);
+        else if (id == 2 && value > 1)
+            return fail(PROTOCOL_ERROR);
+        else if (id == 4)
+        {
+            if (value > static_cast<unsigned long>(MAX_WINDOW))
+                return fail(FLOW_CONTROL_ERROR);
+            long delta = static_cast<long>(value) - _peerInitialWindow;
+            for (std::map<unsigned int, Stream>::iterator it = _streams.begin(); it != _streams.end(); ++it)
+                it->second.sendWindow += delta;
+            _peerInitialWindow = value;
+        }
+        else if (id == 5)
+        {
+            if (value < 16384 || value > 16777215)
+                return fail(PROTOCOL_ERROR);
+            _peerMaxFrame = value;
+        }
+    }
+    _settingsSeen = true;
+    writeFrame(_control, SETTINGS, FLAG_ACK, 0, NULL, 0);
+    return true;
+}
+
+bool Http2Connection::onWindowUpdate(unsigned int stream, const char* payload, size_t length)
+{
+    if (length != 4)
+        return fail(FRAME_SIZE_ERROR);
+    long increment = readUint32(payload) & 0x7fffffff;
+
+    if (stream == 0)
+    {
+        if (increment == 0)
+            return fail(PROTOCOL_ERROR);
+        _sendWindow += increment;
+        if (_sendWindow > MAX_WINDOW)
+            return fail(FLOW_CONTROL_ERROR);
+        return true;
+    }
+    std::map<unsigned int, Stream>::iterator it = _streams.find(stream);
+    if (it == _streams.end())
+        return true;
+    if (increment == 0)
+        abortStream(stream, PROTOCOL_ERROR);
+    else if ((it->second.sendWindow += increment) > MAX_WINDOW)
+        abortStream(stream, FLOW_CONTROL_ERROR);
+    return true;
+}
+
+// RFC 7540 section 5.3.3: a stream made dependent on one of its own
+// descendants first moves that descendant up to its previous parent.
+void Http2Connection::setPriority(unsigned int stream, unsigned int parent, int weight, bool exclusive)
+{
+    std::map<unsigned int, Priority>::iterator self = _tree.find(stream);
+    if (self == _tree.end() && _tree.size() >= MAX_TREE_NODES)
+        return;
+    unsigned int previous = self == _tree.end() ? 0 : self->second.parent;
+
+    unsigned int node = parent;
+    for (int depth = 0; node && depth < MAX_TREE_DEPTH; ++depth)
+    {
+        std::map<unsigned int, Priority>::iterator it = _tree.find(node);
+        if (it == _tree.end())
+            break;
+        if (it->second.parent == stream)
+        {
+            _tree[parent].parent = previous;
+            break;
+        }
+        node = it->second.parent;
+    }
+    if (exclusive)
+    {
+        for (std::map<unsigned int, Priority>::iterator it = _tree.begin(); it != _tree.end(); ++it)
+        {
+            if (it->second.parent == parent && it->first != stream)
+                it->second.parent = stream;
+        }
+    }
+    Priority& priority = _tree[stream];
+    priority.parent = parent;
+    priority.weight = weight;
+}
+
+bool Http2Connection::blockedByAncestor(unsigned int stream, const std::vector<unsigned int>& ready) const
+{
+    unsigned int node = stream;
+    for (int depth = 0; depth < MAX_TREE_DEPTH; ++depth)
+    {
+        std::map<unsigned int, Priority>::const_iterator it = _tree.find(node);
+        if (it == _tree.end() || it->second.parent == 0)
+            return false;
+        node = it->second.parent;
+        if (std::find(ready.begin(), ready.end(), node) != ready.end())
+            return true;
+    }
+    return false;
+}
+
+// A response only ends before its request when the body was refused; the
+// client is then asked to stop sending it (RFC 9113 section 8.1).
+void Http2Connection::completeStream(unsigned int id)
+{
+    std::map<unsigned int, Stream>::iterator it = _streams.find(id);
+    if (it != _streams.end() && !it->second.requestDone)
+        writeReset(id, NO_ERROR);
+    closeStream(id);
+}
+
+// Children of a closed stream move up to its parent.
+void Http2Connection::closeStream(unsigned int stream)
+{
+    _streams.erase(stream);
+    _ready.erase(std::remove(_ready.begin(), _ready.end(), stream), _ready.end());
+    std::map<unsigned int, Priority>::iterator self = _tree.find(stream);
+    if (self == _tree.end())
+        return;
+    unsigned int parent = self->second.parent;
+    _tree.erase(self);
+    for (std::map<unsigned int, Priority>::iterator it = _tree.begin(); it != _tree.end(); ++it)
+    {
+        if (it->second.parent == stream)
+            it->second.parent = parent;
+    }
+}
+
+// A stream error: the stream is reset, and reported through nextReset()
+// if its request was already handed out.
+void Http2Connection::abortStream(unsigned int stream, ErrorCode code)
+{
+    std::map<unsigned int, Stream>::iterator it = _streams.find(stream);
+    if (it != _streams.end() && it->second.dispatched)
+        _resets.push_back(stream);
+    writeReset(stream, code);
+    closeStream(stream);
+}
+
+bool Http2Connection::nextRequestHead(unsigned int& stream, std::string& head)
+{
+    while (!_heads.empty())
+    {
+        unsigned int id = _heads.front();
+        _heads.pop_front();
+        std::map<unsigned int, Stream>::iterator it = _streams.find(id);
+        if (it == _streams.end() || !it->second.awaitingLimit)
+            continue;
+        stream = id;
+        head = it->second.request + "\r\n";
+        return true;
+    }
+    return false;
+}
+
+// The request is released here if its body already ended within limit.
+void Http2Connection::limitBody(unsigned int id, size_t limit)
+{
+    std::map<unsigned int, Stream>::iterator it = _streams.find(id);
+    if (it == _streams.end() || !it->second.awaitingLimit)
+        return;
+    Stream& s = it->second;
+    s.awaitingLimit = false;
+    s.bodyLimit = limit;
+    if (s.body.size() > limit)
+        rejectBody(id, s);
+    else if (s.requestDone)
+        finishRequest(id, s);
+    else
+        creditStream(id, s);
+}
+
+bool Http2Connection::nextOversized(unsigned int& stream, std::string& head)
+{
+    while (!_oversized.empty())
+    {
+        unsigned int id = _oversized.front();
+        _oversized.pop_front();
+        std::map<unsigned int, Stream>::iterator it = _streams.find(id);
+        if (it == _streams.end())
+            continue;
+        stream = id;
+        head = it->second.request + "\r\n";
+        std::string().swap(it->second.request);
+        return true;
+    }
+    return false;
+}
+
+bool Http2Connection::nextRequest(unsigned int& stream, std::string& rawRequest)
+{
+    while (!_ready.empty())
+    {
+        unsigned int id = _ready.front();
+        _ready.pop_front();
+        std::map<unsigned int, Stream>::iterator it = _streams.find(id);
+        if (it == _streams.end())
+            continue;
+        it->second.dispatched = true;
+        stream = id;
+        rawRequest.swap(it->second.request);
+        std::string().swap(it->second.request);
+        return true;
+    }
+    return false;
+}
+
+bool Http2Connection::nextReset(unsigned int& stream)
+{
+    if (_resets.empty())
+        return false;
+    stream = _resets.front();
+    _resets.pop_front();
+    return true;
+}
+
+// Takes the HTTP/1.1 response for a stream in pieces of any size: the
+// head becomes a HEADERS frame, the body (de-chunked) is queued as DATA.
+void Http2Connection::respond(unsigned int id, const char* data, size_t length)
+{
+    std::map<unsigned int, Stream>::iterator it = _streams.find(id);
+    if (it == _streams.end() || it->second.ended)
+        return;
+    Stream& s = it->second;
+
+    if (!s.headersSent)
+    {
+        size_t previous = s.head.size();
+        s.head.append(data, length);
+        size_t end = s.head.find("\r\n\r\n");
+        if (end == std::string::npos)
+            return;
+        s.head.erase(end + 4);
+        data += s.head.size() - previous;
+        length -= s.head.size() - previous;
+        sendResponseHeaders(id, s);
+        if (s.endSent)
+        {
+            completeStream(id);
+            return;
+        }
+    }
+    if (s.ended || length == 0)
+        return;
+
+    if (s.chunked)
+    {
+        s.chunks.feed(data, length, &s.data);
+        if (s.chunks.hasError())
+        {
+            writeReset(id, INTERNAL_ERROR);
+            closeStream(id);
+            return;
+        }
+        s.ended = s.chunks.isDone();
+    }
+    else if (s.untilEnd)
+        s.data.append(data, length);
+    else
+    {
+        size_t body = std::min(length, s.remaining);
+        s.data.append(data, body);
+        s.remaining -= body;
+        s.ended = s.remaining == 0;
+    }
+}
+
+void Http2Connection::sendResponseHeaders(unsigned int id, Stream& s)
+{
+    std::istringstream lines(s.head);
+    std::string line;
+    std::string version;
+    std::string status;
+    std::vector<HeaderField> fields;
+    bool hasLength = false;
+
+    std::getline(lines, line);
+    std::istringstream statusLine(line);
+    statusLine >> version >> status;
+    fields.push_back(HeaderField(":status", status));
+    while (std::getline(lines, line))
+    {
+        size_t colon = line.find(':');
+        if (colon == std::string::npos)
+            continue;
+        std::string name = line.substr(0, colon);
+        std::string value = line.substr(colon + 1);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        value.erase(0, value.find_first_not_of(" \t"));
+        value.erase(value.find_last_not_of(" \t\r") + 1);
+
+        if (isConnectionHeader(name))
+        {
+            if (name == "transfer-encoding" && value.find("chunked") != std::string::npos)
+                s.chunked = true;
+            continue;
+        }
+        if (name == "content-length")
+        {
+            hasLength = true;
+            s.remaining = std::strtoul(value.c_str(), NULL, 10);
+        }
+        fields.push_back(HeaderField(name, value));
+    }
+    if (s.chunked && hasLength)
+    {
+        for (size_t i = 0; i < fields.size(); ++i)
+        {
+            if (fields[i].first == "content-length")
+                fields.erase(fields.begin() + i--);
+        }
+        hasLength = false;
+    }
+
+    int code = std::atoi(status.c_str());
+    bool noBody = s.method == "HEAD" || code == 204 || code == 304 || (code >= 100 && code < 200);
+    s.untilEnd = !noBody && !s.chunked && !hasLength;
+    s.ended = noBody || (hasLength && s.remaining == 0);
+    s.headersSent = true;
+    std::string().swap(s.head);
+
+    std::string block;
+    _encoder.encode(fields, block);
+    for (size_t offset = 0; offset == 0 || offset < block.size(); )
+    {
+        size_t chunk = std::min(block.size() - offset, _peerMaxFrame);
+        unsigned char flags = offset + chunk == block.size() ? FLAG_END_HEADERS : 0;
+        if (offset == 0 && s.ended)
+            flags |= FLAG_END_STREAM;
+        writeFrame(_control, offset == 0 ? HEADERS : CONTINUATION, flags, id, block.data() + offset, chunk);
+        offset += chunk;
+    }
+    s.endSent = s.ended;
+}
+
+// The producer is done with the stream. A body cut short of its declared
+// length is reported to the client as a reset rather than a clean end.
+void Http2Connection::endResponse(unsigned int id)
+{
+    std::map<unsigned int, Stream>::iterator it = _streams.find(id);
+    if (it == _streams.end() || it->second.ended)
+        return;
+    if (it->second.headersSent && it->second.untilEnd)
+        it->second.ended = true;
+    else
+        resetStream(id);
+}
+
+void Http2Connection::resetStream(unsigned int id)
+{
+    if (_streams.find(id) == _streams.end())
+        return;
+    writeReset(id, INTERNAL_ERROR);
+    closeStream(id);
+}
+
+bool Http2Connection::sendable(const Stream& s) const
+{
+    if (!s.headersSent || s.endSent)
+        return false;
+    if (s.dataOffset < s.data.size())
+        return s.sendWindow > 0 && _sendWindow > 0;
+    return s.ended;
+}
+
+// Control frames go first, then DATA frames one at a time to the stream
+// picked by priority, until about budget bytes are written or flow control
+// stops every stream.
+size_t Http2Connection::produce(std::string& out, size_t budget)
+{
+    size_t start = out.size();
+    out += _control;
+    std::string().swap(_control);
+
+    while (out.size() - start < budget)
+    {
+        std::vector<unsigned int> ready;
+        int urgency = 8;
+        for (std::map<unsigned int, Stream>::iterator it = _streams.begin(); it != _streams.end(); ++it)
+        {
+            if (!sendable(it->second) || it->second.urgency > urgency)
+                continue;
+            if (it->second.urgency < urgency)
+                ready.clear();
+            urgency = it->second.urgency;
+            ready.push_back(it->first);
+        }
+        if (ready.empty())
+            break;
+
+        unsigned int id = 0;
+        for (size_t i = 0; i < ready.size(); ++i)
+        {
+            if (blockedByAncestor(ready[i], ready))
+                continue;
+            if (!id || _streams[ready[i]].pass < _streams[id].pass)
+                id = ready[i];
+        }
+        if (!id)
+            id = ready[0];
+
+        Stream& s = _streams[id];
+        size_t length = s.data.size() - s.dataOffset;
+        if (length)
+        {
+            length = std::min(length, _peerMaxFrame);
+            length = std::min(length, static_cast<size_t>(std::min(s.sendWindow, _sendWindow)));
+        }
+        bool end = s.ended && s.dataOffset + length == s.data.size();
+        writeFrame(out, DATA, end ? FLAG_END_STREAM : 0, id, s.data.data() + s.dataOffset, length);
+        s.dataOffset += length;
+        s.sendWindow -= length;
+        _sendWindow -= length;
+
+        std::map<unsigned int, Priority>::iterator priority = _tree.find(id);
+        int weight = priority == _tree.end() ? 16 : priority->second.weight;
+        s.pass += (length + FRAME_HEADER) * 256 / weight;
+        _virtualTime = s.pass;
+        if (s.dataOffset > (1 << 20) && s.dataOffset * 2 > s.data.size())
+        {
+            s.data.erase(0, s.dataOffset);
+            s.dataOffset = 0;
+        }
+        if (end)
+        {
+            s.endSent = true;
+            completeStream(id);
+        }
+    }
+    return out.size() - start;
+}
+
+bool Http2Connection::wantsWrite() const
+{
+    if (!_control.empty())
+        return true;
+    for (std::map<unsigned int, Stream>::const_iterator it = _streams.begin(); it != _streams.end(); ++it)
+    {
+        if (sendable(it->second))
+            return true;
+    }
+    return false;
+}
+
+void Http2Connection::goAway()
+{
+    if (_goingAway)
+        return;
+    _goingAway = true;
+    std::string payload;
+    appendUint32(payload, _lastStream);
+    appendUint32(payload, NO_ERROR);
+    writeFrame(_control, GOAWAY, 0, 0, payload.data(), payload.size());
+}
+
+bool Http2Connection::isFinished() const
+{
+    return _control.empty() && (_failed || (_goingAway && _streams.empty()));
+}
+
+size_t Http2Connection::activeStreams() const
+{
+    return _streams.size();
+}
+
+bool Http2Connection::awaitingClient() const
+{
+    if (_headerStream)
+        return true;
+    for (std::map<unsigned int, Stream>::const_iterator it = _streams.begin(); it != _streams.end(); ++it)
+    {
+        if (!it->second.requestDone)
+            return true;
+    }
+    return false;
+}
+
+void Http2Connection::writeFrame(std::string& out, unsigned char type, unsigned char flags, unsigned int stream, const char* payload, size_t length) const
+{
+    out += static_cast<char>(length >> 16);
+    out += static_cast<char>(length >> 8);
+    out += static_cast<char>(length);
+    out += static_cast<char>(type);
+    out += static_cast<char>(flags);
+    appendUint32(out, stream);
+    if (length)
+        out.append(payload, length);
+}
+
+void Http2Connection::writeWindowUpdate(unsigned int stream, size_t increment)
+{
+    std::string payload;
+    appendUint32(payload, increment);
+    writeFrame(_control, WINDOW_UPDATE, 0, stream, payload.data(), payload.size());
+}
+
+void Http2Connection::writeReset(unsigned int stream, ErrorCode code)
+{
+    std::string payload;
+    appendUint32(payload, code);
+    writeFrame(_control, RST_STREAM, 0, stream, payload.data(), payload.size());
+}
+
+bool Http2Connection::fail(ErrorCode code)
+{
+    if (!_failed)
+    {
+        std::string payload;
+        appendUint32(payload, _lastStream);
+        appendUint32(payload, code);
+        writeFrame(_control, GOAWAY, 0, 0, payload.data(), payload.size());
+    }
+    _failed = true;
+    _goingAway = true;
+    return false;
+}
@@ -0,0 +1,103 @@
+#include "HttpFormat.hpp"
+#include <cstring>
+
+namespace
+{
+    const char kDigitPairs[] =
+        "00010203040506070809" "10111213141516171819" "20212223242526272829"
+        "30313233343536373839" "40414243444546474849" "50515253545556575859"
+        "60616263646566676869" "70717273747576777879" "80818283848586878889"
+        "90919293949596979899";
+
+    const char kDays[] = "SunMonTueWedThuFriSat";
+    const char kMonths[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+    void twoDigits(char* out, int value)
+    {
+        out[0] = kDigitPairs[value * 2];
+        out[1] = kDigitPairs[value * 2 + 1];
+    }
+}
+
+// Writes the digits back to front, two per table lookup, then moves them
+// to the start of out. out must hold MAX_DIGITS characters.
+size_t HttpFormat::formatUnsigned(unsigned long long value, char* out)
+{
+    char buffer[MAX_DIGITS];
+    char* end = buffer + MAX_DIGITS;
+    char* p = end;
+    while (value >= 100)
+    {
+        unsigned index = static_cast<unsigned>(value % 100) * 2;
+        value /= 100;
+        *--p = kDigitPairs[index + 1];
+        *--p = kDigitPairs[index];
+    }
+    if (value >= 10)
+    {
+        *--p = kDigitPairs[value * 2 + 1];
+        *--p = kDigitPairs[value * 2];
+    }
+    else
+        *--p = static_cast<char>('0' + value);
+    std::memcpy(out, p, end - p);
+    return end - p;
+}
+
+// out must hold MAX_DIGITS + 1 characters.
+size_t HttpFormat::formatSigned(long long value, char* out)
+{
+    if (value >= 0)
+        return formatUnsigned(static_cast<unsigned long long>(value), out);
+    out[0] = '-';
+    return 1 + formatUnsigned(0ULL - static_cast<unsigned long long>(value), out + 1);
+}
+
+void HttpFormat::appendUnsigned(std::string& out, unsigned long long value)
+{
+    char buffer[MAX_DIGITS];
+    out.append(buffer, formatUnsigned(value, buffer));
+}
+
+std::string HttpFormat::toString(long long value)
+{
+    char buffer[MAX_DIGITS + 1];
+    return std::string(buffer, formatSigned(value, buffer));
+}
+
+// RFC 7231 IMF-fixdate: "Sun, 06 Nov 1994 08:49:37 GMT", DATE_LENGTH
+// characters, not terminated.
+void HttpFormat::formatDate(time_t when, char* out)
+{
+    struct tm tm;
+    gmtime_r(&when, &tm);
+    std::memcpy(out, kDays + tm.tm_wday * 3, 3);
+    std::memcpy(out + 3, ", ", 2);
+    twoDigits(out + 5, tm.tm_mday);
+    out[7] = ' ';
+    std::memcpy(out + 8, kMonths + tm.tm_mon * 3, 3);
+    out[11] = ' ';
+    int year = tm.tm_year + 1900;
+    twoDigits(out + 12, year / 100 % 100);
+    twoDigits(out + 14, year % 100);
+    out[16] = ' ';
+    twoDigits(out + 17, tm.tm_hour);
+    out[19] = ':';
+    twoDigits(out + 20, tm.tm_min);
+    out[22] = ':';
+    twoDigits(out + 23, tm.tm_sec);
+    std::memcpy(out + 25, " GMT", 4);
+}
+
+const std::string& HttpFormat::commonHeaders()
+{
+    static std::string headers("Date: Thu, 01 Jan 1970 00:00:00 GMT\r\nServer: webserv\r\n");
+    static time_t rendered = 0;
+    time_t now = std::time(NULL);
+    if (now != rendered)
+    {
+        formatDate(now, &headers[6]);
+        rendered = now;
+    }
+    return headers;
+}
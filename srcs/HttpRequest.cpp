@@ -11,49 +11,210 @@
 /* ************************************************************************** */
 
 #include "HttpRequest.hpp"
-
-HttpRequest::HttpRequest(const std::string rawRequest) : _method(""), _path(""), _httpVersion(""), _body("")
+#include "StaticPack.hpp"
+#include "HttpFormat.hpp"
+#include "HeaderScanner.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <strings.h>
+
+namespace
 {
-    std::istringstream requestStream(rawRequest);
-    std::string line;
+    const char* const kKnownNames[HttpRequest::KNOWN_HEADER_COUNT] = {
+        "Host", "Content-Length", "Content-Type", "Connection",
+        "Transfer-Encoding", "Range", "If-None-Match"
+    };
 
-    if (std::getline(requestStream, line))
+    // FNV-1a over the name with ASCII letters lowercased.
+    unsigned hashName(const char* name, size_t length)
     {
-        std::istringstream lineStream(line);
-        lineStream >> _method >> _path >> _httpVersion;
+        unsigned hash = 2166136261u;
+        for (size_t i = 0; i < length; ++i)
+        {
+            unsigned char c = static_cast<unsigned char>(name[i]);
+            if (c >= 'A' && c <= 'Z')
+                c += 'a' - 'A';
+            hash = (hash ^ c) * 16777619u;
+        }
+        return hash;
     }
 
-    while (std::getline(requestStream, line) && line != "\r")
+    struct KnownHashes
+    {
+        unsigned    hashes[HttpRequest::KNOWN_HEADER_COUNT];
+        size_t      lengths[HttpRequest::KNOWN_HEADER_COUNT];
+
+        KnownHashes()
+        {
+            for (int id = 0; id < HttpRequest::KNOWN_HEADER_COUNT; ++id)
+            {
+                lengths[id] = std::strlen(kKnownNames[id]);
+                hashes[id] = hashName(kKnownNames[id], lengths[id]);
+            }
+        }
+    };
+
+    const KnownHashes kKnown;
+
+    // Room for the status line and headers, so a response is allocated
+    // once at its final size.
+    const size_t kHeadReserve = 256;
+
+    // True unless the client did not list gzip or gave it q=0.
+    bool acceptsGzip(const std::string& header)
     {
-        std::size_t delimiter = line.find(":");
-        if (delimiter != std::string::npos)
+        std::istringstream list(header);
+        std::string coding;
+        while (std::getline(list, coding, ','))
         {
-            std::string headerName = line.substr(0, delimiter);
-            std::string headerValue = line.substr(delimiter + 2);
-            _headers[headerName] = headerValue;
+            std::string::size_type start = coding.find_first_not_of(" \t");
+            std::string::size_type semicolon = coding.find(';');
+            if (start == std::string::npos || coding.compare(start, 4, "gzip") != 0)
+                continue;
+            std::string::size_type end = coding.find_first_of(" \t;\r", start);
+            if (end != std::string::npos && end != start + 4)
+                continue;
+            if (semicolon == std::string::npos)
+                return true;
+            std::string::size_type q = coding.find("q=", semicolon);
+            return q == std::string::npos || std::strtod(coding.c_str() + q + 2, NULL) > 0;
         }
+        return false;
     }
+}
+
+HttpRequest::HttpRequest(const std::string& rawRequest) : _method(""), _path(""), _httpVersion(""), _body(""), _cgiScript(""),
+    _arena(Arena::requests()), _mark(_arena.mark()), _headers(NULL), _headerCount(0), _malformed(false)
+{
+    std::fill(_known, _known + KNOWN_HEADER_COUNT, static_cast<const Header*>(NULL));
+    size_t bodyStart = parseHead(rawRequest);
 
-    if (_method == "POST")
+    if (_method == "POST" && bodyStart < rawRequest.size())
     {
-        std::map<std::string, std::string>::const_iterator it = _headers.find("Content-Length");
-        if (it != _headers.end())
+        const Header* length = _known[CONTENT_LENGTH];
+        if (length)
         {
-            int contentLength = std::atoi(it->second.c_str());
+            int contentLength = std::atoi(length->value);
             if (contentLength > 0)
+                _body.assign(rawRequest, bodyStart, static_cast<size_t>(contentLength));
+        }
+    }
+}
+
+// Splits the request line on whitespace and the header lines on the first
+// ':', with optional whitespace trimmed around the value. A request line
+// that is not "token target HTTP/x.y", or a header line without a token
+// before its ':', marks the request malformed. Returns where the body
+// starts, or npos when the blank line after the head is missing.
+size_t HttpRequest::parseHead(const std::string& rawRequest)
+{
+    const char* raw = rawRequest.data();
+    size_t size = rawRequest.size();
+    size_t unused = HeaderScanner::npos;
+    size_t lineEnd = HeaderScanner::findLineEnd(raw, size, unused);
+
+    std::string* parts[3] = { &_method, &_path, &_httpVersion };
+    size_t pos = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+        while (pos < lineEnd && std::isspace(static_cast<unsigned char>(raw[pos])))
+            ++pos;
+        size_t start = pos;
+        while (pos < lineEnd && !std::isspace(static_cast<unsigned char>(raw[pos])))
+            ++pos;
+        parts[i]->assign(raw + start, pos - start);
+    }
+    while (pos < lineEnd && std::isspace(static_cast<unsigned char>(raw[pos])))
+        ++pos;
+    _malformed = pos < lineEnd
+        || !HeaderScanner::isToken(_method.data(), _method.size())
+        || !HeaderScanner::isTarget(_path.data(), _path.size())
+        || !HeaderScanner::isVersion(_httpVersion.data(), _httpVersion.size());
+    if (lineEnd == size)
+        return std::string::npos;
+
+    size_t headStart = lineEnd + 1;
+    size_t bodyStart = std::string::npos;
+    size_t lines = 0;
+    for (pos = headStart; pos < size; ++lines)
+    {
+        size_t end = pos + HeaderScanner::findLineEnd(raw + pos, size - pos, unused);
+        if (end == pos || (end == pos + 1 && raw[pos] == '\r'))
+        {
+            bodyStart = end < size ? end + 1 : size;
+            break;
+        }
+        pos = end + 1;
+    }
+    size_t headEnd = bodyStart == std::string::npos ? size : pos;
+    size_t headLength = headEnd - headStart;
+
+    char* head = _arena.copy(raw + headStart, headLength);
+    _headers = static_cast<Header*>(_arena.allocate(lines * sizeof(Header)));
+    for (size_t offset = 0; offset < headLength; )
+    {
+        char* line = head + offset;
+        size_t colon = HeaderScanner::npos;
+        size_t length = HeaderScanner::findLineEnd(line, headLength - offset, colon);
+        offset += length + 1;
+        if (colon == HeaderScanner::npos || !HeaderScanner::isToken(line, colon))
+        {
+            _malformed = true;
+            continue;
+        }
+        char* value = line + colon + 1;
+        char* valueEnd = line + length;
+        while (value < valueEnd && (*value == ' ' || *value == '\t'))
+            ++value;
+        while (valueEnd > value && (valueEnd[-1] == '\r' || valueEnd[-1] == ' ' || valueEnd[-1] == '\t'))
+            --valueEnd;
+        line[colon] = '\0';
+        *valueEnd = '\0';
+        Header& header = _headers[_headerCount++];
+        header.name = line;
+        header.nameLength = colon;
+        header.value = value;
+        header.valueLength = valueEnd - value;
+        header.hash = hashName(line, colon);
+        for (int id = 0; id < KNOWN_HEADER_COUNT; ++id)
+        {
+            if (header.hash == kKnown.hashes[id] && colon == kKnown.lengths[id]
+                && strncasecmp(line, kKnownNames[id], colon) == 0)
             {
-                std::vector<char> buffer(contentLength);
-                requestStream.read(&buffer[0], contentLength);
-                _body.assign(buffer.begin(), buffer.end());
+                _known[id] = &header;
+                break;
             }
         }
     }
+    return bodyStart;
+}
+
+// A repeated header answers with its last value, as the known slots do.
+const HttpRequest::Header* HttpRequest::findHeader(const char* name) const
+{
+    size_t length = std::strlen(name);
+    unsigned hash = hashName(name, length);
+    for (size_t i = _headerCount; i > 0; --i)
+    {
+        const Header& header = _headers[i - 1];
+        if (header.hash == hash && header.nameLength == length && strncasecmp(header.name, name, length) == 0)
+            return &header;
+    }
+    return NULL;
+}
+
+bool HttpRequest::headerIs(KnownHeader id, const char* value) const
+{
+    return _known[id] && strcasecmp(_known[id]->value, value) == 0;
 }
 
 std::string HttpRequest::handleRequest(ServerConfig& config)
 {
     const std::vector<ServerLocation>& locations = config.getLocations();
-    if (_body.size() > config.getClientMaxBodySize())
+    if (_malformed)
+        return findErrorPage(config, 400);
+    if (_body.size() > config.getClientMaxBodySize(_path))
         return findErrorPage(config, 413);
     for (std::vector<ServerLocation>::const_iterator it = locations.begin(); it != locations.end(); ++it)
     {
@@ -80,38 +241,58 @@ std::string HttpRequest::handleRequest(ServerConfig& config)
 
 std::string HttpRequest::handleGet(ServerConfig& config)
 {
+    const ServerLocation* packed = config.findLocation(_path);
+    if (packed && !packed->getStaticPack().empty())
+    {
+        std::string response;
+        if (handlePacked(*packed, response))
+            return response;
+    }
+
     std::string fullPath = resolveFilePath(config);
     
-    struct stat fileStat;
-    if (stat(fullPath.c_str(), &fileStat) != 0)
+    OpenFileCache::Info fileStat;
+    if (!OpenFileCache::stat(fullPath, fileStat))
         return findErrorPage(config, 404);
-    if (S_ISDIR(fileStat.st_mode))
+    if (S_ISDIR(fileStat.mode))
     {
         std::string indexPath = fullPath + "/index.html";
-        if (access(indexPath.c_str(), F_OK) != 0)
-            return findErrorPage(config, 403);
+        OpenFileCache::Info indexStat;
+        if (!OpenFileCache::stat(indexPath, indexStat))
+        {
+            const ServerLocation* location = config.findLocation(_path);
+            if (!location || !location->getAutoindex())
+                return findErrorPage(config, 403);
+            return handleAutoindex(config, *location, fullPath);
+        }
         fullPath = indexPath;
     }
     if (!isFileAccessible(fullPath))
         return findErrorPage(config, 404);
     if (fullPath.find(".py") != std::string::npos && fullPath.find("/var/www/upload/") == std::string::npos)
-        return executeCGI(fullPath, config);
+        return prepareCGI(fullPath);
     std::string fileContent = readFile(fullPath);
-    if (fileContent.empty() && S_ISREG(fileStat.st_mode))
+    if (fileContent.empty() && S_ISREG(fileStat.mode))
     {
         std::string response = "HTTP/1.1 204 No Content\r\n";
+        response += HttpFormat::commonHeaders();
         response += "Content-Length: 0\r\n";
         response += "Connection: close\r\n\r\n";
         return response;
     }
     if (fileContent.empty())
         return findErrorPage(config, 500);
-    std::ostringstream oss;
-    oss << fileContent.size();
-    std::string response = "HTTP/1.1 200 OK\r\n";
-    response += "Content-Length: " + oss.str() + "\r\n";
-    response += "Content-Type: " + getMimeType(fullPath) + "\r\n";
-    if (_headers["Connection"] == "keep-alive")
+    std::string response;
+    response.reserve(kHeadReserve + fileContent.size());
+    response += "HTTP/1.1 200 OK\r\n";
+    response += HttpFormat::commonHeaders();
+    response += "Content-Length: ";
+    HttpFormat::appendUnsigned(response, fileContent.size());
+    response += "\r\n";
+    response += "Content-Type: ";
+    response += getMimeType(config, fullPath);
+    response += "\r\n";
+    if (headerIs(CONNECTION, "keep-alive"))
         response += "Connection: keep-alive\r\n";
     else
         response += "Connection: close\r\n";
@@ -121,6 +302,89 @@ std::string HttpRequest::handleGet(ServerConfig& config)
     return response;
 }
 
+// The pack holds the URIs below the location, so "/assets/app.js" in
+// "location /assets" is looked up as "/app.js". A miss falls back to the
+// document root.
+bool HttpRequest::handlePacked(const ServerLocation& location, std::string& response)
+{
+    const StaticPack* pack = StaticPack::find(location.getStaticPack());
+    if (!pack)
+        return false;
+    std::string::size_type end = _path.find('?');
+    if (end == std::string::npos)
+        end = _path.size();
+    std::string::size_type start = std::min(location.getPath().size(), end);
+    if (start > 0 && location.getPath()[start - 1] == '/')
+        --start;
+    std::string key = start < end && _path[start] == '/' ? _path.substr(start, end - start) : "/" + _path.substr(start, end - start);
+
+    StaticPack::Hit hit;
+    if (!pack->lookup(key.data(), key.size(), acceptsGzip(getHeaderValue("Accept-Encoding")), hit))
+        return false;
+    const char* connection = headerIs(CONNECTION, "keep-alive") ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    const std::string& common = HttpFormat::commonHeaders();
+    response.reserve(hit.headLength + common.size() + std::strlen(connection) + hit.bodyLength);
+    response.append(hit.head, hit.headLength);
+    response.append(common);
+    response.append(connection);
+    response.append(hit.body, hit.bodyLength);
+    return true;
+}
+
+std::string HttpRequest::handleAutoindex(ServerConfig& config, const ServerLocation& location, const std::string& directory)
+{
+    std::string::size_type query = _path.find('?');
+    std::string uri = _path.substr(0, query);
+    if (uri.empty() || uri[uri.size() - 1] != '/')
+        return redirectToDirectory(uri + "/" + (query == std::string::npos ? "" : _path.substr(query)));
+    std::string body;
+    if (!DirectoryIndex::render(directory, uri, location.getAutoindexFormat(), body))
+        return findErrorPage(config, 403);
+
+    std::string response;
+    response.reserve(kHeadReserve + body.size());
+    response += "HTTP/1.1 200 OK\r\n";
+    response += HttpFormat::commonHeaders();
+    response += "Content-Length: ";
+    HttpFormat::appendUnsigned(response, body.size());
+    response += "\r\n";
+    if (location.getAutoindexFormat() == DirectoryIndex::JSON)
+        response += "Content-Type: application/json\r\n";
+    else
+        response += "Content-Type: text/html; charset=utf-8\r\n";
+    if (headerIs(CONNECTION, "keep-alive"))
+        response += "Connection: keep-alive\r\n";
+    else
+        response += "Connection: close\r\n";
+    response += "\r\n";
+    response += body;
+    return response;
+}
+
+// Links in a listing are relative, so they only resolve against the
+// directory once its URI ends with '/'.
+std::string HttpRequest::redirectToDirectory(const std::string& location)
+{
+    static const char body[] = "<html>\r\n<head><title>301 Moved Permanently</title></head>\r\n"
+        "<body>\r\n<h1>301 Moved Permanently</h1>\r\n</body>\r\n</html>\r\n";
+    std::string response;
+    response.reserve(kHeadReserve + location.size() + sizeof(body));
+    response += "HTTP/1.1 301 Moved Permanently\r\n";
+    response += HttpFormat::commonHeaders();
+    response += "Location: ";
+    response += location;
+    response += "\r\nContent-Type: text/html\r\nContent-Length: ";
+    HttpFormat::appendUnsigned(response, sizeof(body) - 1);
+    response += "\r\n";
+    if (headerIs(CONNECTION, "keep-alive"))
+        response += "Connection: keep-alive\r\n";
+    else
+        response += "Connection: close\r\n";
+    response += "\r\n";
+    response += body;
+    return response;
+}
+
 void HttpRequest::setupChildProcess(int outputPipe[2], int inputPipe[2], const std::string& scriptPath)
 {
     close(outputPipe[0]);
@@ -146,101 +410,16 @@ void HttpRequest::setupChildProcess(int outputPipe[2], int inputPipe[2], const s
     exit(1);
 }
 
-std::string HttpRequest::handleParentProcess(int outputPipe[2], int inputPipe[2], pid_t pid)
+// CGI scripts are run by the server loop (Server::startCGI) so they do
+// not block other clients; the request only records which script to run.
+std::string HttpRequest::prepareCGI(const std::string& scriptPath)
 {
-    close(outputPipe[1]);
-    close(inputPipe[0]);
-    ssize_t bytesWritten = write(inputPipe[1], _body.c_str(), _body.size());
-    close(inputPipe[1]);
-    if (bytesWritten == -1)
-        throw std::runtime_error("Erreur lors de l'écriture dans le pipe d'entrée");
-
-    std::string output;
-    char buffer[1024];
-    ssize_t bytesRead;
-    while ((bytesRead = read(outputPipe[0], buffer, sizeof(buffer) - 1)) > 0)
-    {
-        buffer[bytesRead] = '\0';
-        output += buffer;
-    }
-    close(outputPipe[0]);
-    int status;
-    if (waitpid(pid, &status, 0) == -1)
-        throw std::runtime_error("Erreur lors de l'attente du processus CGI");
-    if (WIFEXITED(status) && WEXITSTATUS(status) != 0)
-        throw std::runtime_error("Le script CGI a retourné une erreur");
-    return constructCGIResponse(output);
-}
-
-std::string HttpRequest::executeCGI(const std::string& scriptPath, ServerConfig& config)
-{
-    (void)config;
-    try
-    {
-        int outputPipe[2], inputPipe[2];
-        createPipes(outputPipe, inputPipe);
-
-        pid_t pid = fork();
-        if (pid == 0)
-        {
-            setupChildProcess(outputPipe, inputPipe, scriptPath);
-        }
-        else if (pid > 0)
-        {
-            close(outputPipe[1]);
-            close(inputPipe[0]);
-
-            write(inputPipe[1], _body.c_str(), _body.size());
-            close(inputPipe[1]);
-
-            std::string output;
-            char buffer[1024];
-            ssize_t bytesRead;
-            int status;
-            int elapsedTime = 0;
-
-            while (elapsedTime < 5)
-            {
-                pid_t result = waitpid(pid, &status, WNOHANG);
-                if (result == pid)
-                {
-                    while ((bytesRead = read(outputPipe[0], buffer, sizeof(buffer) - 1)) > 0)
-                    {
-                        buffer[bytesRead] = '\0';
-                        output += buffer;
-                    }
-                    close(outputPipe[0]);
-                    
-                    return constructCGIResponse(output);
-                }
-                else if (result == 0)
-                {
-                    usleep(500000);
-                    elapsedTime++;
-                }
-                else
-                    throw std::runtime_error("Erreur lors de l'attente du processus CGI");
-            }
-            kill(pid, SIGKILL);
-            waitpid(pid, NULL, 0);
-            close(outputPipe[0]);
-            return findErrorPage(config,504);
-        }
-        else
-            throw std::runtime_error("Fork failed");
-    }
-    catch (const std::exception& e)
-    {
-        std::cerr << "Erreur CGI : " << e.what() << std::endl;
-        return generateDefaultErrorPage(500);
-    }
-    return generateDefaultErrorPage(500);
+    _cgiScript = scriptPath;
+    return "";
 }
 
 std::string HttpRequest::handlePost(ServerConfig& config)
 {
-    std::string response;
-
     const std::vector<ServerLocation>& locations = config.getLocations();
     for (std::vector<ServerLocation>::const_iterator it = locations.begin(); it != locations.end(); ++it) {
         if ("/post" == it->getPath() && _path != "/cgi-bin/auth.py")
@@ -250,58 +429,33 @@ std::string HttpRequest::handlePost(ServerConfig& config)
             break;
         }
     }
-    std::map<std::string, std::string>::const_iterator it = this->_headers.find("Content-Length");
-    if (it == this->_headers.end())
+    const Header* length = _known[CONTENT_LENGTH];
+    if (!length)
         return findErrorPage(config, 411);
 
-    int contentLength;
-    std::istringstream lengthStream(it->second);
-    lengthStream >> contentLength;
+    int contentLength = std::atoi(length->value);
 
     if (contentLength == 0)
         return findErrorPage(config, 400);
     if (this->_body.size() != static_cast<std::string::size_type>(contentLength))
         return findErrorPage(config, 400);
-    std::map<std::string, std::string>::const_iterator contentTypeHeader = _headers.find("Content-Type");
-    if (contentTypeHeader == _headers.end())
+    const Header* contentTypeHeader = _known[CONTENT_TYPE];
+    if (!contentTypeHeader)
         return findErrorPage(config, 400);
 
-    std::string contentType = contentTypeHeader->second;
+    std::string contentType(contentTypeHeader->value, contentTypeHeader->valueLength);
     if (contentType.find("application/json") != std::string::npos)
-        return (uploadTxt(config, response));
+        return uploadTxt(config);
     else if (contentType.find("multipart/form-data") != std::string::npos)
-        return (uploadFile(config, response, contentType));
+        return uploadFile(config, contentType);
     else if (contentType.find("application/x-www-form-urlencoded") != std::string::npos)
     {
         std::string scriptPath = _path;
         scriptPath = config.getRoot() + scriptPath.substr(1);
-        return executeCGI(scriptPath, config);
+        return prepareCGI(scriptPath);
     }
     else if (contentType.find("plain/text") != std::string::npos)
-    {
-        if (!ensureUploadDirectoryExists())
-            return findErrorPage(config, 500);
-
-        std::ostringstream fileNameStream;
-        fileNameStream << "plain_text.txt";
-        std::string fileName = fileNameStream.str();
-
-        std::string targetRoot = resolveFilePath(config);
-        std::string targetPath = targetRoot + "/" + fileName;
-
-        std::ofstream outFile(targetPath.c_str(), std::ios::binary);
-        if (!outFile.is_open())
-            return findErrorPage(config, 500);
-
-        outFile.write(this->_body.c_str(), this->_body.size());
-        outFile.close();
-
-        response = "HTTP/1.1 201 Created\r\n";
-        response += "Content-Length: 0\r\n";
-        response += "Content-Type: text/plain\r\n";
-        response += "\r\n";
-        return response;
-    }
+        return storeUpload(config, "plain_text.txt", _body.data(), _body.size());
     return findErrorPage(config, 415);
 }
 
@@ -318,19 +472,21 @@ std::string HttpRequest::handleDelete(ServerConfig& config)
     }
     std::string resourcePath = "var/www/upload" + _path;
 
-    struct stat fileStat;
-    if (stat(resourcePath.c_str(), &fileStat) != 0)
+    OpenFileCache::Info fileStat;
+    if (!OpenFileCache::stat(resourcePath, fileStat))
         return findErrorPage(config, 404);
 
-    if (access(resourcePath.c_str(), W_OK) != 0)
+    if (!fileStat.writable)
         return findErrorPage(config, 403);
 
-    std::map<std::string, std::string>::const_iterator methodIt = _headers.find("Allow");
-    if (methodIt != _headers.end() && methodIt->second.find("DELETE") == std::string::npos)
+    const Header* allow = findHeader("Allow");
+    if (allow && !std::strstr(allow->value, "DELETE"))
         return findErrorPage(config, 405);
     if (unlink(resourcePath.c_str()) != 0)
         return findErrorPage(config, 500);
+    OpenFileCache::invalidate(resourcePath);
     std::string response = "HTTP/1.1 204 Created\r\n";
+        response += HttpFormat::commonHeaders();
         response += "Content-Length: 0\r\n";
         response += "Content-Type: text/plain\r\n";
         response += "\r\n";
@@ -346,33 +502,30 @@ std::string HttpRequest::findErrorPage(ServerConfig& config, int errorCode)
         return generateDefaultErrorPage(errorCode);
     }
     std::string fullPath =  errorPagePath;
-    struct stat fileStat;
-    if (stat(fullPath.c_str(), &fileStat) != 0 || access(fullPath.c_str(), R_OK) != 0)
+    OpenFileCache::Info fileStat;
+    if (!OpenFileCache::stat(fullPath, fileStat) || !fileStat.readable)
     {
         std::cerr << "Erreur : La page d'erreur " << fullPath << " est introuvable ou inaccessible" << std::endl;
         return generateDefaultErrorPage(errorCode);
     }
-    std::ifstream errorFile(fullPath.c_str());
-    if (!errorFile.is_open())
+    std::string content;
+    if (!OpenFileCache::read(fullPath, content))
     {
         std::cerr << "Erreur : Impossible d'ouvrir la page d'erreur " << fullPath << std::endl;
         return generateDefaultErrorPage(errorCode);
     }
 
-    std::string content;
-    std::string line;
-    while (std::getline(errorFile, line))
-        content += line + "\n";
-    errorFile.close();
-
-    std::ostringstream response;
-    response << "HTTP/1.1 " << errorCode << " Error\r\n";
-    response << "Content-Type: text/html\r\n";
-    response << "Content-Length: " << content.size() << "\r\n";
-    response << "\r\n";
-    response << content;
-
-    return response.str();
+    std::string response;
+    response.reserve(kHeadReserve + content.size());
+    response += "HTTP/1.1 ";
+    HttpFormat::appendUnsigned(response, errorCode);
+    response += " Error\r\n";
+    response += HttpFormat::commonHeaders();
+    response += "Content-Type: text/html\r\nContent-Length: ";
+    HttpFormat::appendUnsigned(response, content.size());
+    response += "\r\n\r\n";
+    response += content;
+    return response;
 }
 
 std::string HttpRequest::getHttpVersion(void)
@@ -380,6 +533,11 @@ std::string HttpRequest::getHttpVersion(void)
     return _httpVersion;
 }
 
+bool HttpRequest::isMalformed() const
+{
+    return _malformed;
+}
+
 std::string HttpRequest::getMethod() const
 {
     return _method;
@@ -390,6 +548,17 @@ std::string HttpRequest::getPath() const
     return _path;
 }
 
+const std::string& HttpRequest::getBody() const
+{
+    return _body;
+}
+
+const std::string& HttpRequest::getCGIScript() const
+{
+    return _cgiScript;
+}
+
 HttpRequest::~HttpRequest()
 {
+    _arena.rewind(_mark);
 }
\ No newline at end of file
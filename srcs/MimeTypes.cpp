@@ -0,0 +1,117 @@
+#include "MimeTypes.hpp"
+#include <cstring>
+
+namespace
+{
+    struct MimeEntry
+    {
+        const char* extension;
+        const char* type;
+    };
+
+    // Must stay sorted by extension (lowercase, without the dot).
+    const MimeEntry kMimeTable[] = {
+        { "css",   "text/css" },
+        { "csv",   "text/csv" },
+        { "gif",   "image/gif" },
+        { "gz",    "application/gzip" },
+        { "htm",   "text/html" },
+        { "html",  "text/html" },
+        { "ico",   "image/x-icon" },
+        { "jpeg",  "image/jpeg" },
+        { "jpg",   "image/jpeg" },
+        { "js",    "application/javascript" },
+        { "json",  "application/json" },
+        { "mjs",   "application/javascript" },
+        { "mp3",   "audio/mpeg" },
+        { "mp4",   "video/mp4" },
+        { "pdf",   "application/pdf" },
+        { "php",   "text/html" },
+        { "png",   "image/png" },
+        { "py",    "text/html" },
+        { "svg",   "image/svg+xml" },
+        { "txt",   "text/plain" },
+        { "wasm",  "application/wasm" },
+        { "webm",  "video/webm" },
+        { "webp",  "image/webp" },
+        { "woff",  "font/woff" },
+        { "woff2", "font/woff2" },
+        { "xml",   "application/xml" },
+        { "zip",   "application/zip" }
+    };
+
+    const size_t kMimeTableSize = sizeof(kMimeTable) / sizeof(kMimeTable[0]);
+
+    inline unsigned char lowerAscii(unsigned char c)
+    {
+        return (c >= 'A' && c <= 'Z') ? static_cast<unsigned char>(c + ('a' - 'A')) : c;
+    }
+}
+
+int MimeTypes::compareExtension(const char* a, size_t aLength, const char* b, size_t bLength)
+{
+    size_t n = aLength < bLength ? aLength : bLength;
+    for (size_t i = 0; i < n; ++i)
+    {
+        unsigned char ca = lowerAscii(static_cast<unsigned char>(a[i]));
+        unsigned char cb = lowerAscii(static_cast<unsigned char>(b[i]));
+        if (ca != cb)
+            return ca < cb ? -1 : 1;
+    }
+    if (aLength == bLength)
+        return 0;
+    return aLength < bLength ? -1 : 1;
+}
+
+bool MimeTypes::extensionOf(const char* path, size_t length, const char*& extension, size_t& extLength)
+{
+    for (size_t i = length; i > 0; --i)
+    {
+        char c = path[i - 1];
+        if (c == '/')
+            return false;
+        if (c == '.')
+        {
+            extension = path + i;
+            extLength = length - i;
+            return extLength > 0;
+        }
+    }
+    return false;
+}
+
+const char* MimeTypes::lookup(const char* extension, size_t length)
+{
+    size_t low = 0;
+    size_t high = kMimeTableSize;
+
+    while (low < high)
+    {
+        size_t mid = low + (high - low) / 2;
+        const char* candidate = kMimeTable[mid].extension;
+        int cmp = compareExtension(extension, length, candidate, std::strlen(candidate));
+        if (cmp == 0)
+            return kMimeTable[mid].type;
+        if (cmp < 0)
+            high = mid;
+        else
+            low = mid + 1;
+    }
+    return NULL;
+}
+
+const char* MimeTypes::fromPath(const char* path, size_t length)
+{
+    const char* extension;
+    size_t extLength;
+
+    if (!extensionOf(path, length, extension, extLength))
+        return defaultType();
+    const char* type = lookup(extension, extLength);
+    return type ? type : defaultType();
+}
+
+const char* MimeTypes::defaultType()
+{
+    return "application/octet-stream";
+}
@@ -0,0 +1,249 @@
+#include "OpenFileCache.hpp"
+#include "TimerWheel.hpp"
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace
+{
+    size_t maxEntries = 0;
+    unsigned long inactive = 60000;
+    unsigned long valid = 60000;
+
+    OpenFileCache::Counters cacheCounters = { 0, 0, 0, 0 };
+}
+
+std::map<std::string, OpenFileCache::Entry> OpenFileCache::_entries;
+std::list<std::string> OpenFileCache::_lru;
+
+void OpenFileCache::configure(size_t max, unsigned long inactiveMs, unsigned long validMs)
+{
+    clear();
+    maxEntries = max;
+    inactive = inactiveMs;
+    valid = validMs;
+}
+
+const OpenFileCache::Counters& OpenFileCache::counters()
+{
+    return cacheCounters;
+}
+
+// Regular files are opened once and kept; the descriptor is close-on-exec
+// so CGI children do not inherit it.
+void OpenFileCache::fill(const std::string& path, Entry& entry, bool keepOpen)
+{
+    struct stat st;
+    entry.fd = -1;
+    entry.device = 0;
+    entry.inode = 0;
+    if (::stat(path.c_str(), &st) != 0)
+    {
+        entry.info.error = errno;
+        entry.info.mode = 0;
+        entry.info.size = 0;
+        entry.info.mtime = 0;
+        entry.info.readable = false;
+        entry.info.writable = false;
+        return;
+    }
+    entry.info.error = 0;
+    entry.info.mode = st.st_mode;
+    entry.info.size = st.st_size;
+    entry.info.mtime = st.st_mtime;
+    entry.device = st.st_dev;
+    entry.inode = st.st_ino;
+    if (keepOpen && S_ISREG(st.st_mode))
+    {
+        entry.fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        entry.info.readable = entry.fd >= 0;
+    }
+    else
+        entry.info.readable = access(path.c_str(), R_OK) == 0;
+    entry.info.writable = access(path.c_str(), W_OK) == 0;
+}
+
+// Entries are keyed by the path with empty and "." segments dropped, so
+// "var/www/upload/a" and "var/www//upload/./a" share one entry and an
+// invalidation reaches it whichever way the caller spelled the path. A
+// trailing '/' still counts, and ".." is kept: folding "link/.." would
+// merge paths the kernel resolves differently. The key is only a key;
+// stat() and open() always get the path as the caller passed it.
+std::string OpenFileCache::normalize(const std::string& path)
+{
+    bool absolute = !path.empty() && path[0] == '/';
+    bool directory = false;
+    std::string key;
+    key.reserve(path.size());
+    for (size_t pos = 0; pos < path.size(); )
+    {
+        size_t end = path.find('/', pos);
+        if (end == std::string::npos)
+            end = path.size();
+        size_t length = end - pos;
+        directory = length == 0 || (length == 1 && path[pos] == '.');
+        if (!directory)
+        {
+            if (absolute || !key.empty())
+                key += '/';
+            key.append(path, pos, length);
+        }
+        pos = end + 1;
+    }
+    if (key.empty())
+        return absolute ? "/" : ".";
+    if (directory || path[path.size() - 1] == '/')
+        key += '/';
+    return key;
+}
+
+void OpenFileCache::release(Entry& entry)
+{
+    if (entry.fd >= 0)
+        close(entry.fd);
+    entry.fd = -1;
+}
+
+void OpenFileCache::erase(std::map<std::string, Entry>::iterator it)
+{
+    release(it->second);
+    _lru.erase(it->second.lru);
+    _entries.erase(it);
+}
+
+void OpenFileCache::evictInactive(unsigned long now)
+{
+    while (!_lru.empty())
+    {
+        std::map<std::string, Entry>::iterator oldest = _entries.find(_lru.back());
+        if (now - oldest->second.used < inactive)
+            break;
+        erase(oldest);
+        ++cacheCounters.evicted;
+    }
+}
+
+// A revalidation is a single stat(): if the path still names the same
+// file, unchanged, the entry (and its descriptor) is kept.
+OpenFileCache::Entry* OpenFileCache::lookup(const std::string& requested)
+{
+    if (maxEntries == 0)
+        return NULL;
+    std::string key = normalize(requested);
+    unsigned long now = TimerWheel::nowMs();
+    evictInactive(now);
+
+    std::map<std::string, Entry>::iterator it = _entries.find(key);
+    if (it != _entries.end())
+    {
+        ++cacheCounters.hits;
+        Entry& entry = it->second;
+        if (now - entry.validated >= valid)
+        {
+            struct stat st;
+            int error = ::stat(requested.c_str(), &st) == 0 ? 0 : errno;
+            if (error != entry.info.error || (error == 0 && (st.st_dev != entry.device || st.st_ino != entry.inode
+                || st.st_mtime != entry.info.mtime || st.st_size != entry.info.size || st.st_mode != entry.info.mode)))
+            {
+                release(entry);
+                fill(requested, entry, true);
+                ++cacheCounters.revalidated;
+            }
+            entry.validated = now;
+        }
+        entry.used = now;
+        _lru.splice(_lru.begin(), _lru, entry.lru);
+        return &entry;
+    }
+
+    ++cacheCounters.misses;
+    if (_entries.size() >= maxEntries)
+    {
+        erase(_entries.find(_lru.back()));
+        ++cacheCounters.evicted;
+    }
+    _lru.push_front(key);
+    Entry& entry = _entries[key];
+    fill(requested, entry, true);
+    entry.validated = now;
+    entry.used = now;
+    entry.lru = _lru.begin();
+    return &entry;
+}
+
+bool OpenFileCache::stat(const std::string& path, Info& info)
+{
+    Entry* entry = lookup(path);
+    if (entry)
+        info = entry->info;
+    else
+    {
+        Entry uncached;
+        fill(path, uncached, false);
+        info = uncached.info;
+    }
+    return info.error == 0;
+}
+
+// Asks for one byte more than expected, so a file that grew or shrank
+// since it was stat'ed is noticed without another system call.
+bool OpenFileCache::readAll(int fd, size_t size, std::string& content)
+{
+    content.resize(size + 1);
+    size_t offset = 0;
+    while (offset < content.size())
+    {
+        ssize_t n = pread(fd, &content[offset], content.size() - offset, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        offset += n;
+    }
+    content.resize(offset);
+    return offset == size;
+}
+
+// Reads with pread() on the cached descriptor, so the file is neither
+// opened nor stat'ed again while the entry is valid. A size mismatch means
+// the file was rewritten in place: the entry is refreshed and read again.
+bool OpenFileCache::read(const std::string& path, std::string& content)
+{
+    Entry* entry = lookup(path);
+    if (entry)
+    {
+        if (entry->fd < 0)
+            return false;
+        if (readAll(entry->fd, entry->info.size, content))
+            return true;
+        release(*entry);
+        fill(path, *entry, true);
+        entry->validated = TimerWheel::nowMs();
+        ++cacheCounters.revalidated;
+        return entry->fd >= 0 && readAll(entry->fd, entry->info.size, content);
+    }
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && readAll(fd, st.st_size, content);
+    close(fd);
+    return ok;
+}
+
+void OpenFileCache::invalidate(const std::string& path)
+{
+    std::map<std::string, Entry>::iterator it = _entries.find(normalize(path));
+    if (it != _entries.end())
+        erase(it);
+}
+
+void OpenFileCache::clear()
+{
+    for (std::map<std::string, Entry>::iterator it = _entries.begin(); it != _entries.end(); ++it)
+        release(it->second);
+    _entries.clear();
+    _lru.clear();
+}
@@ -0,0 +1,512 @@
+#include "ResponseCache.hpp"
+#include "HttpRequest.hpp"
+#include <algorithm>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+static std::string toLower(std::string value)
+{
+    std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+    return value;
+}
+
+static std::string trim(const std::string& value)
+{
+    size_t start = value.find_first_not_of(" \t");
+    if (start == std::string::npos)
+        return "";
+    return value.substr(start, value.find_last_not_of(" \t\r") - start + 1);
+}
+
+// Hop-by-hop and framing headers are not stored; Content-Length is
+// recomputed and Age added when an entry is served.
+static bool isDroppedHeader(const std::string& name)
+{
+    static const char* const dropped[] = {"connection", "keep-alive", "proxy-connection", "te", "upgrade",
+        "transfer-encoding", "content-length", "age", NULL};
+    for (size_t i = 0; dropped[i]; ++i)
+    {
+        if (strcasecmp(name.c_str(), dropped[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+static std::time_t parseHttpDate(const std::string& value)
+{
+    struct tm parsed;
+    std::memset(&parsed, 0, sizeof(parsed));
+    if (!strptime(value.c_str(), "%a, %d %b %Y %H:%M:%S", &parsed))
+        return static_cast<std::time_t>(-1);
+    return timegm(&parsed);
+}
+
+ResponseCache::ResponseCache() : _memoryLimit(0), _memoryUsed(0), _diskLimit(0), _diskUsed(0), _fileSequence(0)
+{
+}
+
+ResponseCache::~ResponseCache()
+{
+    clear();
+}
+
+// Returns false when cache_path cannot be used; the memory tier still works.
+bool ResponseCache::configure(size_t memoryLimit, const std::string& diskPath, size_t diskLimit)
+{
+    bool usable = true;
+
+    if (diskPath != _diskPath)
+    {
+        while (!_disk.empty())
+            removeDisk(_disk.begin());
+        _diskPath = diskPath;
+        if (!_diskPath.empty())
+        {
+            if ((mkdir(_diskPath.c_str(), 0700) != 0 && errno != EEXIST) || access(_diskPath.c_str(), W_OK | X_OK) != 0)
+            {
+                _diskPath.clear();
+                usable = false;
+            }
+            else
+                removeStaleFiles();
+        }
+    }
+    _memoryLimit = memoryLimit;
+    _diskLimit = _diskPath.empty() ? 0 : diskLimit;
+    evictMemory(0);
+    evictDisk(0);
+    if (!isEnabled())
+        clear();
+    return usable;
+}
+
+bool ResponseCache::isEnabled() const
+{
+    return _memoryLimit > 0 || !_diskPath.empty();
+}
+
+size_t ResponseCache::maxObjectSize() const
+{
+    return std::max(maxMemoryObject(), _diskLimit);
+}
+
+bool ResponseCache::isCacheableRequest(const HttpRequest& request)
+{
+    if (request.getMethod() != "GET" || !request.getHeaderValue("Authorization").empty())
+        return false;
+    return toLower(request.getHeaderValue("Cache-Control")).find("no-store") == std::string::npos;
+}
+
+std::string ResponseCache::primaryKey(const HttpRequest& request, const std::string& scope)
+{
+    return request.getMethod() + " " + scope + " " + toLower(request.getHeaderValue("Host")) + " " + request.getPath();
+}
+
+std::string ResponseCache::variantKey(const std::string& primary, const std::vector<std::string>& names, const HttpRequest& request)
+{
+    std::string key = primary;
+    for (size_t i = 0; i < names.size(); ++i)
+        key += "\n" + names[i] + ": " + request.getHeaderValue(names[i]);
+    return key;
+}
+
+// A variant key is its primary key, then one line per Vary header.
+void ResponseCache::countVariant(const std::string& key, bool added)
+{
+    std::string primary = key.substr(0, key.find('\n'));
+    if (added)
+    {
+        ++_vary[primary].entries;
+        return;
+    }
+    std::map<std::string, Variants>::iterator it = _vary.find(primary);
+    if (it != _vary.end() && --it->second.entries == 0)
+        _vary.erase(it);
+}
+
+// All values of a header, joined with ", ". head is a status line
+// followed by header lines, as received or produced.
+std::string ResponseCache::headerValue(const std::string& head, const std::string& name)
+{
+    std::string value;
+    size_t start = head.find('\n');
+
+    while (start != std::string::npos && start + 1 < head.size())
+    {
+        ++start;
+        size_t end = head.find('\n', start);
+        std::string line = head.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        size_t colon = line.find(':');
+        if (colon == name.size() && strncasecmp(line.c_str(), name.c_str(), colon) == 0)
+        {
+            if (!value.empty())
+                value += ", ";
+            value += trim(line.substr(colon + 1));
+        }
+        start = end;
+    }
+    return value;
+}
+
+// Seconds the response may be served from cache, or -1 when it must not
+// be stored at all.
+long ResponseCache::freshnessLifetime(const std::string& head, std::time_t now)
+{
+    static const int cacheableStatus[] = {200, 203, 300, 301, 404, 410, 0};
+    size_t space = head.find(' ');
+    int status = space == std::string::npos ? 0 : std::atoi(head.c_str() + space + 1);
+    size_t i = 0;
+
+    while (cacheableStatus[i] && cacheableStatus[i] != status)
+        ++i;
+    if (!cacheableStatus[i] || !headerValue(head, "Set-Cookie").empty())
+        return -1;
+
+    std::string control = toLower(headerValue(head, "Cache-Control"));
+    if (control.find("no-store") != std::string::npos || control.find("no-cache") != std::string::npos
+        || control.find("private") != std::string::npos)
+        return -1;
+    size_t maxAge = control.find("s-maxage=");
+    if (maxAge == std::string::npos)
+        maxAge = control.find("max-age=");
+    if (maxAge != std::string::npos)
+        return std::atol(control.c_str() + control.find('=', maxAge) + 1);
+
+    std::string expires = headerValue(head, "Expires");
+    if (expires.empty())
+        return -1;
+    std::time_t expiresAt = parseHttpDate(expires);
+    if (expiresAt == static_cast<std::time_t>(-1))
+        return -1;
+    std::time_t date = parseHttpDate(headerValue(head, "Date"));
+    if (date == static_cast<std::time_t>(-1))
+        date = now;
+    return static_cast<long>(expiresAt - date);
+}
+
+bool ResponseCache::lookup(const HttpRequest& request, const std::string& scope, std::string& response)
+{
+    if (!isEnabled() || !isCacheableRequest(request))
+        return false;
+    if (toLower(request.getHeaderValue("Cache-Control")).find("no-cache") != std::string::npos)
+        return false;
+
+    std::string primary = primaryKey(request, scope);
+    std::map<std::string, Variants>::iterator vary = _vary.find(primary);
+    if (vary == _vary.end())
+        return false;
+    std::string key = variantKey(primary, vary->second.names, request);
+    std::time_t now = std::time(NULL);
+
+    std::map<std::string, Entry>::iterator hot = _memory.find(key);
+    if (hot != _memory.end())
+    {
+        if (hot->second.expires <= now)
+        {
+            removeMemory(hot);
+            return false;
+        }
+        _memoryLru.splice(_memoryLru.begin(), _memoryLru, hot->second.lru);
+        response = render(hot->second, now);
+        return true;
+    }
+
+    std::map<std::string, DiskEntry>::iterator cold = _disk.find(key);
+    if (cold == _disk.end())
+        return false;
+    Entry entry;
+    if (cold->second.expires <= now || !readDisk(cold, entry))
+    {
+        removeDisk(cold);
+        return false;
+    }
+    response = render(entry, now);
+    if (sizeOf(key, entry) <= maxMemoryObject())
+    {
+        // Moving the only entry would drop the Vary names in between.
+        std::vector<std::string> names;
+        names.swap(vary->second.names);
+        removeDisk(cold);
+        insertMemory(key, entry);
+        _vary[primary].names.swap(names);
+    }
+    else
+        _diskLru.splice(_diskLru.begin(), _diskLru, cold->second.lru);
+    return true;
+}
+
+bool ResponseCache::store(const HttpRequest& request, const std::string& scope, const std::string& head, const std::string& body)
+{
+    if (!isEnabled() || !isCacheableRequest(request))
+        return false;
+
+    std::time_t now = std::time(NULL);
+    long lifetime = freshnessLifetime(head, now);
+    if (lifetime <= 0)
+        return false;
+
+    std::vector<std::string> varyNames;
+    std::istringstream vary(headerValue(head, "Vary"));
+    std::string name;
+    while (std::getline(vary, name, ','))
+    {
+        name = trim(name);
+        if (name == "*")
+            return false;
+        if (!name.empty())
+            varyNames.push_back(name);
+    }
+    std::string primary = primaryKey(request, scope);
+    std::string key = variantKey(primary, varyNames, request);
+
+    Entry entry;
+    entry.stored = now;
+    entry.expires = now + lifetime;
+    std::istringstream lines(head);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        if (line.empty())
+            break;
+        if (!entry.head.empty() && isDroppedHeader(line.substr(0, line.find(':'))))
+            continue;
+        entry.head += line + "\r\n";
+    }
+    std::ostringstream length;
+    length << body.size();
+    entry.head += "Content-Length: " + length.str() + "\r\n";
+    entry.body = body;
+
+    std::map<std::string, Entry>::iterator hot = _memory.find(key);
+    if (hot != _memory.end())
+        removeMemory(hot);
+    std::map<std::string, DiskEntry>::iterator cold = _disk.find(key);
+    if (cold != _disk.end())
+        removeDisk(cold);
+
+    if (sizeOf(key, entry) <= maxMemoryObject())
+        insertMemory(key, entry);
+    else if (!writeDisk(key, entry))
+        return false;
+    _vary[primary].names.swap(varyNames);
+    return true;
+}
+
+void ResponseCache::clear()
+{
+    while (!_disk.empty())
+        removeDisk(_disk.begin());
+    _memory.clear();
+    _memoryLru.clear();
+    _memoryUsed = 0;
+    _vary.clear();
+}
+
+size_t ResponseCache::maxMemoryObject() const
+{
+    return _memoryLimit / 4;
+}
+
+void ResponseCache::insertMemory(const std::string& key, const Entry& entry)
+{
+    size_t size = sizeOf(key, entry);
+    evictMemory(size);
+    _memoryLru.push_front(key);
+    Entry& stored = _memory[key];
+    stored = entry;
+    stored.lru = _memoryLru.begin();
+    _memoryUsed += size;
+    countVariant(key, true);
+}
+
+// Least recently used entries that are still fresh move to the disk tier.
+void ResponseCache::evictMemory(size_t needed)
+{
+    std::time_t now = std::time(NULL);
+    while (!_memoryLru.empty() && _memoryUsed + needed > _memoryLimit)
+    {
+        std::map<std::string, Entry>::iterator victim = _memory.find(_memoryLru.back());
+        if (!_diskPath.empty() && victim->second.expires > now)
+            writeDisk(victim->first, victim->second);
+        removeMemory(victim);
+    }
+}
+
+void ResponseCache::removeMemory(std::map<std::string, Entry>::iterator it)
+{
+    _memoryUsed -= sizeOf(it->first, it->second);
+    _memoryLru.erase(it->second.lru);
+    countVariant(it->first, false);
+    _memory.erase(it);
+}
+
+// File layout: "<stored> <expires> <key length> <head length>\n" followed
+// by the key, the stored head and the body. Files are written under a
+// temporary name and renamed so a reader never sees a partial entry.
+bool ResponseCache::writeDisk(const std::string& key, const Entry& entry)
+{
+    size_t size = sizeOf(key, entry);
+    if (_diskPath.empty() || size > _diskLimit)
+        return false;
+    evictDisk(size);
+
+    std::ostringstream header;
+    header << entry.stored << " " << entry.expires << " " << key.size() << " " << entry.head.size() << "\n";
+    std::string prefix = header.str() + key + entry.head;
+    std::string file = nextFile();
+    std::string temp = file + ".tmp";
+
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return false;
+    const std::string* parts[2] = {&prefix, &entry.body};
+    bool written = true;
+    for (int i = 0; i < 2 && written; ++i)
+    {
+        size_t offset = 0;
+        while (offset < parts[i]->size())
+        {
+            ssize_t n = write(fd, parts[i]->data() + offset, parts[i]->size() - offset);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                written = false;
+                break;
+            }
+            offset += n;
+        }
+    }
+    if (close(fd) != 0 || !written || rename(temp.c_str(), file.c_str()) != 0)
+    {
+        unlink(temp.c_str());
+        return false;
+    }
+
+    _diskLru.push_front(key);
+    DiskEntry& stored = _disk[key];
+    stored.file = file;
+    stored.size = prefix.size() + entry.body.size();
+    stored.expires = entry.expires;
+    stored.lru = _diskLru.begin();
+    _diskUsed += stored.size;
+    countVariant(key, true);
+    return true;
+}
+
+// The entry has to end up in std::strings for render() anyway, so the
+// file is read straight into one and the body is moved down in place.
+bool ResponseCache::readDisk(std::map<std::string, DiskEntry>::iterator it, Entry& entry)
+{
+    int fd = open(it->second.file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+    std::string data(static_cast<size_t>(info.st_size), '\0');
+    size_t size = 0;
+    while (size < data.size())
+    {
+        ssize_t n = read(fd, &data[size], data.size() - size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        size += n;
+    }
+    close(fd);
+    if (size != data.size())
+        return false;
+
+    size_t newline = data.find('\n');
+    if (newline == std::string::npos)
+        return false;
+    std::istringstream header(data.substr(0, newline));
+    long stored = 0;
+    long expires = 0;
+    size_t keyLength = 0;
+    size_t headLength = 0;
+    size_t offset = newline + 1;
+    if (!(header >> stored >> expires >> keyLength >> headLength)
+        || offset + keyLength + headLength > size
+        || data.compare(offset, keyLength, it->first) != 0)
+        return false;
+    entry.stored = stored;
+    entry.expires = expires;
+    entry.head.assign(data, offset + keyLength, headLength);
+    data.erase(0, offset + keyLength + headLength);
+    entry.body.swap(data);
+    return true;
+}
+
+void ResponseCache::evictDisk(size_t needed)
+{
+    while (!_diskLru.empty() && _diskUsed + needed > _diskLimit)
+        removeDisk(_disk.find(_diskLru.back()));
+}
+
+void ResponseCache::removeDisk(std::map<std::string, DiskEntry>::iterator it)
+{
+    unlink(it->second.file.c_str());
+    _diskUsed -= it->second.size;
+    _diskLru.erase(it->second.lru);
+    countVariant(it->first, false);
+    _disk.erase(it);
+}
+
+// Entry files are prefixed with the pid that wrote them. Files left by a
+// process that is gone are removed; a live one (the old binary during an
+// upgrade) keeps its own.
+void ResponseCache::removeStaleFiles() const
+{
+    DIR* directory = opendir(_diskPath.c_str());
+    if (!directory)
+        return;
+    struct dirent* item;
+    while ((item = readdir(directory)) != NULL)
+    {
+        std::string name = item->d_name;
+        if (name.find(".cache") == std::string::npos)
+            continue;
+        pid_t owner = static_cast<pid_t>(std::atol(name.c_str()));
+        if (owner > 0 && owner != getpid() && kill(owner, 0) == 0)
+            continue;
+        unlink((_diskPath + "/" + name).c_str());
+    }
+    closedir(directory);
+}
+
+// Every entry gets its own file name, so two keys can never share (and
+// overwrite) a file; readDisk still checks the stored key on a hit.
+std::string ResponseCache::nextFile()
+{
+    std::ostringstream name;
+    name << _diskPath << "/" << getpid() << "-" << std::hex << ++_fileSequence << ".cache";
+    return name.str();
+}
+
+std::string ResponseCache::render(const Entry& entry, std::time_t now)
+{
+    std::ostringstream age;
+    age << (now > entry.stored ? now - entry.stored : 0);
+    return entry.head + "Age: " + age.str() + "\r\n\r\n" + entry.body;
+}
+
+size_t ResponseCache::sizeOf(const std::string& key, const Entry& entry)
+{
+    return key.size() + entry.head.size() + entry.body.size();
+}
@@ -13,95 +13,257 @@
 #include "Server.hpp"
 #include "HttpRequest.hpp"
 #include "ServerConfig.hpp"
+#include <netdb.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <strings.h>
 
 volatile sig_atomic_t Server::signal_received = 0;
+volatile sig_atomic_t Server::reload_requested = 0;
+volatile sig_atomic_t Server::drain_requested = 0;
+volatile sig_atomic_t Server::upgrade_requested = 0;
+volatile sig_atomic_t Server::child_exited = 0;
+int Server::signal_pipe[2] = { -1, -1 };
+const char* const Server::LISTEN_FDS_ENV = "WEBSERV_LISTEN_FDS";
+const char* const Server::PARENT_PID_ENV = "WEBSERV_PARENT_PID";
+const char* const Server::SERVICE_UNAVAILABLE_RESPONSE =
+    "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nRetry-After: 1\r\nConnection: close\r\n\r\n";
+const char* const Server::REQUEST_TIMEOUT_RESPONSE =
+    "HTTP/1.1 408 Request Timeout\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+const char* const Server::TOO_MANY_REQUESTS_RESPONSE =
+    "HTTP/1.1 429 Too Many Requests\r\nContent-Length: 0\r\nRetry-After: 1\r\nConnection: close\r\n\r\n";
 
-int Server::createSocket()
+namespace
 {
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+    // Key of a listener in _listeners, which also names it in the logs and
+    // in the environment handed over on binary upgrade.
+    std::pair<std::string, int> listenerKey(const ListenOptions& options)
+    {
+        if (options.isUnix())
+            return std::make_pair(options.address(), 0);
+        if (options.host.find(':') != std::string::npos)
+            return std::make_pair("[" + options.host + "]", options.port);
+        return std::make_pair(options.host, options.port);
+    }
+
+    // Framing headers are dropped when a chunked body is decoded.
+    bool isFramingHeader(const char* line, size_t length)
+    {
+        static const char* const names[] = { "Transfer-Encoding", "Content-Length" };
+        for (size_t i = 0; i < 2; ++i)
+        {
+            size_t nameLength = std::strlen(names[i]);
+            if (length > nameLength && line[nameLength] == ':' && strncasecmp(line, names[i], nameLength) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    std::string listenerName(const std::pair<std::string, int>& key)
+    {
+        std::ostringstream oss;
+        oss << key.first;
+        if (key.second)
+            oss << ":" << key.second;
+        return oss.str();
+    }
+}
+
+int Server::createSocket(int family)
+{
+    int server_fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 
     if (server_fd < 0)
         throw std::runtime_error(logMessageError("ERROR", "Failed to create socket."));
     return server_fd;
 }
 
+// Host names are resolved once, here; the first address returned is the
+// one bound. A stale Unix-domain socket left by a previous run is removed.
+int Server::bindSocket(const ListenOptions& options)
+{
+    sockaddr_storage address;
+    socklen_t length;
+    std::memset(&address, 0, sizeof(address));
+    if (options.isUnix())
+    {
+        sockaddr_un* local = reinterpret_cast<sockaddr_un*>(&address);
+        local->sun_family = AF_UNIX;
+        std::strncpy(local->sun_path, options.path.c_str(), sizeof(local->sun_path) - 1);
+        length = sizeof(sockaddr_un);
+        struct stat info;
+        if (lstat(options.path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode))
+            unlink(options.path.c_str());
+    }
+    else
+    {
+        addrinfo hints;
+        addrinfo* result = NULL;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+        int status = getaddrinfo(options.host.c_str(), intToString(options.port).c_str(), &hints, &result);
+        if (status != 0 || !result)
+            throw std::runtime_error("Failed to resolve " + options.address() + ": " + gai_strerror(status));
+        std::memcpy(&address, result->ai_addr, result->ai_addrlen);
+        length = result->ai_addrlen;
+        freeaddrinfo(result);
+    }
+
+    int server_fd = createSocket(address.ss_family);
+    try {
+        configureSocket(server_fd, address.ss_family, options);
+        if (bind(server_fd, (sockaddr*)&address, length) < 0)
+            throw std::runtime_error("Failed to bind socket for " + options.address() + ": " + std::strerror(errno));
+    }
+    catch (...)
+    {
+        close(server_fd);
+        throw;
+    }
+    return server_fd;
+}
+
 void Server::initSockets()
 {
-    std::vector<std::pair<std::string, int> > boundSockets;
+    std::set<std::pair<std::string, int> > boundSockets;
+    std::map<std::pair<std::string, int>, int> previousListeners;
 
+    previousListeners.swap(_listeners);
     for (size_t i = 0; i < _configs.size(); ++i)
     {
-        const std::vector<int>& ports = _configs[i].getPorts();
-        const std::string& host = _configs[i].getHost();
+        const std::vector<ListenOptions>& listens = _configs[i].getListens();
 
-        for (size_t j = 0; j < ports.size(); ++j)
+        for (size_t j = 0; j < listens.size(); ++j)
         {
-            std::pair<std::string, int> socketKey = std::make_pair(host, ports[j]);
+            const ListenOptions& options = listens[j];
+            std::pair<std::string, int> socketKey = listenerKey(options);
 
-            if (std::find(boundSockets.begin(), boundSockets.end(), socketKey) != boundSockets.end()) {
-                logMessage("INFO", "Socket already bound for " + host + ":" + intToString(ports[j]));
+            if (!boundSockets.insert(socketKey).second)
+                continue;
+
+            std::map<std::pair<std::string, int>, int>::iterator kept = previousListeners.find(socketKey);
+            if (kept != previousListeners.end())
+            {
+                tuneSocket(kept->second, options);
+                listen(kept->second, options.backlog);
+                _listeners[socketKey] = kept->second;
+                _listenerOptions[kept->second] = options;
+                _socketToConfig[kept->second] = &_configs[i];
+                attachTlsListener(kept->second, _configs[i], options);
+                if (options.http2)
+                    _h2Listeners.insert(kept->second);
+                else
+                    _h2Listeners.erase(kept->second);
+                previousListeners.erase(kept);
                 continue;
             }
 
-            int server_fd = createSocket();
+            int server_fd = -1;
             try {
-                configureSocket(server_fd);
-
-                sockaddr_in address = {};
-                address.sin_family = AF_INET;
-                address.sin_addr.s_addr = inet_addr(host.c_str());
-                address.sin_port = htons(ports[j]);
-
-                if (bind(server_fd, (sockaddr*)&address, sizeof(address)) < 0)
-                {
-                    close(server_fd);
-                    _server_fds.erase(std::remove(_server_fds.begin(), _server_fds.end(), server_fd), _server_fds.end());
-                    throw std::runtime_error("Failed to bind socket for host: " + host + " on port " + intToString(ports[j]));
-                }
-
-                boundSockets.push_back(socketKey);
-                _addresses.push_back(address);
-                listenOnSocket(server_fd);
+                server_fd = bindSocket(options);
+                tuneSocket(server_fd, options);
+                listenOnSocket(server_fd, options.backlog);
                 _socketToConfig[server_fd] = &_configs[i];
+                _listeners[socketKey] = server_fd;
+                _listenerOptions[server_fd] = options;
+                attachTlsListener(server_fd, _configs[i], options);
+                if (options.http2)
+                    _h2Listeners.insert(server_fd);
                 addServerSocketToPoll(server_fd);
-                logMessage("INFO", "Server is listening on " + host + ":" + intToString(ports[j]));
+                logMessage("INFO", "Server is listening on " + options.address() + (_tlsListeners.count(server_fd) ? " (ssl)" : ""));
             } 
             catch (const std::exception& e)
             {
-                close(server_fd);
+                if (server_fd >= 0)
+                {
+                    _socketToConfig.erase(server_fd);
+                    _listeners.erase(socketKey);
+                    _listenerOptions.erase(server_fd);
+                    close(server_fd);
+                }
                 logMessage("ERROR", e.what());
                 continue;
             }
         }
     }
+    for (std::map<std::pair<std::string, int>, int>::iterator it = previousListeners.begin(); it != previousListeners.end(); ++it)
+    {
+        logMessage("INFO", "No longer listening on " + listenerName(it->first));
+        closeListener(it->second);
+        if (it->first.first.compare(0, 5, "unix:") == 0)
+            unlink(it->first.first.c_str() + 5);
+    }
 }
 
+void Server::closeListener(int server_fd)
+{
+    int index = findPollIndex(server_fd);
+    if (index >= 0)
+        releasePollSlot(index);
+    _server_fds.erase(std::remove(_server_fds.begin(), _server_fds.end(), server_fd), _server_fds.end());
+    _socketToConfig.erase(server_fd);
+    _listenerOptions.erase(server_fd);
+    _tlsListeners.erase(server_fd);
+    _h2Listeners.erase(server_fd);
+    close(server_fd);
+}
 
-void Server::configureSocket(int server_fd)
+// "[::]" listeners accept IPv4 clients too (as mapped addresses) once
+// ipv6only=off.
+void Server::configureSocket(int server_fd, int family, const ListenOptions& options)
 {
     int opt = 1;
-    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
-    {
-        close(server_fd);
+    if (family != AF_UNIX && setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
         throw std::runtime_error(logMessageError("ERROR", "Failed to configure socket options (SO_REUSEADDR)."));
-    }
+    opt = options.ipv6only;
+    if (family == AF_INET6 && setsockopt(server_fd, IPPROTO_IPV6, IPV6_V6ONLY, &opt, sizeof(opt)) < 0)
+        throw std::runtime_error(logMessageError("ERROR", "Failed to configure socket options (IPV6_V6ONLY)."));
 }
 
-void Server::listenOnSocket(int server_fd)
+// Run on every load, so a listener kept across a reload picks up changed
+// options. A failure only costs the optimization, not the listener.
+void Server::tuneSocket(int server_fd, const ListenOptions& options)
 {
-    if (listen(server_fd, 10) < 0)
-    {
-        close(server_fd);
+    int value = static_cast<int>(options.rcvbuf);
+    if (options.rcvbuf && setsockopt(server_fd, SOL_SOCKET, SO_RCVBUF, &value, sizeof(value)) < 0)
+        logMessage("WARNING", "Failed to set rcvbuf on " + options.address());
+    value = static_cast<int>(options.sndbuf);
+    if (options.sndbuf && setsockopt(server_fd, SOL_SOCKET, SO_SNDBUF, &value, sizeof(value)) < 0)
+        logMessage("WARNING", "Failed to set sndbuf on " + options.address());
+    if (options.isUnix())
+        return;
+
+    // Inherited by accepted sockets. Responses are written whole, so Nagle
+    // would only hold back the last segment of each one.
+    value = 1;
+    setsockopt(server_fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value));
+#ifdef TCP_DEFER_ACCEPT
+    // Wake up for a connection only once its request starts arriving,
+    // waiting at most as long as the header timeout would.
+    value = options.deferred ? std::max(1, static_cast<int>(_global.getClientHeaderTimeout() / 1000)) : 0;
+    if (setsockopt(server_fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &value, sizeof(value)) < 0 && options.deferred)
+        logMessage("WARNING", "Failed to enable deferred accept on " + options.address());
+#endif
+#ifdef TCP_FASTOPEN
+    value = options.fastopen;
+    if (options.fastopen && setsockopt(server_fd, IPPROTO_TCP, TCP_FASTOPEN, &value, sizeof(value)) < 0)
+        logMessage("WARNING", "Failed to enable fastopen on " + options.address());
+#endif
+}
+
+void Server::listenOnSocket(int server_fd, int backlog)
+{
+    if (listen(server_fd, backlog) < 0)
         throw std::runtime_error(logMessageError("ERROR", "Failed to set socket to listen."));
-    }
 }
 
 void Server::addServerSocketToPoll(int server_fd)
 {
-    struct pollfd server_poll_fd = {};
-    server_poll_fd.fd = server_fd;
-    server_poll_fd.events = POLLIN | POLLOUT;
-    _poll_fds.push_back(server_poll_fd);
+    addToPoll(server_fd, POLLIN);
     _server_fds.push_back(server_fd);
 }
 
@@ -111,38 +273,22 @@ ServerConfig* Server::getConfigForRequest(const std::string& hostHeader, int con
         return &_configs[0];
     std::string hostWithoutPort = hostHeader;
     int portFromHeader = connectedPort;
-    size_t colonPos = hostHeader.find(':');
+    size_t colonPos = hostHeader.find(':', hostHeader[0] == '[' ? hostHeader.find(']') : 0);
     if (colonPos != std::string::npos)
     {
         hostWithoutPort = hostHeader.substr(0, colonPos);
         std::istringstream ss(hostHeader.substr(colonPos + 1));
         ss >> portFromHeader;
     }
-    ServerConfig* defaultForPort = NULL;
-    for (size_t i = 0; i < _configs.size(); ++i)
-    {
-        const std::string& configHost = _configs[i].getHost();
-        const std::string& configServerName = _configs[i].getServerName();
-        const std::vector<int>& configPorts = _configs[i].getPorts();
-        if (!configServerName.empty()) {
-            if (hostWithoutPort == configServerName) {
-                if (std::find(configPorts.begin(), configPorts.end(), portFromHeader) != configPorts.end())
-                    return &_configs[i];
-            }
-        }
-        if (hostWithoutPort == configHost) {
-            if (std::find(configPorts.begin(), configPorts.end(), portFromHeader) != configPorts.end())
-                return &_configs[i];
-        }
-        if (std::find(configPorts.begin(), configPorts.end(), portFromHeader) != configPorts.end() && !defaultForPort)
-            defaultForPort = &_configs[i];
-    }
-    if (defaultForPort)
-        return defaultForPort;
-    return NULL;
+    if (hostWithoutPort.size() > 1 && hostWithoutPort[0] == '[' && hostWithoutPort[hostWithoutPort.size() - 1] == ']')
+        hostWithoutPort = hostWithoutPort.substr(1, hostWithoutPort.size() - 2);
+    std::transform(hostWithoutPort.begin(), hostWithoutPort.end(), hostWithoutPort.begin(), ::tolower);
+    if (!hostWithoutPort.empty() && hostWithoutPort[hostWithoutPort.size() - 1] == '.')
+        hostWithoutPort.erase(hostWithoutPort.size() - 1);
+    int index = _virtualHosts.find(hostWithoutPort, portFromHeader);
+    return index < 0 ? NULL : &_configs[index];
 }
 
-
 void Server::cleanupSockets()
 {
     for (size_t i = 0; i < _server_fds.size(); ++i)
@@ -153,6 +299,17 @@ void Server::cleanupSockets()
             _server_fds[i] = -1;
         }
     }
+    if (_reserveFd >= 0)
+    {
+        close(_reserveFd);
+        _reserveFd = -1;
+    }
+    for (int i = 1; i >= 0; --i)
+    {
+        if (signal_pipe[i] >= 0)
+            close(signal_pipe[i]);
+        signal_pipe[i] = -1;
+    }
     _poll_fds.clear();
 }
 
@@ -163,111 +320,453 @@ void Server::run()
 
     while (running)
     {
-        int poll_count = poll(&_poll_fds[0], _poll_fds.size(), -1);
+        int timeout = _timers.nextTimeout();
+        if (_draining && (timeout < 0 || timeout > 1000))
+            timeout = 1000;
+        compactPollFds();
+        if (!_tlsPending.empty())
+            timeout = 0;
+        int poll_count = poll(_poll_fds.empty() ? NULL : &_poll_fds[0], _poll_fds.size(), timeout);
+        if (poll_count >= 0)
+            poll_count += markTlsPending();
 
-        if (poll_count < 0)
+        if (handleSignals())
+            continue;
+        handleTimeouts();
+        if (_draining && (_clientToServer.empty() || std::time(NULL) >= _drainDeadline))
         {
-            if (!running)
-                break;
-            logMessage("ERROR", "Poll failed.");
+            if (!_clientToServer.empty())
+                logMessage("WARNING", "Drain deadline reached with " + intToString(_clientToServer.size()) + " connection(s) still open.");
+            stop();
+            break;
+        }
+        if (poll_count <= 0)
+        {
+            if (poll_count < 0 && errno != EINTR)
+                logMessage("ERROR", "Poll failed.");
             continue;
         }
 
-        for (size_t i = 0; i < _poll_fds.size(); ++i)
+        size_t count = _poll_fds.size();
+        for (size_t i = 0; i < count; ++i)
         {
-            if (_poll_fds[i].revents & POLLIN)
+            int fd = _poll_fds[i].fd;
+            short revents = _poll_fds[i].revents;
+
+            if (fd < 0 || revents == 0)
+                continue;
+            if (fd == signal_pipe[0])
             {
-                if (isServerSocket(_poll_fds[i].fd))
-                    handleNewConnection(_poll_fds[i].fd);
-                else
-                    handleClientRequest(i);
+                drainSignalPipe();
+                continue;
             }
-            if (_poll_fds[i].revents & POLLOUT)
+            if (_proxySessions.find(fd) != _proxySessions.end())
             {
-                int client_fd = _poll_fds[i].fd;
-                if (responseBuffer.find(client_fd) != responseBuffer.end())
-                {
-                    const std::string& response = responseBuffer[client_fd];
-                    ssize_t bytes_sent = send(client_fd, response.c_str(), response.size(), 0);
-                    
-                    if (bytes_sent == -1 || bytes_sent == 0)
-                    {
-                        logMessage("ERROR", "Failed to send data to client " + intToString(client_fd));
-                        removeClient(i);
-                    }
-                    else
-                    {
-                        responseBuffer.erase(client_fd);
-                        _poll_fds[i].events &= ~POLLOUT;
-                    }
-                }
+                handleUpstreamEvent(i);
+                continue;
             }
+            if (_cgiSessions.find(fd) != _cgiSessions.end() || _cgiInputs.find(fd) != _cgiInputs.end())
+            {
+                handleCgiEvent(i);
+                continue;
+            }
+            std::map<int, SSL*>::iterator tls = _tlsClients.find(fd);
+            if (tls != _tlsClients.end() && !SSL_is_init_finished(tls->second))
+            {
+                continueTlsHandshake(i);
+                continue;
+            }
+            if (revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                if (isServerSocket(fd))
+                    handleNewConnection(fd);
+                else
+                    handleClientRequest(i);
+            }
+            if ((revents & POLLOUT) && _poll_fds[i].fd == fd)
+                sendClientResponse(i);
         }
     }
 }
 
+void Server::sendClientResponse(int clientIndex)
+{
+    int client_fd = _poll_fds[clientIndex].fd;
+    std::map<int, Http2Connection>::iterator h2 = _h2Connections.find(client_fd);
+    if (h2 != _h2Connections.end() && responseBuffer.find(client_fd) == responseBuffer.end())
+    {
+        std::string frames;
+        if (h2->second.produce(frames, HTTP2_WRITE_BUDGET))
+            responseBuffer[client_fd].swap(frames);
+    }
+    std::map<int, std::string>::iterator pending = responseBuffer.find(client_fd);
+    if (pending == responseBuffer.end())
+    {
+        setCork(client_fd, false);
+        _poll_fds[clientIndex].events &= ~POLLOUT;
+        if (h2 != _h2Connections.end())
+            settleHttp2(clientIndex);
+        return;
+    }
+
+    std::string& response = pending->second;
+    ssize_t bytes_sent = clientSend(client_fd, response.c_str(), response.size());
+    if (bytes_sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+    if (bytes_sent == -1 || bytes_sent == 0)
+    {
+        logMessage("ERROR", "Failed to send data to client " + intToString(client_fd));
+        removeClient(clientIndex);
+        return;
+    }
+    if (static_cast<size_t>(bytes_sent) < response.size())
+    {
+        response.erase(0, bytes_sent);
+        setCork(client_fd, true);
+        armClientTimer(client_fd, TIMER_SEND);
+        return;
+    }
+    responseBuffer.erase(pending);
+    if (h2 != _h2Connections.end())
+    {
+        setCork(client_fd, h2->second.wantsWrite());
+        return;
+    }
+    _poll_fds[clientIndex].events &= ~POLLOUT;
+    if (_clientProxy.find(client_fd) != _clientProxy.end())
+    {
+        setCork(client_fd, true);
+        armClientTimer(client_fd, TIMER_SEND);
+        return;
+    }
+    setCork(client_fd, false);
+    if (_lingering.count(client_fd))
+    {
+        lingerClient(clientIndex);
+        return;
+    }
+    if (_draining || _closeAfterSend.count(client_fd))
+    {
+        removeClient(clientIndex);
+        return;
+    }
+    _idleClients.insert(client_fd);
+    armClientTimer(client_fd, TIMER_KEEPALIVE);
+}
+
+// Corked while more of a response is still to come (a short write, or a
+// proxied body still streaming in), so it leaves in full segments; the
+// tail goes out as soon as the response is complete.
+void Server::setCork(int client_fd, bool corked)
+{
+#ifdef TCP_CORK
+    if (corked == (_corkedClients.count(client_fd) > 0))
+        return;
+    if (corked)
+    {
+        std::map<int, int>::const_iterator listener = _clientToServer.find(client_fd);
+        std::map<int, ListenOptions>::const_iterator options = listener == _clientToServer.end()
+            ? _listenerOptions.end() : _listenerOptions.find(listener->second);
+        if (options == _listenerOptions.end() || options->second.isUnix())
+            return;
+    }
+    int value = corked;
+    if (setsockopt(client_fd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value)) < 0)
+        return;
+    if (corked)
+        _corkedClients.insert(client_fd);
+    else
+        _corkedClients.erase(client_fd);
+#else
+    (void)client_fd;
+    (void)corked;
+#endif
+}
+
+int Server::findPollIndex(int fd) const
+{
+    for (size_t i = 0; i < _poll_fds.size(); ++i)
+    {
+        if (_poll_fds[i].fd == fd)
+            return i;
+    }
+    return -1;
+}
+
+void Server::addToPoll(int fd, short events)
+{
+    struct pollfd entry = {};
+    entry.fd = fd;
+    entry.events = events;
+    _poll_fds.push_back(entry);
+}
+
+// Entries are only marked free here and dropped by compactPollFds() before
+// the next poll(), so indices stay valid while the loop walks _poll_fds.
+void Server::releasePollSlot(int index)
+{
+    _poll_fds[index].fd = -1;
+    _poll_fds[index].events = 0;
+    _poll_fds[index].revents = 0;
+}
+
+void Server::compactPollFds()
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < _poll_fds.size(); ++i)
+    {
+        if (_poll_fds[i].fd >= 0)
+            _poll_fds[kept++] = _poll_fds[i];
+    }
+    _poll_fds.resize(kept);
+}
+
+void Server::armClientTimer(int client_fd, int kind, unsigned long delay)
+{
+    if (delay == 0)
+    {
+        if (kind == TIMER_HEADER)
+            delay = _global.getClientHeaderTimeout();
+        else if (kind == TIMER_BODY)
+            delay = _global.getClientBodyTimeout();
+        else if (kind == TIMER_SEND)
+            delay = _global.getSendTimeout();
+        else if (kind == TIMER_PROXY)
+            delay = _global.getProxyReadTimeout();
+        else if (kind == TIMER_CGI)
+            delay = _global.getCgiTimeout();
+        else
+            delay = _global.getKeepaliveTimeout();
+    }
+
+    TimerWheel::Timer& timer = _clientTimers[client_fd];
+    timer.fd = client_fd;
+    timer.kind = kind;
+    _timers.arm(timer, delay);
+}
+
+void Server::cancelClientTimer(int client_fd)
+{
+    std::map<int, TimerWheel::Timer>::iterator it = _clientTimers.find(client_fd);
+    if (it != _clientTimers.end())
+        _timers.cancel(it->second);
+}
+
+void Server::handleTimeouts()
+{
+    static const char* const phases[] = {"header", "body", "send", "keepalive", "upstream", "cgi", "linger"};
+    std::vector<TimerWheel::Timer*> expired;
+
+    _timers.advance(expired);
+    for (size_t i = 0; i < expired.size(); ++i)
+    {
+        int client_fd = expired[i]->fd;
+        int kind = expired[i]->kind;
+
+        if (kind != TIMER_KEEPALIVE && kind != TIMER_LINGER)
+            logMessage("WARNING", std::string("Client ") + intToString(client_fd) + " timed out (" + phases[kind] + ")");
+        if (kind == TIMER_PROXY)
+        {
+            failProxySession(client_fd, 504, false);
+            continue;
+        }
+        if (kind == TIMER_CGI)
+        {
+            finishCgiSession(client_fd, true);
+            continue;
+        }
+        if ((kind == TIMER_HEADER || kind == TIMER_BODY) && clientBuffers.find(client_fd) != clientBuffers.end())
+            clientSend(client_fd, REQUEST_TIMEOUT_RESPONSE, std::strlen(REQUEST_TIMEOUT_RESPONSE));
+        int index = findPollIndex(client_fd);
+        if (index >= 0)
+            removeClient(index);
+    }
+}
 
 bool Server::isServerSocket(int fd) const
 {
     return std::find(_server_fds.begin(), _server_fds.end(), fd) != _server_fds.end();
 }
 
+// Drains the accept queue, up to ACCEPT_BUDGET connections per wakeup; a
+// listener with more pending stays readable and is served on the next poll.
 void Server::handleNewConnection(int server_fd)
 {
-    sockaddr_in client_addr;
-    socklen_t client_len = sizeof(client_addr);
-    int client_fd = accept(server_fd, (sockaddr*)&client_addr, &client_len);
+    for (size_t accepted = 0; accepted < ACCEPT_BUDGET; ++accepted)
+    {
+        sockaddr_storage client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int client_fd = accept4(server_fd, (sockaddr*)&client_addr, &client_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
 
-    if (client_fd < 0)
+        if (client_fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno == EMFILE || errno == ENFILE)
+                shedConnection(server_fd);
+            else if (errno != EAGAIN && errno != EWOULDBLOCK)
+                logMessage("ERROR", "Failed to accept new connection.");
+            return;
+        }
+        acceptClient(server_fd, client_fd, client_addr);
+    }
+}
+
+// Out of descriptors, the pending connection would keep the listener
+// readable and poll() spinning: the reserve descriptor is given up to
+// accept and refuse it, then taken back.
+void Server::shedConnection(int server_fd)
+{
+    logMessage("WARNING", "Out of file descriptors, refusing a pending connection.");
+    if (_reserveFd < 0)
+        return;
+    close(_reserveFd);
+    int client_fd = accept4(server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_fd >= 0)
+        rejectConnection(client_fd, _tlsListeners.count(server_fd) ? NULL : SERVICE_UNAVAILABLE_RESPONSE);
+    _reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+// The listener's server block and port are bound to the connection here,
+// so requests on it need no getsockname().
+void Server::acceptClient(int server_fd, int client_fd, const sockaddr_storage& client_addr)
+{
+    if (_clientToServer.size() >= _global.getWorkerConnections())
     {
-        logMessage("ERROR", "Failed to accept new connection.");
+        logMessage("WARNING", "worker_connections limit reached, rejecting client " + intToString(client_fd));
+        rejectConnection(client_fd, _tlsListeners.count(server_fd) ? NULL : SERVICE_UNAVAILABLE_RESPONSE);
         return;
     }
+    // Per-IP limits do not apply to Unix-domain clients, which are all
+    // the same local fronting proxy.
+    if (client_addr.ss_family != AF_UNIX)
+    {
+        ClientLimiter::Key clientKey = ClientLimiter::keyFromAddress((const sockaddr*)&client_addr);
+        if (!_limiter.acquireConnection(clientKey, ClientLimiter::now()))
+        {
+            logMessage("WARNING", "Per-IP connection limit reached, rejecting client " + intToString(client_fd));
+            rejectConnection(client_fd, _tlsListeners.count(server_fd) ? NULL : SERVICE_UNAVAILABLE_RESPONSE);
+            return;
+        }
+        _clientAddresses[client_fd] = clientKey;
+    }
 
-    struct pollfd client_poll_fd = {};
-    client_poll_fd.fd = client_fd;
-    client_poll_fd.events = POLLIN;
-
-    _poll_fds.push_back(client_poll_fd);
+    addToPoll(client_fd, POLLIN);
+    armClientTimer(client_fd, TIMER_HEADER);
 
     ServerConfig* config = _socketToConfig[server_fd];
+    _clientToServer[client_fd] = server_fd;
+    std::map<int, ListenOptions>::const_iterator listener = _listenerOptions.find(server_fd);
+    _clientPorts[client_fd] = listener == _listenerOptions.end() || listener->second.isUnix() ? -1 : listener->second.port;
     if (config)
         _socketToConfig[client_fd] = config;
 
     else
         logMessage("WARNING", "Could not find server configuration for client.");
+    if (_tlsListeners.count(server_fd) && !startTls(client_fd, server_fd))
+        removeClient(findPollIndex(client_fd));
 }
 
 
 void Server::handleClientRequest(int clientIndex)
 {
     int client_fd = _poll_fds[clientIndex].fd;
+    if (_lingering.count(client_fd))
+    {
+        discardClientInput(clientIndex);
+        return;
+    }
+    if (_h2Connections.find(client_fd) != _h2Connections.end())
+    {
+        readHttp2(clientIndex);
+        return;
+    }
     std::string buffer = readClientRequest(client_fd, clientIndex);
     if (buffer.empty())
         return;
+    if (_h2Listeners.count(_clientToServer[client_fd]) && buffer.compare(0, 16, Http2Connection::PREFACE, 16) == 0)
+    {
+        startHttp2(clientIndex, buffer);
+        return;
+    }
+    dispatchRequest(client_fd, buffer, true);
+}
+
+// coalesce is false when replaying a request that already waited for
+// another client's cache fill, so it goes to the backend on a miss.
+void Server::dispatchRequest(int client_fd, const std::string& buffer, bool coalesce)
+{
     HttpRequest request(buffer);
-    std::string hostHeader = request.getHeaderValue("Host");
-    int connectedPort = -1;
-    struct sockaddr_in addr;
-    socklen_t addrLen = sizeof(addr);
-    if (getsockname(client_fd, (struct sockaddr*)&addr, &addrLen) == 0)
-        connectedPort = ntohs(addr.sin_port);
-    ServerConfig* config = getConfigForRequest(hostHeader, connectedPort);
+    ServerConfig* config = resolveConfig(client_fd, request);
     if (!config)
     {
         logMessage("ERROR", "No configuration found for client " + intToString(client_fd));
-        removeClient(clientIndex);
+        abortClient(client_fd);
+        return;
+    }
+    // Malformed requests skip the cache and proxy; handleRequest answers 400.
+    bool malformed = request.isMalformed();
+    bool cacheable = !malformed && _cache.isEnabled() && ResponseCache::isCacheableRequest(request);
+    std::string scope = cacheable ? cacheScope(client_fd) : "";
+    std::string cached;
+    if (cacheable && _cache.lookup(request, scope, cached))
+    {
+        logMessage("INFO", request.getMethod() + " " + request.getPath() + " " + request.getHttpVersion() + "\" " + intToString(request.extractStatusCode(cached)) + " " + intToString(cached.size()) + " cache hit");
+        queueClientData(client_fd, cached);
+        endClientResponse(client_fd);
+        return;
+    }
+    const ServerLocation* proxy = malformed ? NULL : config->findProxyLocation(request.getPath());
+    if (proxy)
+    {
+        // handleRequest() holds other locations to the limit; bodies are
+        // already checked as they arrive, this covers anything replayed.
+        if (request.getBody().size() > config->getClientMaxBodySize(request.getPath()))
+        {
+            queueClientData(client_fd, request.findErrorPage(*config, 413));
+            endClientResponse(client_fd);
+            return;
+        }
+        std::string leader;
+        if (cacheable && coalesce)
+        {
+            std::string key = ResponseCache::primaryKey(request, scope);
+            std::map<std::string, std::vector<std::pair<int, std::string> > >::iterator inFlight = _cacheWaiters.find(key);
+            if (inFlight != _cacheWaiters.end())
+            {
+                inFlight->second.push_back(std::make_pair(client_fd, buffer));
+                return;
+            }
+            _cacheWaiters[key];
+            leader = key;
+        }
+        startProxy(client_fd, request, buffer, *proxy, *config, leader);
+        if (_clientProxy.find(client_fd) == _clientProxy.end())
+        {
+            endClientResponse(client_fd);
+            releaseCacheWaiters(leader);
+        }
         return;
     }
     try {
         std::string response = request.handleRequest(*config);
-         logMessage("INFO", request.getMethod() + " " + request.getPath() + " " + request.getHttpVersion() + + "\" " + intToString(request.extractStatusCode(response)) + " " + intToString(response.size()) + " \"" + request.getHeaderValue("User-Agent") + "\"");
-        responseBuffer[client_fd] = response;
-        _poll_fds[clientIndex].events |= POLLOUT;
+        if (!request.getCGIScript().empty())
+        {
+            startCGI(client_fd, request, buffer, *config);
+            if (_clientCgi.find(client_fd) == _clientCgi.end())
+                endClientResponse(client_fd);
+            return;
+        }
+        const char* userAgent = request.headerValue("User-Agent");
+         logMessage("INFO", request.getMethod() + " " + request.getPath() + " " + request.getHttpVersion() + + "\" " + intToString(request.extractStatusCode(response)) + " " + intToString(response.size()) + " \"" + (userAgent ? userAgent : "") + "\"");
+        if (cacheable)
+            storeResponse(request, scope, response);
+        queueClientData(client_fd, response);
+        endClientResponse(client_fd);
     }
     catch (const std::exception& e) {
         logMessage("ERROR", "Failed to handle request for client " + intToString(client_fd));
-        removeClient(clientIndex);
+        abortClient(client_fd);
     }
 }
 
@@ -276,40 +775,66 @@ std::string Server::readClientRequest(int client_fd, int clientIndex)
     char tempBuffer[1024];
     ssize_t bytes_read;
 
-    bytes_read = recv(client_fd, tempBuffer, sizeof(tempBuffer) - 1, MSG_DONTWAIT);
+    bytes_read = clientRecv(client_fd, tempBuffer, sizeof(tempBuffer) - 1);
 
     if (bytes_read > 0)
     {
+        if (clientBuffers.find(client_fd) == clientBuffers.end() && !allowClientRequest(client_fd))
+        {
+            logMessage("WARNING", "Request rate limit exceeded for client " + intToString(client_fd));
+            clientSend(client_fd, TOO_MANY_REQUESTS_RESPONSE, std::strlen(TOO_MANY_REQUESTS_RESPONSE));
+            removeClient(clientIndex);
+            return "";
+        }
+        if (_idleClients.erase(client_fd))
+            armClientTimer(client_fd, TIMER_HEADER);
         tempBuffer[bytes_read] = '\0';
-        clientBuffers[client_fd] += std::string(tempBuffer, bytes_read);
+        std::string& pending = clientBuffers[client_fd];
+        pending.append(tempBuffer, bytes_read);
 
-        if (clientBuffers[client_fd].find("\r\n\r\n") != std::string::npos || clientBuffers[client_fd].find("\n\n") != std::string::npos)
+        std::map<int, PendingBody>::iterator body = _pendingBodies.find(client_fd);
+        int status = 0;
+        if (body == _pendingBodies.end())
         {
-            size_t contentLengthPos = clientBuffers[client_fd].find("Content-Length:");
-            
-            if (contentLengthPos != std::string::npos) {
-                size_t start = clientBuffers[client_fd].find(" ", contentLengthPos) + 1;
-                size_t end = clientBuffers[client_fd].find("\r\n", contentLengthPos);
-                int contentLength = std::atoi(clientBuffers[client_fd].substr(start, end - start).c_str());
-                size_t currentBodySize = clientBuffers[client_fd].size() - clientBuffers[client_fd].find("\r\n\r\n") - 4;
-                if (currentBodySize >= static_cast<size_t>(contentLength))
-                {
-                    std::string completeRequest = clientBuffers[client_fd];
-                    clientBuffers.erase(client_fd);
-                    return completeRequest;
-                }
-            }
-            else
+            // Each read only scans what is new, plus the 3 bytes before it
+            // that may hold the start of the blank line.
+            size_t limit = std::min(pending.size(), _global.getClientHeaderBufferSize());
+            size_t& scanned = _headScanned[client_fd];
+            size_t start = scanned > 3 ? scanned - 3 : 0;
+            size_t headEnd = HeaderScanner::findHeadEnd(pending.data() + start, limit - start);
+            scanned = limit;
+            if (headEnd != HeaderScanner::npos)
             {
-                std::string completeRequest = clientBuffers[client_fd];
-                clientBuffers.erase(client_fd);
-                return completeRequest;
+                _headScanned.erase(client_fd);
+                status = beginRequestBody(client_fd, start + headEnd);
+                body = _pendingBodies.find(client_fd);
             }
+            else if (limit < _global.getClientHeaderBufferSize())
+                return "";
+            else
+                status = 431;
+        }
+        if (status == 0)
+            status = receiveRequestBody(body->second, pending);
+        if (status == 0)
+        {
+            armClientTimer(client_fd, TIMER_BODY);
+            return "";
+        }
+        if (status != 200)
+        {
+            rejectRequest(clientIndex, status);
+            return "";
         }
+        std::string completeRequest = body->second.chunked ? dechunkRequest(pending, body->second) : pending;
+        _pendingBodies.erase(body);
+        clientBuffers.erase(client_fd);
+        cancelClientTimer(client_fd);
+        return completeRequest;
     }
     else if (bytes_read == 0)
         removeClient(clientIndex);
-    else if (bytes_read == -1)
+    else if (bytes_read == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
     {
         logMessage("ERROR", "Read error on client socket." + intToString(client_fd));
         removeClient(clientIndex);
@@ -317,6 +842,175 @@ std::string Server::readClientRequest(int client_fd, int clientIndex)
     return "";
 }
 
+PendingBody::PendingBody() : headEnd(0), limit(static_cast<size_t>(-1)), chunked(false),
+    contentLength(0), consumed(0)
+{
+}
+
+// Unix-domain clients have no port to match: they get the server block of
+// the listener they came in on.
+ServerConfig* Server::resolveConfig(int client_fd, const HttpRequest& request)
+{
+    std::map<int, int>::const_iterator port = _clientPorts.find(connectionFd(client_fd));
+    if (port != _clientPorts.end() && port->second >= 0)
+    {
+        const char* host = request.headerValue(HttpRequest::HOST);
+        return getConfigForRequest(host ? host : "", port->second);
+    }
+    std::map<int, ServerConfig*>::const_iterator config = _socketToConfig.find(connectionFd(client_fd));
+    return config == _socketToConfig.end() ? NULL : config->second;
+}
+
+// Resolves the server and location from the head alone, so the body is
+// held to their client_max_body_size before any of it is buffered.
+// Returns 0, or the status to reject the request with.
+int Server::beginRequestBody(int client_fd, size_t headEnd)
+{
+    PendingBody& body = _pendingBodies[client_fd];
+    body.headEnd = headEnd;
+    HttpRequest head(clientBuffers[client_fd].substr(0, headEnd));
+    ServerConfig* config = resolveConfig(client_fd, head);
+    if (config)
+        body.limit = config->getClientMaxBodySize(head.getPath());
+
+    const char* encoding = head.headerValue(HttpRequest::TRANSFER_ENCODING);
+    if (encoding)
+    {
+        if (strcasecmp(encoding, "chunked") != 0)
+            return 501;
+        body.chunked = true;
+        return 0;
+    }
+    const char* length = head.headerValue(HttpRequest::CONTENT_LENGTH);
+    if (!length)
+        return 0;
+    char* end;
+    errno = 0;
+    unsigned long long value = std::strtoull(length, &end, 10);
+    if (*length < '0' || *length > '9' || *end || errno == ERANGE || value > static_cast<size_t>(-1))
+        return 400;
+    body.contentLength = value;
+    return body.contentLength > body.limit ? 413 : 0;
+}
+
+// 0 while more of the body is expected, 200 once it is complete, or the
+// status to reject the request with. A chunked body is only measured
+// here; it is decoded once, when complete.
+int Server::receiveRequestBody(PendingBody& body, const std::string& pending)
+{
+    size_t received = pending.size() - body.headEnd;
+    if (!body.chunked)
+        return received >= body.contentLength ? 200 : 0;
+    body.consumed += body.chunks.feed(pending.data() + body.headEnd + body.consumed, received - body.consumed);
+    if (body.chunks.hasError())
+        return 400;
+    if (body.chunks.getDecodedSize() > body.limit)
+        return 413;
+    return body.chunks.isDone() ? 200 : 0;
+}
+
+// The request as the handlers expect it: body decoded, and framing
+// headers replaced by the Content-Length of the decoded body.
+std::string Server::dechunkRequest(const std::string& pending, const PendingBody& body)
+{
+    std::string request;
+    request.reserve(body.headEnd + body.chunks.getDecodedSize() + 32);
+    for (size_t pos = 0; pos < body.headEnd; )
+    {
+        size_t end = pending.find('\n', pos);
+        size_t length = end - pos;
+        if (length == 0 || (length == 1 && pending[pos] == '\r'))
+            break;
+        if (!isFramingHeader(pending.data() + pos, length))
+            request.append(pending, pos, length + 1);
+        pos = end + 1;
+    }
+    request += "Content-Length: ";
+    HttpFormat::appendUnsigned(request, body.chunks.getDecodedSize());
+    request += "\r\n\r\n";
+    ChunkedParser decoder;
+    decoder.feed(pending.data() + body.headEnd, body.consumed, &request);
+    return request;
+}
+
+// Answers before the rest of the body is read, so an oversized upload
+// costs no memory. The rest of the body is discarded until the reply is
+// out and the connection lingers (see lingerClient()), so closing with
+// unread data does not reset the connection before the client reads it.
+void Server::rejectRequest(int clientIndex, int status)
+{
+    int client_fd = _poll_fds[clientIndex].fd;
+    PendingBody body = _pendingBodies[client_fd];
+    std::string head = clientBuffers[client_fd].substr(0, body.headEnd);
+    _pendingBodies.erase(client_fd);
+    clientBuffers.erase(client_fd);
+    _headScanned.erase(client_fd);
+    logMessage("WARNING", "Rejected request from client " + intToString(client_fd) + " with " + intToString(status) + " before reading its body");
+    // The server is resolved again from the head, so its error pages come
+    // from the live configuration. A head that never completed gets the
+    // listener's server.
+    HttpRequest request(head);
+    ServerConfig* config = body.headEnd ? resolveConfig(client_fd, request) : NULL;
+    if (!config)
+    {
+        std::map<int, ServerConfig*>::iterator listener = _socketToConfig.find(client_fd);
+        config = listener == _socketToConfig.end() ? NULL : listener->second;
+    }
+    if (!config)
+    {
+        removeClient(clientIndex);
+        return;
+    }
+    std::string response = request.findErrorPage(*config, status);
+    response.insert(response.find("\r\n") + 2, "Connection: close\r\n");
+    _closeAfterSend.insert(client_fd);
+    _lingering.insert(client_fd);
+    queueClientData(client_fd, response);
+}
+
+// The reply is out: our side is shut down, and whatever the client still
+// sends is read and dropped until it closes or LINGER_TIMEOUT expires.
+void Server::lingerClient(int clientIndex)
+{
+    int client_fd = _poll_fds[clientIndex].fd;
+    std::map<int, SSL*>::iterator tls = _tlsClients.find(client_fd);
+    if (tls != _tlsClients.end())
+        SSL_shutdown(tls->second);
+    if (shutdown(client_fd, SHUT_WR) != 0)
+    {
+        removeClient(clientIndex);
+        return;
+    }
+    armClientTimer(client_fd, TIMER_LINGER, LINGER_TIMEOUT);
+}
+
+void Server::discardClientInput(int clientIndex)
+{
+    int client_fd = _poll_fds[clientIndex].fd;
+    char buffer[16384];
+    ssize_t bytes_read;
+
+    while ((bytes_read = clientRecv(client_fd, buffer, sizeof(buffer))) > 0)
+        ;
+    if (bytes_read == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        removeClient(clientIndex);
+}
+
+void Server::rejectConnection(int client_fd, const char* response)
+{
+    if (response)
+        send(client_fd, response, std::strlen(response), MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(client_fd);
+}
+
+bool Server::allowClientRequest(int client_fd)
+{
+    std::map<int, ClientLimiter::Key>::iterator address = _clientAddresses.find(client_fd);
+    if (address == _clientAddresses.end())
+        return true;
+    return _limiter.allowRequest(address->second, ClientLimiter::now());
+}
+
 void Server::removeClient(int index)
 {
     int client_fd = _poll_fds[index].fd;
@@ -325,16 +1019,75 @@ void Server::removeClient(int index)
         responseBuffer.erase(client_fd);
     if (_socketToConfig.find(client_fd) != _socketToConfig.end())
         _socketToConfig.erase(client_fd);
+    _clientToServer.erase(client_fd);
+    _idleClients.erase(client_fd);
+    _closeAfterSend.erase(client_fd);
+    _lingering.erase(client_fd);
+    if (_h2Connections.find(client_fd) != _h2Connections.end())
+    {
+        closeHttp2Streams(client_fd);
+        _h2Connections.erase(client_fd);
+    }
+    forgetCacheWaiter(client_fd);
+    detachCgiClient(client_fd);
+    std::map<int, int>::iterator proxied = _clientProxy.find(client_fd);
+    if (proxied != _clientProxy.end())
+        finishProxySession(proxied->second, false);
+    cancelClientTimer(client_fd);
+    _clientTimers.erase(client_fd);
+    std::map<int, SSL*>::iterator tls = _tlsClients.find(client_fd);
+    if (tls != _tlsClients.end())
+    {
+        if (SSL_is_init_finished(tls->second))
+            SSL_shutdown(tls->second);
+        SSL_free(tls->second);
+        _tlsClients.erase(tls);
+        _tlsPending.erase(client_fd);
+    }
+    std::map<int, ClientLimiter::Key>::iterator address = _clientAddresses.find(client_fd);
+    if (address != _clientAddresses.end())
+    {
+        _limiter.releaseConnection(address->second, ClientLimiter::now());
+        _clientAddresses.erase(address);
+    }
+    clientBuffers.erase(client_fd);
+    _headScanned.erase(client_fd);
+    _pendingBodies.erase(client_fd);
+    _clientPorts.erase(client_fd);
+    _corkedClients.erase(client_fd);
+    releaseRetiredConfigs(client_fd);
     if (client_fd != -1)
         close(client_fd);
-    _poll_fds.erase(_poll_fds.begin() + index);
+    releasePollSlot(index);
 }
 
 void Server::stop()
 {
     logMessage("INFO", "Stopping the server...");
     running = false;
+    for (std::map<int, CgiSession>::iterator it = _cgiSessions.begin(); it != _cgiSessions.end(); ++it)
+    {
+        kill(it->second.pid, SIGKILL);
+        waitpid(it->second.pid, NULL, 0);
+    }
     cleanupSockets();
+    const UploadSink::Counters& uploads = UploadSink::counters();
+    if (uploads.started > 0)
+    {
+        std::ostringstream summary;
+        summary << "Uploads: " << uploads.completed << " stored, " << uploads.failed << " failed, "
+                << uploads.bytes << " bytes written";
+        logMessage("INFO", summary.str());
+    }
+    const OpenFileCache::Counters& files = OpenFileCache::counters();
+    if (files.hits + files.misses > 0)
+    {
+        std::ostringstream summary;
+        summary << "Open file cache: " << files.hits << " hits, " << files.misses << " misses, "
+                << files.revalidated << " reopened, " << files.evicted << " evicted";
+        logMessage("INFO", summary.str());
+    }
+    OpenFileCache::clear();
     logMessage("INFO", "Server stopped successfully.");
 }
 
@@ -342,4 +1095,19 @@ void Server::signalHandler(int signal)
 {
     if (signal == SIGINT)
         signal_received = 1;
+    else if (signal == SIGHUP)
+        reload_requested = 1;
+    else if (signal == SIGTERM || signal == SIGQUIT)
+        drain_requested = 1;
+    else if (signal == SIGUSR2)
+        upgrade_requested = 1;
+    else if (signal == SIGCHLD)
+        child_exited = 1;
+    if (signal_pipe[1] >= 0)
+    {
+        int saved = errno;
+        ssize_t written = write(signal_pipe[1], "", 1);
+        (void)written;
+        errno = saved;
+    }
 }
\ No newline at end of file
@@ -1,4 +1,7 @@
 #include "ServerConfig.hpp"
+#include "GlobalConfig.hpp"
+#include "StaticPack.hpp"
+#include <sys/stat.h>
 
 ServerConfig::ServerConfig() : _root("var/www/main"), _index("index.html"), _host("127.0.0.1"), _clientMaxBodySize(100000000)
 {
@@ -13,182 +16,235 @@ ServerConfig::ServerConfig() : _root("var/www/main"), _index("index.html"), _hos
     setErrorPage(415, ("main/errors/415.html"));
 }
 
-void ServerConfig::parseServerBlock(const std::string& serverBlock)
+namespace
 {
-    size_t pos = 0;
-    size_t end;
+    const std::string& singleValue(const ConfigNode& directive)
+    {
+        if (directive.args.empty())
+            throw std::runtime_error("Error: Missing value for '" + directive.name + "'");
+        if (directive.args.size() > 1)
+            throw std::runtime_error("Error: '" + directive.name + "' expects a single value");
+        return directive.args[0];
+    }
 
+    std::string onOff(const ConfigNode& directive)
+    {
+        const std::string& value = singleValue(directive);
+        if (value != "on" && value != "off")
+            throw std::runtime_error("Error: " + directive.name + " expects 'on' or 'off', got '" + value + "'");
+        return value;
+    }
+}
+
+void ServerConfig::parseServerBlock(const ConfigNode& serverBlock)
+{
     bool hasListen = false;
     bool hasRoot = false;
 
-    while (pos < serverBlock.size())
+    for (size_t i = 0; i < serverBlock.children.size(); ++i)
     {
-        end = serverBlock.find('\n', pos);
-        if (end == std::string::npos)
-            end = serverBlock.size();
+        const ConfigNode& directive = serverBlock.children[i];
+        const std::string& name = directive.name;
 
-        std::string line = serverBlock.substr(pos, end - pos);
-
-        line.erase(0, line.find_first_not_of(" \t\r"));
-        line.erase(line.find_last_not_of(" \t\r") + 1);
-
-        if (line.empty() || line[0] == '#' || line == "server {" || line == "}") 
+        if (name == "location")
         {
-            pos = end + 1;
+            handleLocationDirective(directive);
             continue;
         }
-
-        if (line.find("listen") == 0)
+        try
         {
-            std::string value = line.substr(6);
-            value.erase(0, value.find_first_not_of(" \t"));
-            value.erase(value.find_last_not_of(" \t;") + 1);
-
-            if (value.empty())
-                throw std::runtime_error("Error: Missing value for 'listen'");
-
-            int port = std::atoi(value.c_str());
-            if (port <= 0 || port > 65535)
-                throw std::runtime_error("Error: Invalid port value '" + value + "'");
-
-            _ports.push_back(port);
-            hasListen = true;
+            if (directive.block && name != "types")
+                throw std::runtime_error("Error: Unexpected block '" + name + "'");
+            if (name == "listen")
+            {
+                handleListenDirective(directive);
+                hasListen = true;
+            }
+            else if (name == "root")
+            {
+                _root = singleValue(directive);
+                hasRoot = true;
+            }
+            else if (name == "index")
+                _index = singleValue(directive);
+            else if (name == "server_name")
+            {
+                if (directive.args.empty())
+                    throw std::runtime_error("Error: Missing value for 'server_name'");
+                for (size_t j = 0; j < directive.args.size(); ++j)
+                    addServerName(directive.args[j]);
+            }
+            else if (name == "host")
+                setHost(singleValue(directive));
+            else if (name == "client_max_body_size")
+                _clientMaxBodySize = std::strtoul(singleValue(directive).c_str(), NULL, 10);
+            else if (name == "ssl_certificate")
+                _sslCertificate = singleValue(directive);
+            else if (name == "ssl_certificate_key")
+                _sslCertificateKey = singleValue(directive);
+            else if (name == "types")
+                handleTypesDirective(directive);
+            else if (name == "error_page")
+                handleErrorPageDirective(directive);
+            else
+                throw std::runtime_error("Error: Unknown directive '" + name + "'");
         }
-        else if (line.find("root") == 0)
+        catch (const std::runtime_error& e)
         {
-            std::string value = line.substr(4);
-            value.erase(0, value.find_first_not_of(" \t"));
-            value.erase(value.find_last_not_of(" \t;") + 1);
+            throw std::runtime_error(directive.where() + ": " + e.what());
+        }
+    }
+
+    if (!hasListen)
+        throw std::runtime_error(serverBlock.where() + ": Error: Missing 'listen' directive in server block");
+    for (size_t i = 0; i < _listens.size(); ++i)
+    {
+        if (_listens[i].host.empty() && !_listens[i].isUnix())
+            _listens[i].host = _host;
+    }
+    if (!hasRoot)
+        throw std::runtime_error(serverBlock.where() + ": Error: Missing 'root' directive in server block");
+    if (hasSslListener() && (_sslCertificate.empty() || _sslCertificateKey.empty()))
+        throw std::runtime_error(serverBlock.where() + ": Error: 'listen ... ssl' requires 'ssl_certificate' and 'ssl_certificate_key'");
+}
 
-            if (value.empty())
-                throw std::runtime_error("Error: Missing value for 'root'");
+void ServerConfig::handleLocationDirective(const ConfigNode& directive)
+{
+    try
+    {
+        if (!directive.block)
+            throw std::runtime_error("Error: 'location' needs a { } block");
+        if (directive.args.size() != 1)
+            throw std::runtime_error("Error: Missing 'path' for location block");
 
-            _root = value;
-            hasRoot = true;
-        }
-        else if (line.find("index") == 0)
-        {
-            std::string value = line.substr(5);
-            value.erase(0, value.find_first_not_of(" \t"));
-            value.erase(value.find_last_not_of(" \t;") + 1);
+        ServerLocation location(directive.args[0]);
+        parseLocationBlock(directive, location);
+        _locations.push_back(location);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Warning: Invalid location block ignored. " << directive.where() << ": " << e.what() << std::endl;
+    }
+}
 
-            if (value.empty())
-                throw std::runtime_error("Error: Missing value for 'index'");
+// "port", "host:port", "[ipv6]:port", "host" (port 80) or "unix:/path",
+// followed by the options of that listener.
+void ServerConfig::handleListenDirective(const ConfigNode& directive)
+{
+    std::string value = directive.value();
 
-            _index = value;
-        }
-        else if (line.find("server_name") == 0)
-        {
-            std::string value = line.substr(11);
-            value.erase(0, value.find_first_not_of(" \t"));
-            value.erase(value.find_last_not_of(" \t;") + 1);
+    if (value.empty())
+        throw std::runtime_error("Error: Missing value for 'listen'");
 
-            if (value.empty())
-                throw std::runtime_error("Error: Missing value for 'server_name'");
+    std::istringstream params(value);
+    std::string address;
+    params >> address;
 
-            _serverName = value;
+    ListenOptions options;
+    if (address.compare(0, 5, "unix:") == 0)
+    {
+        options.path = address.substr(5);
+        if (options.path.empty() || options.path.size() >= 108 || options.path.find_first_of(",;") != std::string::npos)
+            throw std::runtime_error("Error: Invalid unix socket path '" + address + "'");
+    }
+    else
+    {
+        std::string portStr = address;
+        if (address[0] == '[')
+        {
+            size_t close = address.find(']');
+            if (close == std::string::npos || (close + 1 < address.size() && address[close + 1] != ':'))
+                throw std::runtime_error("Error: Invalid listen address '" + address + "'");
+            options.host = address.substr(1, close - 1);
+            portStr = close + 1 < address.size() ? address.substr(close + 2) : "80";
+            if (options.host.find(':') == std::string::npos || !isValidIP(options.host))
+                throw std::runtime_error("Error: Invalid IPv6 address '" + address + "'");
         }
-        else if (line.find("host") == 0)
+        else if (address.find(':') != std::string::npos)
         {
-            std::string value = line.substr(4);
-            value.erase(0, value.find_first_not_of(" \t"));
-            value.erase(value.find_last_not_of(" \t;") + 1);
-
-            if (value.empty())
-                throw std::runtime_error("Error: Missing value for 'host'");
-
-            setHost(value);
+            size_t colon = address.find(':');
+            if (address.find(':', colon + 1) != std::string::npos)
+                throw std::runtime_error("Error: IPv6 listen addresses must be bracketed: '" + address + "'");
+            options.host = address.substr(0, colon);
+            portStr = address.substr(colon + 1);
         }
-        else if (line.find("client_max_body_size") == 0)
+        else if (address.find_first_not_of("0123456789") != std::string::npos)
         {
-            std::string value = line.substr(20);
-            value.erase(0, value.find_first_not_of(" \t"));
-            value.erase(value.find_last_not_of(" \t;") + 1);
-
-            if (value.empty())
-                throw std::runtime_error("Error: Missing value for 'client_max_body_size'");
+            options.host = address;
+            portStr = "80";
+        }
+        if (options.host == "*")
+            options.host = "0.0.0.0";
+        if (portStr.empty() || portStr.find_first_not_of("0123456789") != std::string::npos)
+            throw std::runtime_error("Error: Invalid port value '" + value + "'");
+        options.port = std::atoi(portStr.c_str());
+        if (options.port <= 0 || options.port > 65535)
+            throw std::runtime_error("Error: Invalid port value '" + value + "'");
+    }
 
-            _clientMaxBodySize = std::strtoul(value.c_str(), NULL, 10);
+    std::string param;
+    while (params >> param)
+    {
+        if (param == "ssl")
+            options.ssl = true;
+        else if (param == "http2")
+            options.http2 = true;
+        else if (param.find("backlog=") == 0)
+        {
+            options.backlog = std::atoi(param.c_str() + 8);
+            if (options.backlog <= 0)
+                throw std::runtime_error("Error: Invalid 'listen' backlog '" + param + "'");
         }
-        else if (line.find("location") == 0)
+        else if (param == "ipv6only=on" || param == "ipv6only=off")
+            options.ipv6only = param == "ipv6only=on";
+        else if (param == "deferred")
+            options.deferred = true;
+        else if (param.find("fastopen=") == 0)
         {
-            handleLocationDirective(line, serverBlock, pos);
-            continue;
+            options.fastopen = std::atoi(param.c_str() + 9);
+            if (options.fastopen <= 0)
+                throw std::runtime_error("Error: Invalid 'listen' fastopen '" + param + "'");
         }
-        else if (line.find("error_page") == 0)
-            handleErrorPageDirective(line);
+        else if (param.find("rcvbuf=") == 0)
+            options.rcvbuf = GlobalConfig::parseSize(param.substr(7), "rcvbuf");
+        else if (param.find("sndbuf=") == 0)
+            options.sndbuf = GlobalConfig::parseSize(param.substr(7), "sndbuf");
         else
-            throw std::runtime_error("Error: Unknown directive '" + line + "'");
-
-        pos = end + 1;
+            throw std::runtime_error("Error: Unknown 'listen' parameter '" + param + "'");
     }
 
-    if (!hasListen)
-        throw std::runtime_error("Error: Missing 'listen' directive in server block");
-    if (!hasRoot)
-        throw std::runtime_error("Error: Missing 'root' directive in server block");
+    if (options.isUnix() && (options.deferred || options.fastopen))
+        throw std::runtime_error("Error: 'deferred' and 'fastopen' need a TCP listener: '" + address + "'");
+    if (!options.isUnix())
+        _ports.push_back(options.port);
+    _listens.push_back(options);
 }
 
-void ServerConfig::handleLocationDirective(const std::string& line, const std::string& serverBlock, size_t& pos)
+void ServerConfig::handleTypesDirective(const ConfigNode& directive)
 {
-    size_t pathStart = line.find("location") + 8;
-    std::string path = line.substr(pathStart);
-    path.erase(0, path.find_first_not_of(" \t"));
-    size_t pathEnd = path.find_first_of(" \t{");
-    if (pathEnd != std::string::npos)
-        path = path.substr(0, pathEnd);
-
-    if (path.empty())
-        throw std::runtime_error("Error: Missing 'path' for location block");
-    size_t locationStart = serverBlock.find('{', pos);
-    size_t locationEnd = serverBlock.find('}', locationStart);
-
-    if (locationStart == std::string::npos || locationEnd == std::string::npos)
-        throw std::runtime_error("Error: Malformed location block");
-
-    std::string locationBlock = serverBlock.substr(locationStart + 1, locationEnd - locationStart - 1);
-
-    ServerLocation location(path);
-
-    try
-    {
-        parseLocationBlock(locationBlock, location);
-        _locations.push_back(location);
-    }
-    catch (const std::exception& e)
+    if (!directive.block)
+        throw std::runtime_error("Error: 'types' needs a { } block");
+    for (size_t i = 0; i < directive.children.size(); ++i)
     {
-        std::cerr << "Warning: Invalid location block ignored. " << e.what() << std::endl;
+        const ConfigNode& entry = directive.children[i];
+        if (entry.block || entry.args.empty())
+            throw std::runtime_error("Error: Missing extension for type '" + entry.name + "'");
+        for (size_t j = 0; j < entry.args.size(); ++j)
+            addMimeType(entry.args[j], entry.name);
     }
-
-    pos = locationEnd + 1;
 }
 
-void ServerConfig::handleErrorPageDirective(const std::string& line)
+void ServerConfig::handleErrorPageDirective(const ConfigNode& directive)
 {
-    std::string value = line.substr(10);
-    value.erase(0, value.find_first_not_of(" \t"));
-    value.erase(value.find_last_not_of(" \t;") + 1);
-
-    if (value.empty())
-        throw std::runtime_error("Error: Missing value for 'error_page'");
-
-    size_t spacePos = value.find(' ');
-    if (spacePos == std::string::npos)
+    if (directive.args.size() != 2)
         throw std::runtime_error("Error: Invalid format for 'error_page'. Expected: <code> <path>");
 
-    std::string errorCodeStr = value.substr(0, spacePos);
-    errorCodeStr.erase(0, errorCodeStr.find_first_not_of(" \t"));
-    errorCodeStr.erase(errorCodeStr.find_last_not_of(" \t") + 1);
-
+    const std::string& errorCodeStr = directive.args[0];
     int errorCode = std::atoi(errorCodeStr.c_str());
     if (errorCode < 100 || errorCode > 599)
         throw std::runtime_error("Error: Invalid error code '" + errorCodeStr + "' for 'error_page'");
 
-    std::string errorPath = value.substr(spacePos + 1);
-    errorPath.erase(0, errorPath.find_first_not_of(" \t"));
-    errorPath.erase(errorPath.find_last_not_of(" \t;") + 1);
-    if (errorPath.empty())
-        throw std::runtime_error("Error: Missing path for 'error_page'");
+    const std::string& errorPath = directive.args[1];
     std::string fullPath = _root + errorPath;
     std::ifstream testFile(fullPath.c_str());
     if (!testFile.is_open())
@@ -198,87 +254,102 @@ void ServerConfig::handleErrorPageDirective(const std::string& line)
     _error_pages[errorCode] = errorPath;
 }
 
-void ServerConfig::parseLocationBlock(const std::string& locationBlock, ServerLocation& location)
+void ServerConfig::parseLocationBlock(const ConfigNode& locationBlock, ServerLocation& location)
 {
-    size_t pos = 0;
-    size_t end;
-
-    while (pos < locationBlock.size())
+    for (size_t i = 0; i < locationBlock.children.size(); ++i)
     {
-        end = locationBlock.find('\n', pos);
-        if (end == std::string::npos)
-            end = locationBlock.size();
-
-        std::string line = locationBlock.substr(pos, end - pos);
-
-        line.erase(0, line.find_first_not_of(" \t\r"));
-        line.erase(line.find_last_not_of(" \t\r;") + 1);
-
-        if (line.empty() || line[0] == '#')
-        {
-            pos = end + 1;
-            continue;
-        }
-
-        if (line.find("root") == 0)
-        {
-            std::string value = line.substr(4);
-            value.erase(0, value.find_first_not_of(" \t"));
-            location.setRoot(value);
+        const ConfigNode& directive = locationBlock.children[i];
+        const std::string& name = directive.name;
 
-            std::ifstream testFile(value.c_str());
-            if (!testFile.is_open())
-            throw std::runtime_error("The specified root directory does not exist: " + value);
-        }
-        else if (line.find("index") == 0)
+        try
         {
-            std::string value = line.substr(5);
-            value.erase(0, value.find_first_not_of(" \t"));
-            location.setIndex(value);
-            std::string fullPath = location.getRoot() + value;
-            std::ifstream testFile(fullPath.c_str());
-            if (!testFile.is_open())
-                throw std::runtime_error("The specified index file does not exist " + fullPath);
-        }
-        else if (line.find("methods") == 0)
-        {
-            location.disableAllMethods();
-            std::string methods = line.substr(7);
-            methods.erase(0, methods.find_first_not_of(" \t"));
+            if (directive.block)
+                throw std::runtime_error("Error: Unexpected block '" + name + "' in location block");
+            if (name == "root")
+            {
+                const std::string& value = singleValue(directive);
+                location.setRoot(value);
 
-            if (methods.find("GET") != std::string::npos)
-                location.allowGet();
-            if (methods.find("POST") != std::string::npos)
-                location.allowPost();
-            if (methods.find("DELETE") != std::string::npos)
-                location.allowDelete();
-        }
-        else
-        {
-            if (line.find_first_not_of(" \t") == std::string::npos)
+                std::ifstream testFile(value.c_str());
+                if (!testFile.is_open())
+                    throw std::runtime_error("The specified root directory does not exist: " + value);
+            }
+            else if (name == "index")
             {
-                pos = end + 1;
-                continue;
+                const std::string& value = singleValue(directive);
+                location.setIndex(value);
+                std::string fullPath = location.getRoot() + value;
+                std::ifstream testFile(fullPath.c_str());
+                if (!testFile.is_open())
+                    throw std::runtime_error("The specified index file does not exist " + fullPath);
             }
-            std::cerr << "Unknown directive: [" << line << "]" << std::endl;
-
-            throw std::runtime_error("Error: Unknown directive in location block: '" + line + "'");
+            else if (name == "autoindex_format")
+            {
+                const std::string& value = singleValue(directive);
+                if (value != "html" && value != "json")
+                    throw std::runtime_error("Error: autoindex_format expects 'html' or 'json', got '" + value + "'");
+                location.setAutoindexFormat(value == "json" ? DirectoryIndex::JSON : DirectoryIndex::HTML);
+            }
+            else if (name == "autoindex")
+                location.setAutoindex(onOff(directive) == "on");
+            else if (name == "upload_store")
+            {
+                const std::string& value = singleValue(directive);
+                struct stat info;
+                if (stat(value.c_str(), &info) != 0 || !S_ISDIR(info.st_mode))
+                    throw std::runtime_error("Error: upload_store directory does not exist: " + value);
+                location.setUploadStore(value);
+            }
+            else if (name == "upload_fsync")
+            {
+                const std::string& value = singleValue(directive);
+                UploadSink::SyncPolicy policy;
+                if (!UploadSink::parseSyncPolicy(value, policy))
+                    throw std::runtime_error("Error: upload_fsync expects 'off', 'on' or 'full', got '" + value + "'");
+                location.setUploadSync(policy);
+            }
+            else if (name == "upload_direct")
+                location.setUploadDirect(onOff(directive) == "on");
+            else if (name == "static_pack")
+            {
+                const std::string& value = singleValue(directive);
+                StaticPack::load(value);
+                location.setStaticPack(value);
+            }
+            else if (name == "client_max_body_size")
+                location.setClientMaxBodySize(std::strtoul(singleValue(directive).c_str(), NULL, 10));
+            else if (name == "proxy_pass")
+            {
+                const std::string& value = singleValue(directive);
+                if (value.find("http://") != 0 || value.size() == 7)
+                    throw std::runtime_error("Error: proxy_pass expects http://<upstream or host:port>, got '" + value + "'");
+                location.setProxyPass(value.substr(7));
+            }
+            else if (name == "methods")
+                location.setAllowedMethods(directive.value());
+            else
+                throw std::runtime_error("Error: Unknown directive in location block: '" + name + "'");
+        }
+        catch (const std::runtime_error& e)
+        {
+            throw std::runtime_error(directive.where() + ": " + e.what());
         }
-
-        pos = end + 1;
     }
 }
 
 void ServerConfig::clear()
 {
     _ports.clear();
+    _listens.clear();
     _root.clear();
     _index.clear();
     _error_pages.clear();
     _locations.clear();
     _serverName.clear();
+    _serverNames.clear();
     _host.clear();
     _clientMaxBodySize = 0;
+    _mimeTypes.clear();
 }
 
 void ServerConfig::print() const
@@ -287,17 +358,20 @@ void ServerConfig::print() const
     std::cout << "               Config                   " << std::endl;
     std::cout << "----------------------------------------" << std::endl;
 
-    std::cout << "Ports: ";
-    for (size_t i = 0; i < _ports.size(); ++i)
+    std::cout << "Listen: ";
+    for (size_t i = 0; i < _listens.size(); ++i)
     {
         if (i > 0) std::cout << ", ";
-        std::cout << _ports[i];
+        std::cout << _listens[i].address();
     }
     std::cout << std::endl;
 
     std::cout << "Root: " << _root << std::endl;
     std::cout << "Index: " << _index << std::endl;
-    std::cout << "Server Name: " << _serverName << std::endl;
+    std::cout << "Server Name: ";
+    for (size_t i = 0; i < _serverNames.size(); ++i)
+        std::cout << (i ? " " : "") << _serverNames[i];
+    std::cout << std::endl;
     std::cout << "Host: " << _host << std::endl;
     std::cout << "Client Max Body Size: " << _clientMaxBodySize << std::endl;
 
@@ -3,7 +3,9 @@
 #include <sstream>
 #include <algorithm>
 
-ServerLocation::ServerLocation(const std::string& path) : _path(path), _root(""), _index(""), _getAllowed(true), _postAllowed(true), _deleteAllowed(true)
+ServerLocation::ServerLocation(const std::string& path) : _path(path), _root(""), _index(""), _getAllowed(true), _postAllowed(true), _deleteAllowed(true),
+    _autoindex(false), _autoindexFormat(DirectoryIndex::HTML), _uploadSync(UploadSink::SYNC_OFF), _uploadDirect(false),
+    _hasClientMaxBodySize(false), _clientMaxBodySize(0)
 {
     if (path.empty())
         throw std::runtime_error("Error: Path cannot be empty in location block");
@@ -76,6 +78,103 @@ bool ServerLocation::isDeleteAllowed() const
     return _deleteAllowed;
 }
 
+bool ServerLocation::isMethodAllowed(const std::string& method) const
+{
+    if (method == "GET" || method == "HEAD")
+        return _getAllowed;
+    if (method == "POST")
+        return _postAllowed;
+    if (method == "DELETE")
+        return _deleteAllowed;
+    return true;
+}
+
+void ServerLocation::setProxyPass(const std::string& target)
+{
+    _proxyPass = target;
+}
+
+const std::string& ServerLocation::getProxyPass() const
+{
+    return _proxyPass;
+}
+
+void ServerLocation::setAutoindex(bool enabled)
+{
+    _autoindex = enabled;
+}
+
+bool ServerLocation::getAutoindex() const
+{
+    return _autoindex;
+}
+
+void ServerLocation::setAutoindexFormat(DirectoryIndex::Format format)
+{
+    _autoindexFormat = format;
+}
+
+DirectoryIndex::Format ServerLocation::getAutoindexFormat() const
+{
+    return _autoindexFormat;
+}
+
+void ServerLocation::setUploadStore(const std::string& directory)
+{
+    _uploadStore = directory;
+}
+
+const std::string& ServerLocation::getUploadStore() const
+{
+    return _uploadStore;
+}
+
+void ServerLocation::setUploadSync(UploadSink::SyncPolicy policy)
+{
+    _uploadSync = policy;
+}
+
+UploadSink::SyncPolicy ServerLocation::getUploadSync() const
+{
+    return _uploadSync;
+}
+
+void ServerLocation::setUploadDirect(bool enabled)
+{
+    _uploadDirect = enabled;
+}
+
+bool ServerLocation::getUploadDirect() const
+{
+    return _uploadDirect;
+}
+
+void ServerLocation::setStaticPack(const std::string& path)
+{
+    _staticPack = path;
+}
+
+const std::string& ServerLocation::getStaticPack() const
+{
+    return _staticPack;
+}
+
+void ServerLocation::setClientMaxBodySize(size_t size)
+{
+    _hasClientMaxBodySize = true;
+    _clientMaxBodySize = size;
+}
+
+bool ServerLocation::hasClientMaxBodySize() const
+{
+    return _hasClientMaxBodySize;
+}
+
+size_t ServerLocation::getClientMaxBodySize() const
+{
+    return _clientMaxBodySize;
+}
+
 void ServerLocation::setAllowedMethods(const std::string& methodsLine)
 {
     _getAllowed = false;
@@ -105,6 +204,20 @@ void ServerLocation::display() const
     std::cout << "root : " << _root << std::endl;
 
     std::cout << "index : " << _index << std::endl;
+    if (!_proxyPass.empty())
+        std::cout << "proxy_pass : " << _proxyPass << std::endl;
+    if (_autoindex)
+        std::cout << "autoindex : on (" << (_autoindexFormat == DirectoryIndex::JSON ? "json" : "html") << ")" << std::endl;
+    if (!_uploadStore.empty())
+    {
+        static const char* policies[] = { "off", "on", "full" };
+        std::cout << "upload_store : " << _uploadStore << " (fsync " << policies[_uploadSync]
+                  << (_uploadDirect ? ", direct" : "") << ")" << std::endl;
+    }
+    if (!_staticPack.empty())
+        std::cout << "static_pack : " << _staticPack << std::endl;
+    if (_hasClientMaxBodySize)
+        std::cout << "client_max_body_size : " << _clientMaxBodySize << std::endl;
 
     std::cout << "Allowed Methods:\n";
     std::cout << "  GET: " << (_getAllowed ? "Yes" : "No") << std::endl;
@@ -0,0 +1,187 @@
+#include "StaticPack.hpp"
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+const char StaticPack::MAGIC[8] = { 'W', 'S', 'P', 'A', 'C', 'K', '0', '1' };
+
+StaticPack::StaticPack() : _data(NULL), _size(0), _device(0), _inode(0), _mtime(0), _entries(NULL)
+{
+    std::memset(&_header, 0, sizeof(_header));
+}
+
+StaticPack::~StaticPack()
+{
+    if (_data)
+        munmap(const_cast<char*>(_data), _size);
+}
+
+// FNV-1a with the seed folded into the offset basis, then a final mix so
+// the low bits are usable with a modulo.
+uint32_t StaticPack::hash(uint32_t seed, const char* data, size_t length)
+{
+    uint32_t value = 2166136261u ^ (seed * 0x9e3779b9u);
+    for (size_t i = 0; i < length; ++i)
+    {
+        value ^= static_cast<unsigned char>(data[i]);
+        value *= 16777619u;
+    }
+    value ^= value >> 16;
+    value *= 0x85ebca6bu;
+    value ^= value >> 13;
+    return value;
+}
+
+size_t StaticPack::tableOffset(uint32_t bucketCount, uint32_t slotCount)
+{
+    size_t offset = sizeof(Header) + 4 * (static_cast<size_t>(bucketCount) + slotCount);
+    return (offset + 7) & ~static_cast<size_t>(7);
+}
+
+std::map<std::string, StaticPack*>& StaticPack::registry()
+{
+    static std::map<std::string, StaticPack*> packs;
+    return packs;
+}
+
+// Called for every static_pack directive, so a reload picks up a rebuilt
+// pack and leaves an unchanged one mapped. Requests never keep a pointer
+// into a pack past the response they build, so the old mapping can go.
+void StaticPack::load(const std::string& path)
+{
+    std::map<std::string, StaticPack*>& packs = registry();
+    std::map<std::string, StaticPack*>::iterator it = packs.find(path);
+    struct stat info;
+    if (it != packs.end() && stat(path.c_str(), &info) == 0 && info.st_dev == it->second->_device
+        && info.st_ino == it->second->_inode && info.st_mtime == it->second->_mtime
+        && static_cast<size_t>(info.st_size) == it->second->_size)
+        return;
+
+    StaticPack* pack = new StaticPack();
+    try {
+        pack->map(path);
+    }
+    catch (...) {
+        delete pack;
+        throw;
+    }
+    if (it != packs.end())
+    {
+        delete it->second;
+        it->second = pack;
+    }
+    else
+        packs[path] = pack;
+}
+
+const StaticPack* StaticPack::find(const std::string& path)
+{
+    std::map<std::string, StaticPack*>::const_iterator it = registry().find(path);
+    return it == registry().end() ? NULL : it->second;
+}
+
+// Every offset in the file is checked here once, so lookup() can trust
+// the tables.
+void StaticPack::map(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("Error: cannot open static pack '" + path + "'");
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(Header))
+    {
+        close(fd);
+        throw std::runtime_error("Error: '" + path + "' is not a static pack");
+    }
+    _size = static_cast<size_t>(info.st_size);
+    _device = info.st_dev;
+    _inode = info.st_ino;
+    _mtime = info.st_mtime;
+    void* mapped = mmap(NULL, _size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        throw std::runtime_error("Error: cannot map static pack '" + path + "'");
+    _data = static_cast<const char*>(mapped);
+    madvise(mapped, _size, MADV_WILLNEED);
+
+    std::memcpy(&_header, _data, sizeof(Header));
+    const std::string bad = "Error: static pack '" + path + "' is corrupt or from another version";
+    if (std::memcmp(_header.magic, MAGIC, sizeof(MAGIC)) != 0 || _header.fileSize != _size
+        || (_header.entryCount > 0 && (_header.bucketCount == 0 || _header.slotCount < _header.entryCount)))
+        throw std::runtime_error(bad);
+    size_t table = tableOffset(_header.bucketCount, _header.slotCount);
+    if (!inBounds(table, static_cast<uint64_t>(_header.entryCount) * sizeof(Entry)))
+        throw std::runtime_error(bad);
+    _entries = _data + table;
+
+    size_t slots = sizeof(Header) + 4 * static_cast<size_t>(_header.bucketCount);
+    for (uint32_t i = 0; i < _header.slotCount; ++i)
+    {
+        uint32_t index = word(slots + 4 * static_cast<size_t>(i));
+        if (index != EMPTY_SLOT && index >= _header.entryCount)
+            throw std::runtime_error(bad);
+    }
+    for (uint32_t i = 0; i < _header.entryCount; ++i)
+    {
+        Entry entry;
+        std::memcpy(&entry, _entries + i * sizeof(Entry), sizeof(Entry));
+        if (!inBounds(entry.pathOffset, entry.pathLength) || !inBounds(entry.headOffset, entry.headLength)
+            || !inBounds(entry.gzipHeadOffset, entry.gzipHeadLength)
+            || !inBounds(entry.bodyOffset, entry.bodyLength) || !inBounds(entry.gzipOffset, entry.gzipLength))
+            throw std::runtime_error(bad);
+    }
+}
+
+uint32_t StaticPack::word(size_t offset) const
+{
+    uint32_t value;
+    std::memcpy(&value, _data + offset, sizeof(value));
+    return value;
+}
+
+bool StaticPack::inBounds(uint64_t offset, uint64_t length) const
+{
+    return offset <= _size && length <= _size - offset;
+}
+
+bool StaticPack::lookup(const char* uri, size_t length, bool gzip, Hit& hit) const
+{
+    if (_header.entryCount == 0)
+        return false;
+    size_t displacements = sizeof(Header);
+    uint32_t seed = word(displacements + 4 * static_cast<size_t>(hash(0, uri, length) % _header.bucketCount));
+    if (seed == 0)
+        return false;
+    size_t slots = displacements + 4 * static_cast<size_t>(_header.bucketCount);
+    uint32_t index = word(slots + 4 * static_cast<size_t>(hash(seed, uri, length) % _header.slotCount));
+    if (index == EMPTY_SLOT)
+        return false;
+
+    Entry entry;
+    std::memcpy(&entry, _entries + index * sizeof(Entry), sizeof(Entry));
+    if (entry.pathLength != length || std::memcmp(_data + entry.pathOffset, uri, length) != 0)
+        return false;
+    if (gzip && entry.gzipHeadLength > 0)
+    {
+        hit.head = _data + entry.gzipHeadOffset;
+        hit.headLength = entry.gzipHeadLength;
+        hit.body = _data + entry.gzipOffset;
+        hit.bodyLength = entry.gzipLength;
+    }
+    else
+    {
+        hit.head = _data + entry.headOffset;
+        hit.headLength = entry.headLength;
+        hit.body = _data + entry.bodyOffset;
+        hit.bodyLength = entry.bodyLength;
+    }
+    return true;
+}
+
+uint32_t StaticPack::size() const
+{
+    return _header.entryCount;
+}
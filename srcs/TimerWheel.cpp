@@ -0,0 +1,156 @@
+#include "TimerWheel.hpp"
+#include <ctime>
+
+TimerWheel::Timer::Timer() : fd(-1), kind(0), expires(0), prev(NULL), next(NULL)
+{
+}
+
+bool TimerWheel::Timer::isArmed() const
+{
+    return next != NULL;
+}
+
+TimerWheel::TimerWheel(unsigned long tickMs) : _tickMs(tickMs ? tickMs : 1), _current(nowMs() / _tickMs), _count(0)
+{
+    for (int level = 0; level < LEVELS; ++level)
+    {
+        for (int slot = 0; slot < SLOTS; ++slot)
+        {
+            _slots[level][slot].prev = &_slots[level][slot];
+            _slots[level][slot].next = &_slots[level][slot];
+        }
+    }
+}
+
+unsigned long TimerWheel::nowMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<unsigned long>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+void TimerWheel::link(Timer& head, Timer& timer)
+{
+    timer.prev = head.prev;
+    timer.next = &head;
+    head.prev->next = &timer;
+    head.prev = &timer;
+}
+
+void TimerWheel::unlink(Timer& timer)
+{
+    timer.prev->next = timer.next;
+    timer.next->prev = timer.prev;
+    timer.prev = NULL;
+    timer.next = NULL;
+}
+
+void TimerWheel::place(Timer& timer)
+{
+    unsigned long delta = timer.expires > _current ? timer.expires - _current : 0;
+    const unsigned long span = 1UL << (SLOT_BITS * LEVELS);
+
+    if (delta >= span)
+    {
+        timer.expires = _current + span - 1;
+        delta = span - 1;
+    }
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (1UL << (SLOT_BITS * (level + 1))))
+        ++level;
+    unsigned long slot = (timer.expires >> (SLOT_BITS * level)) & (SLOTS - 1);
+    if (level == 0 && delta == 0)
+        slot = (_current + 1) & (SLOTS - 1);
+    link(_slots[level][slot], timer);
+}
+
+void TimerWheel::arm(Timer& timer, unsigned long delayMs)
+{
+    if (timer.isArmed())
+        cancel(timer);
+    unsigned long ticks = (delayMs + _tickMs - 1) / _tickMs;
+    timer.expires = _current + (ticks ? ticks : 1);
+    place(timer);
+    ++_count;
+}
+
+void TimerWheel::cancel(Timer& timer)
+{
+    if (!timer.isArmed())
+        return;
+    unlink(timer);
+    --_count;
+}
+
+void TimerWheel::cascade(int level)
+{
+    Timer& head = _slots[level][(_current >> (SLOT_BITS * level)) & (SLOTS - 1)];
+    while (head.next != &head)
+    {
+        Timer* timer = head.next;
+        unlink(*timer);
+        place(*timer);
+    }
+}
+
+void TimerWheel::advance(std::vector<Timer*>& expired)
+{
+    unsigned long target = nowMs() / _tickMs;
+
+    if (_count == 0)
+    {
+        if (target > _current)
+            _current = target;
+        return;
+    }
+    while (_current < target)
+    {
+        ++_current;
+        if ((_current & (SLOTS - 1)) == 0)
+        {
+            if (((_current >> SLOT_BITS) & (SLOTS - 1)) == 0)
+                cascade(2);
+            cascade(1);
+        }
+        Timer& head = _slots[0][_current & (SLOTS - 1)];
+        while (head.next != &head)
+        {
+            Timer* timer = head.next;
+            unlink(*timer);
+            --_count;
+            expired.push_back(timer);
+        }
+        if (_count == 0)
+        {
+            _current = target;
+            break;
+        }
+    }
+}
+
+// Milliseconds until the next tick that has work to do (a level-0 slot
+// with timers, or the next cascade), or -1 when nothing is armed.
+int TimerWheel::nextTimeout() const
+{
+    if (_count == 0)
+        return -1;
+
+    unsigned long elapsed = nowMs() % _tickMs;
+    unsigned long ticks = SLOTS - (_current & (SLOTS - 1));
+    for (unsigned long i = 1; i < ticks; ++i)
+    {
+        const Timer& head = _slots[0][(_current + i) & (SLOTS - 1)];
+        if (head.next != &head)
+        {
+            ticks = i;
+            break;
+        }
+    }
+    unsigned long wait = ticks * _tickMs;
+    return static_cast<int>(wait > elapsed ? wait - elapsed : 0);
+}
+
+size_t TimerWheel::size() const
+{
+    return _count;
+}
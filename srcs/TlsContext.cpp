@@ -0,0 +1,167 @@
+#include "TlsContext.hpp"
+#include <stdexcept>
+#include <cerrno>
+#include <openssl/err.h>
+
+static const unsigned char ALPN_PROTOCOLS[] = "\x02h2\x08http/1.1";
+static int HTTP2_ENABLED;
+
+static int selectProtocol(SSL* ssl, const unsigned char** out, unsigned char* outlen,
+                          const unsigned char* in, unsigned int inlen, void*)
+{
+    const unsigned char* offered = ALPN_PROTOCOLS;
+    unsigned int offeredLength = sizeof(ALPN_PROTOCOLS) - 1;
+    if (!SSL_get_app_data(ssl))
+    {
+        offered += 3;
+        offeredLength -= 3;
+    }
+    if (SSL_select_next_proto(const_cast<unsigned char**>(out), outlen, offered, offeredLength, in, inlen) != OPENSSL_NPN_NEGOTIATED)
+        return SSL_TLSEXT_ERR_NOACK;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+TlsContext::TlsContext() : _ctx(NULL)
+{
+}
+
+TlsContext::TlsContext(const std::string& certificate, const std::string& key,
+                       size_t sessionCache, unsigned long sessionTimeout, bool sessionTickets) : _ctx(NULL)
+{
+    _ctx = SSL_CTX_new(TLS_server_method());
+    if (!_ctx)
+        throw std::runtime_error("Error: Failed to create TLS context: " + lastError());
+    SSL_CTX_set_min_proto_version(_ctx, TLS1_2_VERSION);
+    if (SSL_CTX_use_certificate_chain_file(_ctx, certificate.c_str()) != 1
+        || SSL_CTX_use_PrivateKey_file(_ctx, key.c_str(), SSL_FILETYPE_PEM) != 1
+        || SSL_CTX_check_private_key(_ctx) != 1)
+    {
+        std::string error = lastError();
+        SSL_CTX_free(_ctx);
+        _ctx = NULL;
+        throw std::runtime_error("Error: Cannot load certificate '" + certificate + "' / key '" + key + "': " + error);
+    }
+
+    // Partial writes let sendClientResponse() keep its buffer and resume
+    // after a short write, as it does for plain sockets.
+    SSL_CTX_set_mode(_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    SSL_CTX_set_options(_ctx, SSL_OP_IGNORE_UNEXPECTED_EOF | SSL_OP_NO_RENEGOTIATION);
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options(_ctx, SSL_OP_ENABLE_KTLS);
+#endif
+
+    static const unsigned char sessionContext[] = "webserv";
+    SSL_CTX_set_session_id_context(_ctx, sessionContext, sizeof(sessionContext) - 1);
+    SSL_CTX_set_alpn_select_cb(_ctx, selectProtocol, NULL);
+    if (sessionCache > 0)
+    {
+        SSL_CTX_set_session_cache_mode(_ctx, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(_ctx, sessionCache);
+    }
+    else
+        SSL_CTX_set_session_cache_mode(_ctx, SSL_SESS_CACHE_OFF);
+    SSL_CTX_set_timeout(_ctx, sessionTimeout / 1000);
+    if (!sessionTickets)
+    {
+        SSL_CTX_set_options(_ctx, SSL_OP_NO_TICKET);
+        SSL_CTX_set_num_tickets(_ctx, 0);
+    }
+}
+
+TlsContext::TlsContext(const TlsContext& other) : _ctx(other._ctx)
+{
+    if (_ctx)
+        SSL_CTX_up_ref(_ctx);
+}
+
+TlsContext& TlsContext::operator=(const TlsContext& other)
+{
+    if (other._ctx)
+        SSL_CTX_up_ref(other._ctx);
+    if (_ctx)
+        SSL_CTX_free(_ctx);
+    _ctx = other._ctx;
+    return *this;
+}
+
+TlsContext::~TlsContext()
+{
+    if (_ctx)
+        SSL_CTX_free(_ctx);
+}
+
+bool TlsContext::isValid() const
+{
+    return _ctx != NULL;
+}
+
+// The connection keeps its own reference on the SSL_CTX, so it survives a
+// reload that drops this context.
+SSL* TlsContext::accept(int fd, bool http2) const
+{
+    SSL* ssl = SSL_new(_ctx);
+    if (!ssl)
+        return NULL;
+    if (SSL_set_fd(ssl, fd) != 1)
+    {
+        SSL_free(ssl);
+        return NULL;
+    }
+    if (http2)
+        SSL_set_app_data(ssl, &HTTP2_ENABLED);
+    SSL_set_accept_state(ssl);
+    return ssl;
+}
+
+bool TlsContext::negotiatedHttp2(SSL* ssl)
+{
+    const unsigned char* protocol;
+    unsigned int length;
+    SSL_get0_alpn_selected(ssl, &protocol, &length);
+    return length == 2 && protocol[0] == 'h' && protocol[1] == '2';
+}
+
+ssize_t TlsContext::read(SSL* ssl, char* buffer, size_t length)
+{
+    ERR_clear_error();
+    int n = SSL_read(ssl, buffer, static_cast<int>(length));
+    if (n > 0)
+        return n;
+    int error = SSL_get_error(ssl, n);
+    if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (error == SSL_ERROR_ZERO_RETURN)
+        return 0;
+    errno = ECONNRESET;
+    return -1;
+}
+
+ssize_t TlsContext::write(SSL* ssl, const char* data, size_t length)
+{
+    ERR_clear_error();
+    int n = SSL_write(ssl, data, static_cast<int>(length));
+    if (n > 0)
+        return n;
+    int error = SSL_get_error(ssl, n);
+    if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    errno = EPIPE;
+    return -1;
+}
+
+std::string TlsContext::lastError()
+{
+    unsigned long code = ERR_get_error();
+    ERR_clear_error();
+    if (code == 0)
+        return "unknown error";
+    char buffer[256];
+    ERR_error_string_n(code, buffer, sizeof(buffer));
+    return buffer;
+}
@@ -0,0 +1,204 @@
+#include "UploadSink.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace
+{
+    const size_t kAlignment = 4096;
+    const size_t kDirectBuffer = 1024 * 1024;
+
+    UploadSink::Counters uploadCounters = { 0, 0, 0, 0, 0 };
+}
+
+UploadSink::UploadSink() : _fd(-1), _sync(SYNC_OFF), _direct(false), _buffer(NULL), _buffered(0), _written(0)
+{
+}
+
+UploadSink::~UploadSink()
+{
+    abort();
+}
+
+// A name is used as given or not at all: no path separators, nothing
+// hidden, so an upload can neither escape the store nor clash with the
+// temporary files.
+bool UploadSink::isValidName(const std::string& name)
+{
+    return !name.empty() && name[0] != '.' && name.size() <= 255
+        && name.find_first_of("/\\") == std::string::npos && name.find('\0') == std::string::npos;
+}
+
+bool UploadSink::parseSyncPolicy(const std::string& value, SyncPolicy& policy)
+{
+    if (value == "off")
+        policy = SYNC_OFF;
+    else if (value == "on")
+        policy = SYNC_FILE;
+    else if (value == "full")
+        policy = SYNC_FULL;
+    else
+        return false;
+    return true;
+}
+
+const UploadSink::Counters& UploadSink::counters()
+{
+    return uploadCounters;
+}
+
+// O_DIRECT is dropped silently where the filesystem refuses it (tmpfs).
+bool UploadSink::open(const std::string& directory, const std::string& name, size_t expected, SyncPolicy sync, bool direct)
+{
+    abort();
+    _directory = directory;
+    if (!_directory.empty() && _directory[_directory.size() - 1] == '/')
+        _directory.erase(_directory.size() - 1);
+    _finalPath = _directory + "/" + name;
+    _sync = sync;
+    _written = 0;
+    _buffered = 0;
+
+    std::vector<char> path(_directory.begin(), _directory.end());
+    const char suffix[] = "/.upload-XXXXXX";
+    path.insert(path.end(), suffix, suffix + sizeof(suffix));
+    _fd = mkostemp(&path[0], O_CLOEXEC);
+    if (_fd < 0)
+        return false;
+    _tempPath = &path[0];
+    fchmod(_fd, 0644);
+    ++uploadCounters.started;
+    ++uploadCounters.active;
+
+    if (expected > 0)
+        fallocate(_fd, FALLOC_FL_KEEP_SIZE, 0, expected);
+    _direct = direct && expected >= kAlignment
+        && fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_DIRECT) == 0;
+    if (_direct && posix_memalign(reinterpret_cast<void**>(&_buffer), kAlignment, kDirectBuffer) != 0)
+    {
+        _buffer = NULL;
+        _direct = false;
+        fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) & ~O_DIRECT);
+    }
+    return true;
+}
+
+bool UploadSink::writeAll(const char* data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t n = ::write(_fd, data, length);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+// Direct writes go out in whole aligned blocks; the unaligned tail of the
+// last one is written with O_DIRECT turned off.
+bool UploadSink::flushAligned(bool final)
+{
+    size_t aligned = _buffered - _buffered % kAlignment;
+    if (aligned > 0 && !writeAll(_buffer, aligned))
+        return false;
+    std::memmove(_buffer, _buffer + aligned, _buffered - aligned);
+    _buffered -= aligned;
+    if (final && _buffered > 0)
+    {
+        fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) & ~O_DIRECT);
+        if (!writeAll(_buffer, _buffered))
+            return false;
+        _buffered = 0;
+    }
+    return true;
+}
+
+bool UploadSink::write(const char* data, size_t length)
+{
+    if (_fd < 0)
+        return false;
+    _written += length;
+    uploadCounters.bytes += length;
+    if (!_direct)
+        return writeAll(data, length);
+    while (length > 0)
+    {
+        size_t chunk = std::min(length, kDirectBuffer - _buffered);
+        std::memcpy(_buffer + _buffered, data, chunk);
+        _buffered += chunk;
+        data += chunk;
+        length -= chunk;
+        if (_buffered == kDirectBuffer && !flushAligned(false))
+            return false;
+    }
+    return true;
+}
+
+// SYNC_FILE makes the data durable before the rename publishes it;
+// SYNC_FULL also syncs the directory so the rename itself survives a
+// crash.
+bool UploadSink::commit()
+{
+    if (_fd < 0)
+        return false;
+    bool ok = !_direct || flushAligned(true);
+    if (ok)
+        ok = ftruncate(_fd, _written) == 0;
+    if (ok && _sync != SYNC_OFF)
+        ok = (_sync == SYNC_FULL ? fsync(_fd) : fdatasync(_fd)) == 0;
+    ok = close(_fd) == 0 && ok;
+    _fd = -1;
+    if (ok)
+        ok = std::rename(_tempPath.c_str(), _finalPath.c_str()) == 0;
+    if (ok && _sync == SYNC_FULL)
+    {
+        int directory = ::open(_directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (directory >= 0)
+        {
+            fsync(directory);
+            close(directory);
+        }
+    }
+    if (!ok)
+    {
+        unlink(_tempPath.c_str());
+        ++uploadCounters.failed;
+    }
+    else
+        ++uploadCounters.completed;
+    --uploadCounters.active;
+    std::free(_buffer);
+    _buffer = NULL;
+    _tempPath.clear();
+    return ok;
+}
+
+void UploadSink::abort()
+{
+    if (_fd >= 0)
+    {
+        close(_fd);
+        _fd = -1;
+        unlink(_tempPath.c_str());
+        ++uploadCounters.failed;
+        --uploadCounters.active;
+    }
+    std::free(_buffer);
+    _buffer = NULL;
+    _tempPath.clear();
+}
+
+size_t UploadSink::written() const
+{
+    return _written;
+}
@@ -0,0 +1,313 @@
+#include "Upstream.hpp"
+#include "GlobalConfig.hpp"
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+namespace
+{
+    const int kVirtualNodes = 160;
+}
+
+UpstreamServer::UpstreamServer() : port(80), maxFails(1), failTimeout(10000)
+{
+}
+
+std::string UpstreamServer::address() const
+{
+    std::ostringstream oss;
+    if (host.find(':') != std::string::npos)
+        oss << "[" << host << "]:" << port;
+    else
+        oss << host << ":" << port;
+    return oss.str();
+}
+
+UpstreamConfig::UpstreamConfig() : balance(ROUND_ROBIN), keepalive(16)
+{
+}
+
+// "host[:port] [max_fails=N] [fail_timeout=T]", IPv6 addresses in brackets
+UpstreamServer UpstreamConfig::parseServer(const std::string& value)
+{
+    std::istringstream params(value);
+    std::string address;
+    std::string param;
+    UpstreamServer server;
+
+    params >> address;
+    size_t hostEnd = address.size();
+    size_t colon = std::string::npos;
+    if (!address.empty() && address[0] == '[')
+    {
+        hostEnd = address.find(']');
+        if (hostEnd == std::string::npos || (hostEnd + 1 < address.size() && address[hostEnd + 1] != ':'))
+            throw std::runtime_error("Error: Invalid upstream server '" + address + "'");
+        server.host = address.substr(1, hostEnd - 1);
+        if (hostEnd + 1 < address.size())
+            colon = hostEnd + 1;
+    }
+    else
+    {
+        colon = address.rfind(':');
+        server.host = address.substr(0, colon);
+    }
+    if (colon != std::string::npos)
+        server.port = std::atoi(address.c_str() + colon + 1);
+    if (server.host.empty() || server.port <= 0 || server.port > 65535)
+        throw std::runtime_error("Error: Invalid upstream server '" + address + "'");
+    while (params >> param)
+    {
+        if (param.find("max_fails=") == 0)
+            server.maxFails = std::atoi(param.c_str() + 10);
+        else if (param.find("fail_timeout=") == 0)
+            server.failTimeout = GlobalConfig::parseDuration(param.substr(13), "fail_timeout");
+        else
+            throw std::runtime_error("Error: Unknown upstream server parameter '" + param + "'");
+    }
+    return server;
+}
+
+void UpstreamConfig::parseBlock(const ConfigNode& block)
+{
+    for (size_t i = 0; i < block.children.size(); ++i)
+    {
+        const ConfigNode& directive = block.children[i];
+        std::string value = directive.value();
+
+        if (directive.block)
+            throw std::runtime_error(directive.where() + ": Error: Unexpected block '" + directive.name + "' in upstream block");
+        if (directive.name == "server")
+            servers.push_back(parseServer(value));
+        else if (directive.name == "balance")
+        {
+            if (value == "round_robin")
+                balance = ROUND_ROBIN;
+            else if (value == "least_conn")
+                balance = LEAST_CONN;
+            else if (value == "consistent_hash")
+                balance = CONSISTENT_HASH;
+            else
+                throw std::runtime_error(directive.where() + ": Error: Unknown balance method '" + value + "'");
+        }
+        else if (directive.name == "keepalive")
+            keepalive = std::strtoul(value.c_str(), NULL, 10);
+        else
+            throw std::runtime_error(directive.where() + ": Error: Unknown directive in upstream block: '" + directive.name + "'");
+    }
+    if (servers.empty())
+        throw std::runtime_error("Error: upstream '" + name + "' has no server");
+}
+
+Upstream::Upstream() : _balance(UpstreamConfig::ROUND_ROBIN), _keepalive(0), _next(0)
+{
+}
+
+Upstream::Upstream(const UpstreamConfig& config) : _name(config.name), _balance(config.balance), _keepalive(config.keepalive), _next(0)
+{
+    for (size_t i = 0; i < config.servers.size(); ++i)
+    {
+        Peer peer;
+        peer.server = config.servers[i];
+        peer.fails = 0;
+        peer.firstFailure = 0;
+        peer.downUntil = 0;
+        peer.active = 0;
+        resolve(peer);
+        _peers.push_back(peer);
+
+        for (int v = 0; v < kVirtualNodes; ++v)
+        {
+            std::ostringstream node;
+            node << peer.server.address() << "#" << v;
+            _ring.push_back(std::make_pair(hash(node.str()), i));
+        }
+    }
+    std::sort(_ring.begin(), _ring.end());
+}
+
+// Takes the first address the resolver returns, IPv4 or IPv6.
+void Upstream::resolve(Peer& peer)
+{
+    addrinfo hints;
+    addrinfo* result = NULL;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(peer.server.host.c_str(), NULL, &hints, &result) != 0 || !result)
+        throw std::runtime_error("Error: Cannot resolve upstream host '" + peer.server.host + "'");
+    std::memset(&peer.address, 0, sizeof(peer.address));
+    std::memcpy(&peer.address, result->ai_addr, result->ai_addrlen);
+    peer.addressLength = result->ai_addrlen;
+    freeaddrinfo(result);
+    if (peer.address.ss_family == AF_INET6)
+        reinterpret_cast<sockaddr_in6*>(&peer.address)->sin6_port = htons(peer.server.port);
+    else
+        reinterpret_cast<sockaddr_in*>(&peer.address)->sin_port = htons(peer.server.port);
+}
+
+const std::string& Upstream::getName() const
+{
+    return _name;
+}
+
+size_t Upstream::peerCount() const
+{
+    return _peers.size();
+}
+
+Upstream::Peer& Upstream::getPeer(size_t index)
+{
+    return _peers[index];
+}
+
+int Upstream::findPeer(const std::string& address) const
+{
+    for (size_t i = 0; i < _peers.size(); ++i)
+    {
+        if (_peers[i].server.address() == address)
+            return i;
+    }
+    return -1;
+}
+
+unsigned int Upstream::hash(const std::string& key)
+{
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < key.size(); ++i)
+    {
+        h ^= static_cast<unsigned char>(key[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+bool Upstream::isAvailable(size_t index, unsigned long now, const std::vector<int>& exclude) const
+{
+    if (std::find(exclude.begin(), exclude.end(), static_cast<int>(index)) != exclude.end())
+        return false;
+    return _peers[index].downUntil <= now;
+}
+
+// Returns -1 when every peer is either excluded (already tried for this
+// request) or marked down.
+int Upstream::selectPeer(const std::string& hashKey, unsigned long now, const std::vector<int>& exclude)
+{
+    if (_peers.empty())
+        return -1;
+
+    if (_balance == UpstreamConfig::CONSISTENT_HASH)
+    {
+        std::pair<unsigned int, size_t> key(hash(hashKey), 0);
+        size_t start = std::lower_bound(_ring.begin(), _ring.end(), key) - _ring.begin();
+        for (size_t n = 0; n < _ring.size(); ++n)
+        {
+            size_t index = _ring[(start + n) % _ring.size()].second;
+            if (isAvailable(index, now, exclude))
+                return index;
+        }
+        return -1;
+    }
+
+    int best = -1;
+    for (size_t n = 0; n < _peers.size(); ++n)
+    {
+        size_t index = (_next + n) % _peers.size();
+        if (!isAvailable(index, now, exclude))
+            continue;
+        if (_balance == UpstreamConfig::ROUND_ROBIN)
+        {
+            best = index;
+            break;
+        }
+        if (best < 0 || _peers[index].active < _peers[best].active)
+            best = index;
+    }
+    if (best >= 0)
+        _next = (best + 1) % _peers.size();
+    return best;
+}
+
+// Hands out a pooled keep-alive connection when one is still usable,
+// otherwise starts a non-blocking connect().
+int Upstream::connectPeer(size_t index, bool& reused)
+{
+    Peer& peer = _peers[index];
+    char probe;
+
+    while (!peer.idle.empty())
+    {
+        int fd = peer.idle.back();
+        peer.idle.pop_back();
+        ssize_t n = recv(fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            reused = true;
+            ++peer.active;
+            return fd;
+        }
+        close(fd);
+    }
+
+    reused = false;
+    int fd = socket(peer.address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, reinterpret_cast<sockaddr*>(&peer.address), peer.addressLength) < 0 && errno != EINPROGRESS)
+    {
+        close(fd);
+        return -1;
+    }
+    ++peer.active;
+    return fd;
+}
+
+void Upstream::releaseConnection(size_t index, int fd, bool reusable)
+{
+    Peer& peer = _peers[index];
+    if (peer.active > 0)
+        --peer.active;
+    if (reusable && peer.idle.size() < _keepalive)
+        peer.idle.push_back(fd);
+    else
+        close(fd);
+}
+
+void Upstream::reportFailure(size_t index, unsigned long now)
+{
+    Peer& peer = _peers[index];
+    if (peer.fails == 0 || now - peer.firstFailure > peer.server.failTimeout)
+    {
+        peer.fails = 0;
+        peer.firstFailure = now;
+    }
+    ++peer.fails;
+    if (peer.server.maxFails > 0 && peer.fails >= peer.server.maxFails)
+    {
+        peer.downUntil = now + peer.server.failTimeout;
+        peer.fails = 0;
+    }
+}
+
+void Upstream::reportSuccess(size_t index)
+{
+    _peers[index].fails = 0;
+}
+
+void Upstream::closeIdle()
+{
+    for (size_t i = 0; i < _peers.size(); ++i)
+    {
+        for (size_t j = 0; j < _peers[i].idle.size(); ++j)
+            close(_peers[i].idle[j]);
+        _peers[i].idle.clear();
+    }
+}
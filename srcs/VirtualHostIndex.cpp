@@ -0,0 +1,114 @@
+#include "VirtualHostIndex.hpp"
+#include <algorithm>
+
+// Walks down from the root, creating nodes as needed, one label at a
+// time from the end of the name.
+size_t VirtualHostIndex::nodeFor(const std::string& name)
+{
+    size_t node = 0;
+    size_t end = name.size();
+    while (end > 0)
+    {
+        size_t dot = name.rfind('.', end - 1);
+        size_t start = dot == std::string::npos ? 0 : dot + 1;
+        std::string label = name.substr(start, end - start);
+        std::map<std::string, size_t>::iterator child = _nodes[node].children.find(label);
+        if (child == _nodes[node].children.end())
+        {
+            _nodes.push_back(Node());
+            child = _nodes[node].children.insert(std::make_pair(label, _nodes.size() - 1)).first;
+        }
+        node = child->second;
+        end = dot == std::string::npos ? 0 : dot;
+    }
+    return node;
+}
+
+void VirtualHostIndex::build(const std::vector<ServerConfig>& configs)
+{
+    _nodes.assign(1, Node());
+    _ports.assign(configs.size(), std::vector<int>());
+    _addresses.clear();
+    _defaults.clear();
+
+    for (size_t i = 0; i < configs.size(); ++i)
+    {
+        const std::vector<std::string>& names = configs[i].getServerNames();
+        for (size_t j = 0; j < names.size(); ++j)
+        {
+            const std::string& name = names[j];
+            if (name.compare(0, 2, "*.") == 0)
+                _nodes[nodeFor(name.substr(2))].wildcard.push_back(i);
+            else if (name[0] == '.')
+            {
+                size_t node = nodeFor(name.substr(1));
+                _nodes[node].exact.push_back(i);
+                _nodes[node].wildcard.push_back(i);
+            }
+            else
+                _nodes[nodeFor(name)].exact.push_back(i);
+        }
+
+        const std::vector<ListenOptions>& listens = configs[i].getListens();
+        for (size_t j = 0; j < listens.size(); ++j)
+        {
+            if (listens[j].isUnix())
+                continue;
+            _ports[i].push_back(listens[j].port);
+            _addresses.insert(std::make_pair(std::make_pair(listens[j].host, listens[j].port), i));
+            _defaults.insert(std::make_pair(listens[j].port, i));
+        }
+        std::sort(_ports[i].begin(), _ports[i].end());
+    }
+}
+
+int VirtualHostIndex::pick(const std::vector<size_t>& candidates, int port) const
+{
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        const std::vector<int>& ports = _ports[candidates[i]];
+        if (std::binary_search(ports.begin(), ports.end(), port))
+            return static_cast<int>(candidates[i]);
+    }
+    return -1;
+}
+
+// host is expected in lower case, without port or trailing dot.
+int VirtualHostIndex::find(const std::string& host, int port) const
+{
+    int wildcard = -1;
+    size_t node = 0;
+    size_t end = host.size();
+    std::string label;
+    while (end > 0)
+    {
+        size_t dot = host.rfind('.', end - 1);
+        size_t start = dot == std::string::npos ? 0 : dot + 1;
+        label.assign(host, start, end - start);
+        std::map<std::string, size_t>::const_iterator child = _nodes[node].children.find(label);
+        if (child == _nodes[node].children.end())
+            break;
+        node = child->second;
+        end = dot == std::string::npos ? 0 : dot;
+        if (end == 0)
+        {
+            int exact = pick(_nodes[node].exact, port);
+            if (exact >= 0)
+                return exact;
+        }
+        else
+        {
+            int match = pick(_nodes[node].wildcard, port);
+            if (match >= 0)
+                wildcard = match;
+        }
+    }
+    if (wildcard >= 0)
+        return wildcard;
+
+    std::map<std::pair<std::string, int>, size_t>::const_iterator address = _addresses.find(std::make_pair(host, port));
+    if (address != _addresses.end())
+        return static_cast<int>(address->second);
+    std::map<int, size_t>::const_iterator fallback = _defaults.find(port);
+    return fallback == _defaults.end() ? -1 : static_cast<int>(fallback->second);
+}
@@ -2,14 +2,6 @@
 #include <csignal>
 #include "Server.hpp"
 
-Server* globalServerPointer = NULL;
-
-void signalHandlerWrapper(int signal)
-{
-    if (signal == SIGINT && globalServerPointer != NULL)
-        globalServerPointer->stop();
-}
-
 int main(int argc, char* argv[])
 {
     const char* configPath;
@@ -21,9 +13,15 @@ int main(int argc, char* argv[])
     try
     {
         Server server(configPath);
-        globalServerPointer = &server;
+        server.setBinaryPath(argv[0]);
 
-        std::signal(SIGINT, signalHandlerWrapper);
+        std::signal(SIGINT, Server::signalHandler);
+        std::signal(SIGHUP, Server::signalHandler);
+        std::signal(SIGTERM, Server::signalHandler);
+        std::signal(SIGQUIT, Server::signalHandler);
+        std::signal(SIGUSR2, Server::signalHandler);
+        std::signal(SIGCHLD, Server::signalHandler);
+        std::signal(SIGPIPE, SIG_IGN);
 
         server.run();
     }
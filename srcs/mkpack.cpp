@@ -0,0 +1,299 @@
+#include "StaticPack.hpp"
+#include "MimeTypes.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+// Builds a StaticPack from a directory: mkpack <root> <output.pack>.
+// Every regular file under root becomes an entry keyed by its URI, and
+// "dir/" is added for each directory holding an index.html. Files that
+// gzip shrinks by at least a tenth also get a compressed variant.
+namespace
+{
+    const size_t kMinGzipSize = 256;
+
+    struct File
+    {
+        std::string uri;
+        std::string path;
+        off_t       size;
+        time_t      mtime;
+    };
+
+    bool byUri(const File& a, const File& b)
+    {
+        return a.uri < b.uri;
+    }
+
+    bool endsWith(const std::string& name, const char* suffix)
+    {
+        size_t length = std::strlen(suffix);
+        return name.size() >= length && name.compare(name.size() - length, length, suffix) == 0;
+    }
+
+    // Scripts are run as CGI by the server, never sent as they are, and a
+    // pack does not pack itself.
+    void walk(const std::string& directory, const std::string& uri, std::vector<File>& files)
+    {
+        DIR* dir = opendir(directory.c_str());
+        if (!dir)
+            throw std::runtime_error("cannot read directory '" + directory + "': " + std::strerror(errno));
+        std::vector<std::string> names;
+        while (struct dirent* entry = readdir(dir))
+        {
+            std::string name = entry->d_name;
+            if (name[0] != '.' && !endsWith(name, ".pack") && !endsWith(name, ".py"))
+                names.push_back(name);
+        }
+        closedir(dir);
+
+        for (size_t i = 0; i < names.size(); ++i)
+        {
+            std::string path = directory + "/" + names[i];
+            struct stat info;
+            if (stat(path.c_str(), &info) != 0)
+                continue;
+            if (S_ISDIR(info.st_mode))
+                walk(path, uri + names[i] + "/", files);
+            else if (S_ISREG(info.st_mode))
+            {
+                File file;
+                file.uri = uri + names[i];
+                file.path = path;
+                file.size = info.st_size;
+                file.mtime = info.st_mtime;
+                files.push_back(file);
+            }
+        }
+    }
+
+    std::string readAll(const std::string& path)
+    {
+        std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+        if (!in)
+            throw std::runtime_error("cannot read '" + path + "'");
+        std::ostringstream content;
+        content << in.rdbuf();
+        return content.str();
+    }
+
+    bool gzip(const std::string& data, std::string& out)
+    {
+        z_stream stream;
+        std::memset(&stream, 0, sizeof(stream));
+        if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+            return false;
+        out.resize(deflateBound(&stream, data.size()));
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+        stream.avail_in = data.size();
+        stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+        stream.avail_out = out.size();
+        int status = deflate(&stream, Z_FINISH);
+        out.resize(stream.total_out);
+        deflateEnd(&stream);
+        return status == Z_STREAM_END;
+    }
+
+    std::string httpDate(time_t when)
+    {
+        char buffer[64];
+        std::strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", std::gmtime(&when));
+        return buffer;
+    }
+
+    std::string head(size_t length, const char* type, const std::string& modified, const std::string& etag, const char* extra)
+    {
+        std::ostringstream out;
+        out << "HTTP/1.1 200 OK\r\n"
+            << "Content-Length: " << length << "\r\n"
+            << "Content-Type: " << type << "\r\n"
+            << "Last-Modified: " << modified << "\r\n"
+            << "ETag: \"" << etag << "\"\r\n"
+            << extra;
+        return out.str();
+    }
+
+    // Hash and displace: keys are split into buckets by hash(0); the
+    // fullest buckets go first and each gets the first seed that sends
+    // all of its keys to free slots.
+    void perfectHash(const std::vector<std::string>& keys, std::vector<uint32_t>& displacements, std::vector<uint32_t>& slots)
+    {
+        uint32_t bucketCount = keys.size() / 4 + 1;
+        uint32_t slotCount = keys.size() + keys.size() / 4 + 1;
+        std::vector<std::vector<uint32_t> > buckets(bucketCount);
+        for (uint32_t i = 0; i < keys.size(); ++i)
+            buckets[StaticPack::hash(0, keys[i].data(), keys[i].size()) % bucketCount].push_back(i);
+
+        std::vector<std::pair<size_t, uint32_t> > order;
+        for (uint32_t b = 0; b < bucketCount; ++b)
+            if (!buckets[b].empty())
+                order.push_back(std::make_pair(buckets[b].size(), b));
+        std::sort(order.rbegin(), order.rend());
+
+        displacements.assign(bucketCount, 0);
+        slots.assign(slotCount, StaticPack::EMPTY_SLOT);
+        std::vector<uint32_t> placed;
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            const std::vector<uint32_t>& bucket = buckets[order[i].second];
+            for (uint32_t seed = 1; ; ++seed)
+            {
+                if (seed == (1u << 24))
+                    throw std::runtime_error("no perfect hash found");
+                placed.clear();
+                for (size_t k = 0; k < bucket.size(); ++k)
+                {
+                    const std::string& key = keys[bucket[k]];
+                    uint32_t slot = StaticPack::hash(seed, key.data(), key.size()) % slotCount;
+                    if (slots[slot] != StaticPack::EMPTY_SLOT || std::find(placed.begin(), placed.end(), slot) != placed.end())
+                        break;
+                    placed.push_back(slot);
+                }
+                if (placed.size() != bucket.size())
+                    continue;
+                for (size_t k = 0; k < bucket.size(); ++k)
+                    slots[placed[k]] = bucket[k];
+                displacements[order[i].second] = seed;
+                break;
+            }
+        }
+    }
+
+    void build(const std::string& root, const std::string& output)
+    {
+        std::vector<File> files;
+        walk(root, "/", files);
+        std::sort(files.begin(), files.end(), byUri);
+
+        std::vector<std::string> keys;
+        std::vector<StaticPack::Entry> entries;
+        std::string blob;
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            const File& file = files[i];
+            std::string body = readAll(file.path);
+            std::string compressed;
+            bool hasGzip = body.size() >= kMinGzipSize && gzip(body, compressed)
+                && compressed.size() <= body.size() - body.size() / 10;
+            const char* type = MimeTypes::fromPath(file.path.data(), file.path.size());
+            std::string modified = httpDate(file.mtime);
+            std::ostringstream etag;
+            etag << std::hex << file.mtime << "-" << file.size;
+
+            StaticPack::Entry entry;
+            std::memset(&entry, 0, sizeof(entry));
+            std::string plain = head(body.size(), type, modified, etag.str(), hasGzip ? "Vary: Accept-Encoding\r\n" : "");
+            entry.headOffset = blob.size();
+            entry.headLength = plain.size();
+            blob += plain;
+            entry.bodyOffset = blob.size();
+            entry.bodyLength = body.size();
+            blob += body;
+            if (hasGzip)
+            {
+                std::string zipped = head(compressed.size(), type, modified, etag.str() + "-gz",
+                    "Content-Encoding: gzip\r\nVary: Accept-Encoding\r\n");
+                entry.gzipHeadOffset = blob.size();
+                entry.gzipHeadLength = zipped.size();
+                blob += zipped;
+                entry.gzipOffset = blob.size();
+                entry.gzipLength = compressed.size();
+                blob += compressed;
+            }
+            keys.push_back(file.uri);
+            entries.push_back(entry);
+
+            const std::string index = "index.html";
+            if (file.uri.size() >= index.size() && file.uri.compare(file.uri.size() - index.size(), index.size(), index) == 0
+                && file.uri[file.uri.size() - index.size() - 1] == '/')
+            {
+                keys.push_back(file.uri.substr(0, file.uri.size() - index.size()));
+                entries.push_back(entry);
+            }
+        }
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            entries[i].pathOffset = blob.size();
+            entries[i].pathLength = keys[i].size();
+            blob += keys[i];
+        }
+
+        std::vector<uint32_t> displacements;
+        std::vector<uint32_t> slots;
+        perfectHash(keys, displacements, slots);
+
+        StaticPack::Header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, StaticPack::MAGIC, sizeof(header.magic));
+        header.entryCount = entries.size();
+        header.bucketCount = displacements.size();
+        header.slotCount = slots.size();
+        size_t table = StaticPack::tableOffset(header.bucketCount, header.slotCount);
+        size_t data = table + entries.size() * sizeof(StaticPack::Entry);
+        header.fileSize = data + blob.size();
+        if (header.fileSize > 0xffffffffu)
+            throw std::runtime_error("a pack is limited to 4 GiB");
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            entries[i].pathOffset += data;
+            entries[i].headOffset += data;
+            entries[i].bodyOffset += data;
+            if (entries[i].gzipHeadLength > 0)
+            {
+                entries[i].gzipHeadOffset += data;
+                entries[i].gzipOffset += data;
+            }
+        }
+
+        std::string temp = output + ".tmp";
+        std::ofstream out(temp.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(&displacements[0]), displacements.size() * sizeof(uint32_t));
+        out.write(reinterpret_cast<const char*>(&slots[0]), slots.size() * sizeof(uint32_t));
+        out.write("\0\0\0\0\0\0\0", table - sizeof(header) - 4 * (displacements.size() + slots.size()));
+        if (!entries.empty())
+            out.write(reinterpret_cast<const char*>(&entries[0]), entries.size() * sizeof(StaticPack::Entry));
+        out.write(blob.data(), blob.size());
+        out.close();
+        if (!out || std::rename(temp.c_str(), output.c_str()) != 0)
+        {
+            std::remove(temp.c_str());
+            throw std::runtime_error("cannot write '" + output + "'");
+        }
+        std::cout << output << ": " << files.size() << " files, " << keys.size() << " URIs, "
+                  << header.fileSize << " bytes" << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <document root> <output.pack>" << std::endl;
+        return 1;
+    }
+    try
+    {
+        std::string root = argv[1];
+        while (root.size() > 1 && root[root.size() - 1] == '/')
+            root.erase(root.size() - 1);
+        build(root, argv[2]);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << argv[0] << ": " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include "Server.hpp"
+#include "HttpRequest.hpp"
+
+// Scheme and listening port of the client's connection, so http and
+// https, or two ports serving the same Host, never share entries. A
+// Unix-domain listener has no port and is told apart by its socket.
+std::string Server::cacheScope(int client_fd)
+{
+    int connection = connectionFd(client_fd);
+    std::string scope = _tlsClients.count(connection) ? "https:" : "http:";
+    std::map<int, int>::const_iterator port = _clientPorts.find(connection);
+    if (port != _clientPorts.end() && port->second >= 0)
+        return scope + intToString(port->second);
+    return scope + "unix" + intToString(_clientToServer[connection]);
+}
+
+void Server::storeResponse(const HttpRequest& request, const std::string& scope, const std::string& response)
+{
+    size_t headerEnd = response.find("\r\n\r\n");
+    if (headerEnd == std::string::npos)
+        return;
+    _cache.store(request, scope, response.substr(0, headerEnd + 2), response.substr(headerEnd + 4));
+}
+
+// Called once the request filling key is done, whatever the outcome.
+// Waiters are replayed: they hit the entry if it was stored, otherwise
+// each goes to the backend on its own.
+void Server::releaseCacheWaiters(const std::string& key)
+{
+    if (key.empty())
+        return;
+    std::map<std::string, std::vector<std::pair<int, std::string> > >::iterator it = _cacheWaiters.find(key);
+    if (it == _cacheWaiters.end())
+        return;
+
+    std::vector<std::pair<int, std::string> > waiters;
+    waiters.swap(it->second);
+    _cacheWaiters.erase(it);
+    for (size_t i = 0; i < waiters.size(); ++i)
+    {
+        if (isClientAlive(waiters[i].first))
+            dispatchRequest(waiters[i].first, waiters[i].second, false);
+    }
+}
+
+void Server::forgetCacheWaiter(int client_fd)
+{
+    std::map<std::string, std::vector<std::pair<int, std::string> > >::iterator it;
+    for (it = _cacheWaiters.begin(); it != _cacheWaiters.end(); ++it)
+    {
+        std::vector<std::pair<int, std::string> >& waiters = it->second;
+        for (size_t i = 0; i < waiters.size(); ++i)
+        {
+            if (waiters[i].first == client_fd)
+            {
+                waiters.erase(waiters.begin() + i);
+                return;
+            }
+        }
+    }
+}
@@ -0,0 +1,228 @@
+#include "Server.hpp"
+#include "HttpRequest.hpp"
+#include <fcntl.h>
+
+CgiSession::CgiSession() : pid(-1), outputFd(-1), inputFd(-1), written(0), cacheable(false), outputDone(false), status(0)
+{
+}
+
+// Forks the script with its stdin/stdout on non-blocking pipes watched by
+// the main poll loop. A GET without credentials or cookies joins a run
+// already under way for the same listener, server block, script and URI
+// (query string included) instead, and receives the same response.
+void Server::startCGI(int client_fd, HttpRequest& request, const std::string& rawRequest, const ServerConfig& config)
+{
+    std::string flightKey;
+
+    if (request.getMethod() == "GET" && request.getHeaderValue("Authorization").empty() && request.getHeaderValue("Cookie").empty())
+    {
+        std::ostringstream key;
+        key << cacheScope(client_fd) << " " << static_cast<const void*>(&config) << " " << request.getCGIScript() << " " << request.getPath();
+        flightKey = key.str();
+        std::map<std::string, int>::iterator flight = _cgiFlights.find(flightKey);
+        if (flight != _cgiFlights.end())
+        {
+            _cgiSessions[flight->second].clients.push_back(client_fd);
+            _clientCgi[client_fd] = flight->second;
+            return;
+        }
+    }
+
+    int outputPipe[2];
+    int inputPipe[2];
+    try
+    {
+        request.createPipes(outputPipe, inputPipe);
+    }
+    catch (const std::exception& e)
+    {
+        logMessage("ERROR", e.what());
+        queueClientData(client_fd, request.generateDefaultErrorPage(500));
+        return;
+    }
+    for (int i = 0; i < 2; ++i)
+    {
+        fcntl(outputPipe[i], F_SETFD, FD_CLOEXEC);
+        fcntl(inputPipe[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    pid_t pid = fork();
+    if (pid == 0)
+        request.setupChildProcess(outputPipe, inputPipe, request.getCGIScript());
+    close(outputPipe[1]);
+    close(inputPipe[0]);
+    if (pid < 0)
+    {
+        close(outputPipe[0]);
+        close(inputPipe[1]);
+        logMessage("ERROR", "Fork failed for CGI " + request.getCGIScript());
+        queueClientData(client_fd, request.generateDefaultErrorPage(500));
+        return;
+    }
+    fcntl(outputPipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(inputPipe[1], F_SETFL, O_NONBLOCK);
+
+    CgiSession& session = _cgiSessions[outputPipe[0]];
+    session.pid = pid;
+    session.outputFd = outputPipe[0];
+    session.input = request.getBody();
+    session.rawRequest = rawRequest;
+    session.flightKey = flightKey;
+    session.clients.push_back(client_fd);
+    session.cacheable = _cache.isEnabled() && ResponseCache::isCacheableRequest(request);
+    if (session.cacheable)
+        session.cacheScope = cacheScope(client_fd);
+    if (session.input.empty())
+        close(inputPipe[1]);
+    else
+    {
+        session.inputFd = inputPipe[1];
+        _cgiInputs[inputPipe[1]] = outputPipe[0];
+        addToPoll(inputPipe[1], POLLOUT);
+    }
+    addToPoll(outputPipe[0], POLLIN);
+    if (!flightKey.empty())
+        _cgiFlights[flightKey] = outputPipe[0];
+    _clientCgi[client_fd] = outputPipe[0];
+    armClientTimer(outputPipe[0], TIMER_CGI);
+}
+
+void Server::handleCgiEvent(int index)
+{
+    int fd = _poll_fds[index].fd;
+
+    std::map<int, int>::iterator input = _cgiInputs.find(fd);
+    if (input != _cgiInputs.end())
+    {
+        CgiSession& session = _cgiSessions[input->second];
+        ssize_t n = write(fd, session.input.data() + session.written, session.input.size() - session.written);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (n > 0)
+            session.written += n;
+        if (n <= 0 || session.written == session.input.size())
+        {
+            releasePollSlot(index);
+            close(fd);
+            session.inputFd = -1;
+            _cgiInputs.erase(input);
+        }
+        return;
+    }
+
+    char buffer[16384];
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+    if (n > 0)
+    {
+        _cgiSessions[fd].output.append(buffer, n);
+        return;
+    }
+    // The pipe stays open until the script is reaped so that its number,
+    // which keys the session, is not reused in the meantime.
+    releasePollSlot(index);
+    _cgiSessions[fd].outputDone = true;
+    reapCgiSessions();
+}
+
+// Called once a script's output has ended and whenever a SIGCHLD arrives:
+// scripts that have exited are finished with their exit status. One that
+// keeps running after closing stdout is left to its cgi_timeout.
+void Server::reapCgiSessions()
+{
+    std::vector<int> exited;
+    for (std::map<int, CgiSession>::iterator it = _cgiSessions.begin(); it != _cgiSessions.end(); ++it)
+    {
+        if (it->second.outputDone && waitpid(it->second.pid, &it->second.status, WNOHANG) == it->second.pid)
+            exited.push_back(it->first);
+    }
+    for (size_t i = 0; i < exited.size(); ++i)
+        finishCgiSession(exited[i], false);
+}
+
+// Hands the response of a reaped script to every client attached to the
+// run; a script that failed (nonzero exit or killed by a signal) gives a
+// 502. aborted means it is killed: on timeout (504) or once no client is
+// left waiting for it.
+void Server::finishCgiSession(int outputFd, bool aborted)
+{
+    std::map<int, CgiSession>::iterator it = _cgiSessions.find(outputFd);
+    if (it == _cgiSessions.end())
+        return;
+    CgiSession session = it->second;
+    _cgiSessions.erase(it);
+
+    cancelClientTimer(outputFd);
+    _clientTimers.erase(outputFd);
+    int index = findPollIndex(outputFd);
+    if (index >= 0)
+        releasePollSlot(index);
+    close(outputFd);
+    if (session.inputFd >= 0)
+    {
+        index = findPollIndex(session.inputFd);
+        if (index >= 0)
+            releasePollSlot(index);
+        close(session.inputFd);
+        _cgiInputs.erase(session.inputFd);
+    }
+    if (aborted)
+    {
+        kill(session.pid, SIGKILL);
+        waitpid(session.pid, NULL, 0);
+    }
+    if (!session.flightKey.empty())
+        _cgiFlights.erase(session.flightKey);
+    for (size_t i = 0; i < session.clients.size(); ++i)
+        _clientCgi.erase(session.clients[i]);
+    if (session.clients.empty())
+        return;
+
+    HttpRequest request(session.rawRequest);
+    std::string response;
+    bool failed = !aborted && (!WIFEXITED(session.status) || WEXITSTATUS(session.status) != 0);
+    if (failed)
+    {
+        if (WIFSIGNALED(session.status))
+            logMessage("ERROR", "CGI " + request.getPath() + " killed by signal " + intToString(WTERMSIG(session.status)));
+        else
+            logMessage("ERROR", "CGI " + request.getPath() + " exited with status " + intToString(WEXITSTATUS(session.status)));
+    }
+    if (aborted || failed)
+    {
+        std::map<int, ServerConfig*>::iterator config = _socketToConfig.find(connectionFd(session.clients[0]));
+        int status = aborted ? 504 : 502;
+        response = config != _socketToConfig.end() && config->second ? request.findErrorPage(*config->second, status) : request.generateDefaultErrorPage(status);
+    }
+    else
+    {
+        response = request.constructCGIResponse(session.output);
+        if (session.cacheable)
+            storeResponse(request, session.cacheScope, response);
+    }
+
+    std::string shared;
+    if (session.clients.size() > 1)
+        shared = " shared by " + intToString(session.clients.size()) + " clients";
+    logMessage("INFO", request.getMethod() + " " + request.getPath() + " " + request.getHttpVersion() + "\" " + intToString(request.extractStatusCode(response)) + " " + intToString(response.size()) + " cgi" + shared);
+    for (size_t i = 0; i < session.clients.size(); ++i)
+    {
+        queueClientData(session.clients[i], response);
+        endClientResponse(session.clients[i]);
+    }
+}
+
+void Server::detachCgiClient(int client_fd)
+{
+    std::map<int, int>::iterator attached = _clientCgi.find(client_fd);
+    if (attached == _clientCgi.end())
+        return;
+    int outputFd = attached->second;
+    _clientCgi.erase(attached);
+
+    std::vector<int>& clients = _cgiSessions[outputFd].clients;
+    clients.erase(std::remove(clients.begin(), clients.end(), client_fd), clients.end());
+    if (clients.empty())
+        finishCgiSession(outputFd, true);
+}
@@ -0,0 +1,210 @@
+#include "Server.hpp"
+#include "HttpRequest.hpp"
+#include "ServerConfig.hpp"
+#include <climits>
+
+bool Server::isStreamHandle(int client_fd)
+{
+    return client_fd < -1;
+}
+
+int Server::connectionFd(int client_fd) const
+{
+    std::map<int, std::pair<int, unsigned int> >::const_iterator stream = _h2Streams.find(client_fd);
+    return stream == _h2Streams.end() ? client_fd : stream->second.first;
+}
+
+bool Server::isClientAlive(int client_fd) const
+{
+    if (isStreamHandle(client_fd))
+        return _h2Streams.find(client_fd) != _h2Streams.end();
+    return _clientToServer.find(client_fd) != _clientToServer.end();
+}
+
+// Entered with the client preface (h2c with prior knowledge), or with
+// nothing once ALPN picked "h2" during the TLS handshake.
+void Server::startHttp2(int clientIndex, const std::string& received)
+{
+    int client_fd = _poll_fds[clientIndex].fd;
+    clientBuffers.erase(client_fd);
+    _idleClients.erase(client_fd);
+
+    Http2Connection& connection = _h2Connections[client_fd];
+    if (_draining)
+        connection.goAway();
+    if (!received.empty() && !connection.feed(received.data(), received.size()))
+        _closeAfterSend.insert(client_fd);
+    dispatchHttp2Requests(client_fd);
+    flushHttp2(client_fd);
+}
+
+void Server::readHttp2(int clientIndex)
+{
+    int client_fd = _poll_fds[clientIndex].fd;
+    char buffer[16384];
+    ssize_t bytes_read = clientRecv(client_fd, buffer, sizeof(buffer));
+
+    if (bytes_read == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+    if (bytes_read <= 0)
+    {
+        removeClient(clientIndex);
+        return;
+    }
+    if (!_h2Connections[client_fd].feed(buffer, bytes_read))
+    {
+        logMessage("WARNING", "HTTP/2 protocol error from client " + intToString(client_fd));
+        _closeAfterSend.insert(client_fd);
+    }
+    dispatchHttp2Requests(client_fd);
+    flushHttp2(client_fd);
+}
+
+int Server::openStreamHandle(int client_fd, unsigned int stream)
+{
+    int handle = _nextStreamHandle;
+    _nextStreamHandle = handle == INT_MIN ? -2 : handle - 1;
+    _h2Streams[handle] = std::make_pair(client_fd, stream);
+    return handle;
+}
+
+// Streams reset by the client are detached from whatever serves them.
+// A request body is held to the client_max_body_size of its location
+// while it arrives, as for HTTP/1.1, and answered 413 once it goes over.
+// Each complete request then goes through dispatchRequest() like an
+// HTTP/1.1 one.
+void Server::dispatchHttp2Requests(int client_fd)
+{
+    Http2Connection& connection = _h2Connections[client_fd];
+    unsigned int stream;
+    std::string rawRequest;
+
+    while (connection.nextReset(stream))
+    {
+        for (std::map<int, std::pair<int, unsigned int> >::iterator it = _h2Streams.begin(); it != _h2Streams.end(); ++it)
+        {
+            if (it->second.first == client_fd && it->second.second == stream)
+            {
+                dropHttp2Stream(it->first);
+                break;
+            }
+        }
+    }
+    while (connection.nextRequestHead(stream, rawRequest))
+    {
+        HttpRequest head(rawRequest);
+        ServerConfig* config = resolveConfig(client_fd, head);
+        connection.limitBody(stream, config ? config->getClientMaxBodySize(head.getPath()) : static_cast<size_t>(-1));
+    }
+    while (connection.nextOversized(stream, rawRequest))
+    {
+        int handle = openStreamHandle(client_fd, stream);
+        HttpRequest head(rawRequest);
+        ServerConfig* config = resolveConfig(client_fd, head);
+        logMessage("WARNING", "Rejected HTTP/2 request from client " + intToString(client_fd) + " with 413, its body is over client_max_body_size");
+        queueClientData(handle, config ? head.findErrorPage(*config, 413) : head.generateDefaultErrorPage(413));
+        endClientResponse(handle);
+    }
+    while (connection.nextRequest(stream, rawRequest))
+    {
+        int handle = openStreamHandle(client_fd, stream);
+        if (!allowClientRequest(client_fd))
+        {
+            logMessage("WARNING", "Request rate limit exceeded for client " + intToString(client_fd));
+            queueClientData(handle, TOO_MANY_REQUESTS_RESPONSE);
+            endClientResponse(handle);
+            continue;
+        }
+        dispatchRequest(handle, rawRequest, true);
+    }
+}
+
+// Only asks for POLLOUT: closing is left to sendClientResponse(), as this
+// runs from inside the proxy and CGI handlers.
+void Server::flushHttp2(int client_fd)
+{
+    std::map<int, Http2Connection>::iterator connection = _h2Connections.find(client_fd);
+    int index = findPollIndex(client_fd);
+    if (connection == _h2Connections.end() || index < 0)
+        return;
+    if (connection->second.wantsWrite() || connection->second.isFinished() || _closeAfterSend.count(client_fd))
+    {
+        _poll_fds[index].events |= POLLOUT;
+        armClientTimer(client_fd, TIMER_SEND);
+    }
+    else if (connection->second.activeStreams() == 0)
+        armClientTimer(client_fd, TIMER_KEEPALIVE);
+    else if (connection->second.awaitingClient())
+        armClientTimer(client_fd, TIMER_BODY);
+    else
+        cancelClientTimer(client_fd);
+}
+
+// Everything queued is written.
+void Server::settleHttp2(int clientIndex)
+{
+    int client_fd = _poll_fds[clientIndex].fd;
+    if (_h2Connections[client_fd].isFinished() || _closeAfterSend.count(client_fd))
+    {
+        removeClient(clientIndex);
+        return;
+    }
+    flushHttp2(client_fd);
+}
+
+void Server::dropHttp2Stream(int handle)
+{
+    forgetCacheWaiter(handle);
+    detachCgiClient(handle);
+    std::map<int, int>::iterator proxied = _clientProxy.find(handle);
+    if (proxied != _clientProxy.end())
+        finishProxySession(proxied->second, false);
+    _closeAfterSend.erase(handle);
+    _h2Streams.erase(handle);
+}
+
+void Server::closeHttp2Streams(int client_fd)
+{
+    std::vector<int> handles;
+    for (std::map<int, std::pair<int, unsigned int> >::iterator it = _h2Streams.begin(); it != _h2Streams.end(); ++it)
+    {
+        if (it->second.first == client_fd)
+            handles.push_back(it->first);
+    }
+    for (size_t i = 0; i < handles.size(); ++i)
+        dropHttp2Stream(handles[i]);
+}
+
+// Called once whatever produced a client's response is done with it. For
+// a plain connection the response buffer already says it all; a stream
+// is ended (or reset, if its body came up short) and its handle retired.
+void Server::endClientResponse(int client_fd)
+{
+    std::map<int, std::pair<int, unsigned int> >::iterator stream = _h2Streams.find(client_fd);
+    if (stream == _h2Streams.end())
+        return;
+    int connectionFd = stream->second.first;
+    std::map<int, Http2Connection>::iterator connection = _h2Connections.find(connectionFd);
+    if (connection != _h2Connections.end())
+        connection->second.endResponse(stream->second.second);
+    _h2Streams.erase(stream);
+    flushHttp2(connectionFd);
+}
+
+void Server::abortClient(int client_fd)
+{
+    std::map<int, std::pair<int, unsigned int> >::iterator stream = _h2Streams.find(client_fd);
+    if (stream == _h2Streams.end())
+    {
+        int index = findPollIndex(client_fd);
+        if (index >= 0)
+            removeClient(index);
+        return;
+    }
+    int connectionFd = stream->second.first;
+    std::map<int, Http2Connection>::iterator connection = _h2Connections.find(connectionFd);
+    if (connection != _h2Connections.end())
+        connection->second.resetStream(stream->second.second);
+    _h2Streams.erase(stream);
+    flushHttp2(connectionFd);
+}
@@ -1,27 +1,113 @@
 #include "ServerConfig.hpp"
+#include "MimeTypes.hpp"
 #include <iostream>
+#include <arpa/inet.h>
 
 void ServerConfig::setPort(int serverPort)
 {
     _ports.push_back(serverPort);
 }
 
-void ServerConfig::setServerName(const std::string& name)
+// Names are matched case-insensitively. A wildcard may only stand for
+// leading labels: "*.example.com", or ".example.com" which also matches
+// example.com itself.
+void ServerConfig::addServerName(const std::string& name)
 {
-    _serverName = name;
+    std::string lowered = name;
+    std::transform(lowered.begin(), lowered.end(), lowered.begin(), ::tolower);
+    if (!lowered.empty() && lowered[lowered.size() - 1] == '.')
+        lowered.erase(lowered.size() - 1);
+    size_t star = lowered.find('*');
+    if (lowered.empty() || lowered == "." || (star != std::string::npos && (star != 0 || lowered.size() < 3 || lowered[1] != '.'
+        || lowered.find('*', 1) != std::string::npos)))
+        throw std::runtime_error("Error: Invalid server_name '" + name + "'");
+    if (_serverNames.empty())
+        _serverName = lowered;
+    _serverNames.push_back(lowered);
 }
 
-
 const std::string& ServerConfig::getServerName(void)
 { 
     return _serverName;
 }
 
+const std::vector<std::string>& ServerConfig::getServerNames() const
+{
+    return _serverNames;
+}
+
+bool ServerConfig::sharesServerName(const ServerConfig& other) const
+{
+    for (size_t i = 0; i < _serverNames.size(); ++i)
+    {
+        if (std::find(other._serverNames.begin(), other._serverNames.end(), _serverNames[i]) != other._serverNames.end())
+            return true;
+    }
+    return false;
+}
+
 const std::vector<int>& ServerConfig::getPorts() const
 {
     return _ports;
 }
 
+ListenOptions::ListenOptions() : port(80), ipv6only(true), backlog(511), ssl(false), http2(false),
+    deferred(false), fastopen(0), rcvbuf(0), sndbuf(0)
+{
+}
+
+bool ListenOptions::isUnix() const
+{
+    return !path.empty();
+}
+
+std::string ListenOptions::address() const
+{
+    if (isUnix())
+        return "unix:" + path;
+    std::ostringstream oss;
+    if (host.find(':') != std::string::npos)
+        oss << "[" << host << "]:" << port;
+    else
+        oss << host << ":" << port;
+    return oss.str();
+}
+
+const std::vector<ListenOptions>& ServerConfig::getListens() const
+{
+    return _listens;
+}
+
+bool ServerConfig::listensOn(const std::string& host, int port) const
+{
+    for (size_t i = 0; i < _listens.size(); ++i)
+    {
+        if (_listens[i].port == port && _listens[i].host == host && !_listens[i].isUnix())
+            return true;
+    }
+    return false;
+}
+
+bool ServerConfig::hasSslListener() const
+{
+    for (size_t i = 0; i < _listens.size(); ++i)
+    {
+        if (_listens[i].ssl)
+            return true;
+    }
+    return false;
+}
+
+const std::string& ServerConfig::getSslCertificate() const
+{
+    return _sslCertificate;
+}
+
+const std::string& ServerConfig::getSslCertificateKey() const
+{
+    return _sslCertificateKey;
+}
+
 void ServerConfig::setRoot(const std::string& rootPath)
 {
     _root = rootPath;
@@ -65,6 +151,91 @@ const std::vector<ServerLocation>& ServerConfig::getLocations() const
     return _locations;
 }
 
+// Proxied locations match by longest prefix so that a whole subtree can be
+// forwarded; other locations keep their exact-path matching.
+const ServerLocation* ServerConfig::findProxyLocation(const std::string& path) const
+{
+    const ServerLocation* best = NULL;
+
+    for (size_t i = 0; i < _locations.size(); ++i)
+    {
+        const std::string& prefix = _locations[i].getPath();
+        if (_locations[i].getProxyPass().empty() || path.compare(0, prefix.size(), prefix) != 0)
+            continue;
+        if (prefix[prefix.size() - 1] != '/' && path.size() > prefix.size() && path[prefix.size()] != '/' && path[prefix.size()] != '?')
+            continue;
+        if (!best || prefix.size() > best->getPath().size())
+            best = &_locations[i];
+    }
+    return best;
+}
+
+// Longest prefix match over all locations, on path segment boundaries.
+const ServerLocation* ServerConfig::findLocation(const std::string& path) const
+{
+    const ServerLocation* best = NULL;
+
+    for (size_t i = 0; i < _locations.size(); ++i)
+    {
+        const std::string& prefix = _locations[i].getPath();
+        if (path.compare(0, prefix.size(), prefix) != 0)
+            continue;
+        if (prefix[prefix.size() - 1] != '/' && path.size() > prefix.size() && path[prefix.size()] != '/' && path[prefix.size()] != '?')
+            continue;
+        if (!best || prefix.size() > best->getPath().size())
+            best = &_locations[i];
+    }
+    return best;
+}
+
+namespace
+{
+    struct MimeOverrideLess
+    {
+        bool operator()(const std::pair<std::string, std::string>& entry, const std::pair<const char*, size_t>& key) const
+        {
+            return MimeTypes::compareExtension(entry.first.data(), entry.first.size(), key.first, key.second) < 0;
+        }
+    };
+}
+
+void ServerConfig::addMimeType(const std::string& extension, const std::string& type)
+{
+    std::string ext = extension;
+    if (!ext.empty() && ext[0] == '.')
+        ext.erase(0, 1);
+    if (ext.empty())
+        throw std::runtime_error("Error: Empty extension in types block");
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+    std::pair<const char*, size_t> key(ext.data(), ext.size());
+    std::vector<std::pair<std::string, std::string> >::iterator it =
+        std::lower_bound(_mimeTypes.begin(), _mimeTypes.end(), key, MimeOverrideLess());
+    if (it != _mimeTypes.end() && it->first == ext)
+        it->second = type;
+    else
+        _mimeTypes.insert(it, std::make_pair(ext, type));
+}
+
+const char* ServerConfig::getMimeType(const std::string& filePath) const
+{
+    const char* extension;
+    size_t extLength;
+
+    if (!MimeTypes::extensionOf(filePath.data(), filePath.size(), extension, extLength))
+        return MimeTypes::defaultType();
+    if (!_mimeTypes.empty())
+    {
+        std::pair<const char*, size_t> key(extension, extLength);
+        std::vector<std::pair<std::string, std::string> >::const_iterator it =
+            std::lower_bound(_mimeTypes.begin(), _mimeTypes.end(), key, MimeOverrideLess());
+        if (it != _mimeTypes.end() && MimeTypes::compareExtension(it->first.data(), it->first.size(), extension, extLength) == 0)
+            return it->second.c_str();
+    }
+    const char* type = MimeTypes::lookup(extension, extLength);
+    return type ? type : MimeTypes::defaultType();
+}
+
 void ServerConfig::setHost(const std::string& host)
 {
     if (!isValidIP(host)) {
@@ -84,6 +255,15 @@ size_t ServerConfig::getClientMaxBodySize() const
     return _clientMaxBodySize;
 }
 
+// The limit of the location serving path, or the server's own.
+size_t ServerConfig::getClientMaxBodySize(const std::string& path) const
+{
+    const ServerLocation* location = findLocation(path);
+    if (location && location->hasClientMaxBodySize())
+        return location->getClientMaxBodySize();
+    return _clientMaxBodySize;
+}
+
 void ServerConfig::setClientMaxBodySize(size_t size)
 {
     _clientMaxBodySize = size;
@@ -91,6 +271,12 @@ void ServerConfig::setClientMaxBodySize(size_t size)
 
 bool ServerConfig::isValidIP(const std::string& ip) const
 {
+    if (ip.find(':') != std::string::npos)
+    {
+        in6_addr address;
+        return inet_pton(AF_INET6, ip.c_str(), &address) == 1;
+    }
+
     int segments = 0;  
     int value = 0;     
     int charCount = 0;
@@ -0,0 +1,555 @@
+#include "Server.hpp"
+#include "HttpRequest.hpp"
+#include <fcntl.h>
+#include <strings.h>
+
+ProxySession::ProxySession() : clientFd(-1), upstreamFd(-1), generation(0), connected(false), reused(false), sent(0),
+    headersDone(false), noBody(false), chunked(false), untilClose(false), keepAlive(true),
+    remaining(0), received(0), status(0), headRequest(false), safeMethod(false), complete(false)
+{
+}
+
+// Methods that can be sent again after a failure without side effects.
+static bool isSafeMethod(const std::string& method)
+{
+    return method == "GET" || method == "HEAD" || method == "OPTIONS" || method == "TRACE";
+}
+
+static bool isHopByHopHeader(const std::string& name)
+{
+    static const char* const hopByHop[] = {"connection", "keep-alive", "proxy-connection", "te", "upgrade", NULL};
+    std::string lower = name;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    for (size_t i = 0; hopByHop[i]; ++i)
+    {
+        if (lower == hopByHop[i])
+            return true;
+    }
+    return false;
+}
+
+// The lowercased header names a head's Connection headers list. Those
+// headers, like the hop-by-hop ones, apply to a single connection.
+static std::vector<std::string> connectionOptions(const std::string& head)
+{
+    std::vector<std::string> named;
+    std::istringstream scan(head);
+    std::string line;
+    while (std::getline(scan, line))
+    {
+        size_t colon = line.find(':');
+        if (colon == std::string::npos || colon != 10 || strncasecmp(line.c_str(), "connection", 10) != 0)
+            continue;
+        std::istringstream tokens(line.substr(colon + 1));
+        std::string token;
+        while (std::getline(tokens, token, ','))
+        {
+            token.erase(0, token.find_first_not_of(" \t"));
+            token.erase(token.find_last_not_of(" \t\r") + 1);
+            std::transform(token.begin(), token.end(), token.begin(), ::tolower);
+            if (!token.empty())
+                named.push_back(token);
+        }
+    }
+    return named;
+}
+
+static bool isConnectionOption(const std::string& name, const std::vector<std::string>& named)
+{
+    std::string lower = name;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    return std::find(named.begin(), named.end(), lower) != named.end();
+}
+
+// The upstream response head as the client gets it, without the headers
+// that only applied to the upstream connection. closing adds the client's
+// own "Connection: close" when the response is delimited by the close.
+static std::string clientResponseHead(const std::string& head, bool closing)
+{
+    std::vector<std::string> named = connectionOptions(head);
+    std::string line;
+    std::istringstream lines(head);
+    std::string result;
+    std::getline(lines, line);
+    result = line + "\n";
+    while (std::getline(lines, line))
+    {
+        size_t colon = line.find(':');
+        if (colon == std::string::npos)
+            continue;
+        std::string name = line.substr(0, colon);
+        if (isHopByHopHeader(name) || isConnectionOption(name, named))
+            continue;
+        result += line + "\n";
+    }
+    if (closing)
+        result += "Connection: close\r\n";
+    result += "\r\n";
+    return result;
+}
+
+// The body is not streamed: the request is dispatched only once it has
+// been received in full (bounded by client_max_body_size), and the head
+// and body sent upstream are built as a single string that is kept until
+// the response arrives, so a failed attempt can be resent to another peer.
+std::string Server::buildUpstreamRequest(const std::string& rawRequest, int client_fd, const std::string& upstreamHost)
+{
+    size_t headerEnd = rawRequest.find("\r\n\r\n");
+    size_t bodyStart = headerEnd == std::string::npos ? rawRequest.size() : headerEnd + 4;
+    std::string head = rawRequest.substr(0, headerEnd);
+    std::vector<std::string> named = connectionOptions(head);
+    std::istringstream lines(head);
+    std::string line;
+    std::string method, uri, version;
+    std::string forwardedFor;
+    bool hasHost = false;
+
+    std::getline(lines, line);
+    std::istringstream requestLine(line);
+    requestLine >> method >> uri >> version;
+
+    std::string upstreamRequest = method + " " + uri + " HTTP/1.1\r\n";
+    while (std::getline(lines, line))
+    {
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        size_t colon = line.find(':');
+        if (colon == std::string::npos)
+            continue;
+        std::string name = line.substr(0, colon);
+        if (isHopByHopHeader(name) || isConnectionOption(name, named))
+            continue;
+        if (strcasecmp(name.c_str(), "X-Forwarded-For") == 0)
+        {
+            std::string value = line.substr(colon + 1);
+            value.erase(0, value.find_first_not_of(" \t"));
+            value.erase(value.find_last_not_of(" \t") + 1);
+            if (!value.empty())
+                forwardedFor += (forwardedFor.empty() ? "" : ", ") + value;
+            continue;
+        }
+        if (strcasecmp(name.c_str(), "Host") == 0)
+            hasHost = true;
+        upstreamRequest += line + "\r\n";
+    }
+    if (!hasHost)
+        upstreamRequest += "Host: " + upstreamHost + "\r\n";
+
+    sockaddr_storage address;
+    socklen_t length = sizeof(address);
+    char ip[INET6_ADDRSTRLEN] = "";
+    if (getpeername(connectionFd(client_fd), (sockaddr*)&address, &length) == 0)
+    {
+        if (address.ss_family == AF_INET)
+            inet_ntop(AF_INET, &((sockaddr_in*)&address)->sin_addr, ip, sizeof(ip));
+        else if (address.ss_family == AF_INET6)
+            inet_ntop(AF_INET6, &((sockaddr_in6*)&address)->sin6_addr, ip, sizeof(ip));
+    }
+    if (ip[0])
+        forwardedFor += (forwardedFor.empty() ? "" : ", ") + std::string(ip);
+    if (!forwardedFor.empty())
+        upstreamRequest += "X-Forwarded-For: " + forwardedFor + "\r\n";
+    upstreamRequest += _tlsClients.count(connectionFd(client_fd)) ? "X-Forwarded-Proto: https\r\n" : "X-Forwarded-Proto: http\r\n";
+    upstreamRequest += "Connection: keep-alive\r\n\r\n";
+    upstreamRequest.reserve(upstreamRequest.size() + rawRequest.size() - bodyStart);
+    upstreamRequest.append(rawRequest, bodyStart, std::string::npos);
+    return upstreamRequest;
+}
+
+// cacheLeader is the cache key other clients are waiting on, if this
+// request is the one filling it.
+void Server::startProxy(int client_fd, HttpRequest& request, const std::string& rawRequest, const ServerLocation& location, ServerConfig& config, const std::string& cacheLeader)
+{
+    if (!location.isMethodAllowed(request.getMethod()))
+    {
+        queueClientData(client_fd, request.findErrorPage(config, 405));
+        return;
+    }
+
+    ProxySession session;
+    session.clientFd = client_fd;
+    session.upstream = location.getProxyPass();
+    session.generation = _generation;
+    session.hashKey = request.getPath();
+    session.headRequest = request.getMethod() == "HEAD";
+    session.safeMethod = isSafeMethod(request.getMethod());
+    session.request = buildUpstreamRequest(rawRequest, client_fd, session.upstream);
+    session.logLine = request.getMethod() + " " + request.getPath() + " " + request.getHttpVersion();
+    session.cacheLeader = cacheLeader;
+    if (_cache.isEnabled() && ResponseCache::isCacheableRequest(request))
+    {
+        session.cacheRequest = rawRequest;
+        session.cacheScope = cacheScope(client_fd);
+    }
+
+    if (!connectProxySession(session))
+    {
+        logMessage("ERROR", "No upstream available for " + session.upstream);
+        queueClientData(client_fd, request.generateDefaultErrorPage(502));
+        return;
+    }
+}
+
+// A session started before a reload stays on the upstream pools of its
+// own configuration generation.
+Upstream* Server::findUpstream(const ProxySession& session)
+{
+    std::map<std::string, Upstream>* upstreams = session.generation == _generation ? &_upstreams : NULL;
+    for (std::list<RetiredConfig>::iterator it = _retiredConfigs.begin(); !upstreams && it != _retiredConfigs.end(); ++it)
+    {
+        if (it->generation == session.generation)
+            upstreams = &it->upstreams;
+    }
+    if (!upstreams)
+        return NULL;
+    std::map<std::string, Upstream>::iterator upstream = upstreams->find(session.upstream);
+    return upstream == upstreams->end() ? NULL : &upstream->second;
+}
+
+// Picks a peer that has not failed for this request yet and starts (or
+// reuses) a connection to it. The session is registered on success.
+bool Server::connectProxySession(ProxySession& session)
+{
+    Upstream* upstream = findUpstream(session);
+    if (!upstream)
+        return false;
+
+    unsigned long now = TimerWheel::nowMs();
+    for (;;)
+    {
+        int peer = upstream->selectPeer(session.hashKey, now, session.tried);
+        if (peer < 0)
+            return false;
+
+        bool reused = false;
+        int fd = upstream->connectPeer(peer, reused);
+        session.tried.push_back(peer);
+        if (fd < 0)
+        {
+            upstream->reportFailure(peer, now);
+            continue;
+        }
+        session.peer = upstream->getPeer(peer).server.address();
+        session.upstreamFd = fd;
+        session.connected = reused;
+        session.reused = reused;
+        session.sent = 0;
+        if (reused)
+            session.tried.pop_back();
+
+        addToPoll(fd, POLLOUT);
+        _proxySessions[fd] = session;
+        _clientProxy[session.clientFd] = fd;
+        armClientTimer(fd, TIMER_PROXY, reused ? _global.getProxyReadTimeout() : _global.getProxyConnectTimeout());
+        return true;
+    }
+}
+
+void Server::queueClientData(int client_fd, const std::string& data)
+{
+    std::map<int, std::pair<int, unsigned int> >::iterator stream = _h2Streams.find(client_fd);
+    if (stream != _h2Streams.end())
+    {
+        std::map<int, Http2Connection>::iterator connection = _h2Connections.find(stream->second.first);
+        if (connection != _h2Connections.end())
+            connection->second.respond(stream->second.second, data.data(), data.size());
+        flushHttp2(stream->second.first);
+        return;
+    }
+    int index = findPollIndex(client_fd);
+    if (index < 0)
+        return;
+    responseBuffer[client_fd] += data;
+    _poll_fds[index].events |= POLLOUT;
+    armClientTimer(client_fd, TIMER_SEND);
+}
+
+void Server::handleUpstreamEvent(int index)
+{
+    int fd = _poll_fds[index].fd;
+    short revents = _poll_fds[index].revents;
+    ProxySession& session = _proxySessions[fd];
+
+    if (!session.connected)
+    {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0)
+        {
+            logMessage("WARNING", "Connection to upstream " + session.peer + " failed: " + std::strerror(error));
+            failProxySession(fd, 502, true);
+            return;
+        }
+        if (!(revents & POLLOUT))
+            return;
+        session.connected = true;
+        armClientTimer(fd, TIMER_PROXY, _global.getProxyReadTimeout());
+    }
+
+    if ((revents & POLLOUT) && session.sent < session.request.size())
+    {
+        ssize_t n = send(fd, session.request.data() + session.sent, session.request.size() - session.sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (n <= 0)
+        {
+            failProxySession(fd, 502, true);
+            return;
+        }
+        session.sent += n;
+        armClientTimer(fd, TIMER_PROXY, _global.getProxyReadTimeout());
+        if (session.sent == session.request.size())
+            _poll_fds[index].events = POLLIN;
+        return;
+    }
+
+    if (revents & (POLLIN | POLLHUP | POLLERR))
+    {
+        char buffer[16384];
+        ssize_t n = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (n > 0)
+        {
+            armClientTimer(fd, TIMER_PROXY, _global.getProxyReadTimeout());
+            onUpstreamData(session, buffer, n);
+            return;
+        }
+        if (session.received == 0)
+        {
+            failProxySession(fd, 502, true);
+            return;
+        }
+        if (session.headersDone && session.untilClose)
+        {
+            session.complete = true;
+            _closeAfterSend.insert(session.clientFd);
+            finishProxySession(fd, false);
+            return;
+        }
+        logMessage("ERROR", "Upstream " + session.peer + " closed the connection mid-response");
+        _closeAfterSend.insert(session.clientFd);
+        finishProxySession(fd, false);
+    }
+}
+
+void Server::parseUpstreamHead(ProxySession& session)
+{
+    std::istringstream lines(session.head);
+    std::string line;
+    std::string version;
+
+    std::getline(lines, line);
+    std::istringstream statusLine(line);
+    statusLine >> version >> session.status;
+    if (version == "HTTP/1.0")
+        session.keepAlive = false;
+
+    bool hasLength = false;
+    while (std::getline(lines, line))
+    {
+        size_t colon = line.find(':');
+        if (colon == std::string::npos)
+            continue;
+        std::string name = line.substr(0, colon);
+        std::string value = line.substr(colon + 1);
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        value.erase(0, value.find_first_not_of(" \t"));
+        value.erase(value.find_last_not_of(" \t\r") + 1);
+
+        if (name == "content-length")
+        {
+            hasLength = true;
+            session.remaining = std::strtoul(value.c_str(), NULL, 10);
+        }
+        else if (name == "transfer-encoding" && value.find("chunked") != std::string::npos)
+            session.chunked = true;
+        else if (name == "connection")
+        {
+            if (value.find("close") != std::string::npos)
+                session.keepAlive = false;
+            else if (value.find("keep-alive") != std::string::npos)
+                session.keepAlive = true;
+        }
+    }
+    session.noBody = session.headRequest || session.status == 204 || session.status == 304 || (session.status >= 100 && session.status < 200);
+    if (session.chunked)
+        hasLength = false;
+    session.untilClose = !session.noBody && !session.chunked && !hasLength;
+}
+
+// Upstream bytes are forwarded to the client as they arrive; the framing
+// is only tracked to know when the upstream connection can be reused.
+void Server::onUpstreamData(ProxySession& session, const char* data, size_t length)
+{
+    int upstreamFd = session.upstreamFd;
+
+    if (session.received == 0)
+    {
+        Upstream* upstream = findUpstream(session);
+        int peer = upstream ? upstream->findPeer(session.peer) : -1;
+        if (peer >= 0)
+            upstream->reportSuccess(peer);
+    }
+    session.received += length;
+
+    size_t offset = 0;
+    if (!session.headersDone)
+    {
+        size_t previous = session.head.size();
+        session.head.append(data, length);
+        size_t end = session.head.find("\r\n\r\n");
+        if (end == std::string::npos)
+            return;
+        session.head.erase(end + 4);
+        offset = session.head.size() - previous;
+        session.headersDone = true;
+        parseUpstreamHead(session);
+        queueClientData(session.clientFd, clientResponseHead(session.head, session.untilClose));
+        if (!session.cacheRequest.empty() && (session.noBody || ResponseCache::freshnessLifetime(session.head, std::time(NULL)) <= 0))
+            session.cacheRequest.clear();
+    }
+
+    if (offset < length)
+        queueClientData(session.clientFd, std::string(data + offset, length - offset));
+    std::string* cacheBody = session.cacheRequest.empty() ? NULL : &session.cacheBody;
+
+    bool complete = false;
+    if (session.noBody)
+        complete = true;
+    else if (session.chunked)
+    {
+        session.chunkParser.feed(data + offset, length - offset, cacheBody);
+        complete = session.chunkParser.isDone() || session.chunkParser.hasError();
+        if (session.chunkParser.hasError())
+            session.keepAlive = false;
+    }
+    else if (!session.untilClose)
+    {
+        size_t body = length - offset;
+        if (body > session.remaining)
+            body = session.remaining;
+        if (cacheBody)
+            cacheBody->append(data + offset, body);
+        session.remaining -= body;
+        complete = session.remaining == 0;
+    }
+    else if (cacheBody)
+        cacheBody->append(data + offset, length - offset);
+    if (cacheBody && cacheBody->size() > _cache.maxObjectSize())
+    {
+        session.cacheRequest.clear();
+        session.cacheBody.clear();
+    }
+    if (complete)
+    {
+        session.complete = !session.chunkParser.hasError();
+        finishProxySession(upstreamFd, session.keepAlive);
+    }
+}
+
+// Retries on another peer (or a fresh connection when a pooled one turned
+// out to be stale) as long as nothing was sent to the client yet. Once
+// request bytes reached an upstream, only safe methods are retried: a
+// POST or PUT that failed mid-way may already have been applied.
+void Server::failProxySession(int upstreamFd, int status, bool retry)
+{
+    std::map<int, ProxySession>::iterator it = _proxySessions.find(upstreamFd);
+    if (it == _proxySessions.end())
+        return;
+
+    ProxySession session = it->second;
+    Upstream* upstream = findUpstream(session);
+    int peer = upstream ? upstream->findPeer(session.peer) : -1;
+    if (peer >= 0 && !session.reused)
+        upstream->reportFailure(peer, TimerWheel::nowMs());
+    it->second.cacheLeader.clear();
+    finishProxySession(upstreamFd, false);
+
+    if (session.received > 0)
+    {
+        releaseCacheWaiters(session.cacheLeader);
+        logMessage("ERROR", "Upstream " + session.peer + " failed mid-response, closing client " + intToString(session.clientFd));
+        if (isStreamHandle(session.clientFd))
+            return;
+        _closeAfterSend.insert(session.clientFd);
+        if (responseBuffer.find(session.clientFd) == responseBuffer.end())
+        {
+            int index = findPollIndex(session.clientFd);
+            if (index >= 0)
+                removeClient(index);
+        }
+        return;
+    }
+    if (isClientAlive(session.clientFd) && retry && (session.sent == 0 || session.safeMethod))
+    {
+        session.upstreamFd = -1;
+        session.connected = false;
+        session.sent = 0;
+        if (connectProxySession(session))
+            return;
+    }
+    releaseCacheWaiters(session.cacheLeader);
+    if (!isClientAlive(session.clientFd))
+        return;
+    logMessage("ERROR", "Proxy to " + session.upstream + " failed with " + intToString(status) + " for client " + intToString(session.clientFd));
+    HttpRequest errorRequest("");
+    queueClientData(session.clientFd, errorRequest.generateDefaultErrorPage(status));
+    endClientResponse(session.clientFd);
+}
+
+void Server::finishProxySession(int upstreamFd, bool reusable)
+{
+    std::map<int, ProxySession>::iterator it = _proxySessions.find(upstreamFd);
+    if (it == _proxySessions.end())
+        return;
+    ProxySession& session = it->second;
+    int client_fd = session.clientFd;
+
+    cancelClientTimer(upstreamFd);
+    _clientTimers.erase(upstreamFd);
+    int index = findPollIndex(upstreamFd);
+    if (index >= 0)
+        releasePollSlot(index);
+
+    Upstream* upstream = findUpstream(session);
+    int peer = upstream ? upstream->findPeer(session.peer) : -1;
+    if (peer >= 0)
+        upstream->releaseConnection(peer, upstreamFd, reusable);
+    else
+        close(upstreamFd);
+
+    if (session.status)
+        logMessage("INFO", session.logLine + "\" " + intToString(session.status) + " " + intToString(session.received) + " upstream " + session.peer);
+    if (session.complete && !session.cacheRequest.empty())
+        _cache.store(HttpRequest(session.cacheRequest), session.cacheScope, session.head, session.cacheBody);
+    std::string cacheLeader = session.cacheLeader;
+    size_t received = session.received;
+    _clientProxy.erase(client_fd);
+    _proxySessions.erase(it);
+    releaseCacheWaiters(cacheLeader);
+
+    // With nothing received, failProxySession() retries or answers itself.
+    if (isStreamHandle(client_fd))
+    {
+        _closeAfterSend.erase(client_fd);
+        if (received > 0)
+            endClientResponse(client_fd);
+        return;
+    }
+
+    if (_clientToServer.find(client_fd) == _clientToServer.end() || responseBuffer.find(client_fd) != responseBuffer.end())
+        return;
+    int clientIndex = findPollIndex(client_fd);
+    if (clientIndex < 0)
+        return;
+    setCork(client_fd, false);
+    if (_draining || _closeAfterSend.count(client_fd))
+        removeClient(clientIndex);
+    else
+    {
+        _idleClients.insert(client_fd);
+        armClientTimer(client_fd, TIMER_KEEPALIVE);
+    }
+}
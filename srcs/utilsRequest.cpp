@@ -1,10 +1,9 @@
 #include "HttpRequest.hpp"
+#include <strings.h>
 
 std::string HttpRequest::intToString(int value)
 {
-    std::ostringstream oss;
-    oss << value;
-    return oss.str();
+    return HttpFormat::toString(value);
 }
 
 std::string HttpRequest::resolveFilePath(const ServerConfig& config)
@@ -14,7 +13,7 @@ std::string HttpRequest::resolveFilePath(const ServerConfig& config)
     const std::vector<ServerLocation>& locations = config.getLocations();
     for (std::vector<ServerLocation>::const_iterator it = locations.begin(); it != locations.end(); ++it)
     {
-        if (this->_path == it->getPath())
+        if (this->_path == it->getPath() && !it->getRoot().empty())
         {
             fullPath = it->getRoot() + it->getIndex();
             locationFound = true;
@@ -37,72 +36,93 @@ std::string HttpRequest::resolveFilePath(const ServerConfig& config)
 
 bool HttpRequest::isFileAccessible(const std::string& filePath)
 {
-    struct stat fileStat;
-    if (stat(filePath.c_str(), &fileStat) != 0)
-        return false;
-    if (access(filePath.c_str(), R_OK) != 0)
-        return false;
-    return true;
+    OpenFileCache::Info info;
+    return OpenFileCache::stat(filePath, info) && info.readable;
 }
 
 std::string HttpRequest::readFile(const std::string& filePath)
 {
-    std::ifstream file(filePath.c_str(), std::ios::binary);
-    if (!file.is_open())
+    std::string content;
+    if (!OpenFileCache::read(filePath, content))
         return "";
-    file.seekg(0, std::ios::end);
-    std::streamsize size = file.tellg();
-    file.seekg(0, std::ios::beg);
-
-    if (size > 0 && size < std::numeric_limits<std::streamsize>::max())
-    {
-        std::vector<char> buffer(static_cast<size_t>(size));
-        if (file.read(buffer.data(), size))
-            return std::string(buffer.data(), size);
-    }
-    return "";
+    return content;
 }
 
-std::string HttpRequest::getMimeType(const std::string& filePath)
+const char* HttpRequest::getMimeType(const ServerConfig& config, const std::string& filePath)
 {
-    std::map<std::string, std::string> mimeTypes;
-    mimeTypes[".php"] = "text/html";
-    mimeTypes[".html"] = "text/html";
-    mimeTypes[".css"] = "text/css";
-    mimeTypes[".js"] = "application/javascript";
-    mimeTypes[".jpg"] = "image/jpeg";
-    mimeTypes[".jpeg"] = "image/jpeg";
-    mimeTypes[".png"] = "image/png";
-    mimeTypes[".gif"] = "image/gif";
-    mimeTypes[".svg"] = "image/svg+xml";
-    mimeTypes[".ico"] = "image/x-icon";
-    mimeTypes[".json"] = "application/json";
-    mimeTypes[".xml"] = "application/xml";
-    mimeTypes[".txt"] = "text/plain";
-    mimeTypes[".py"] = "text/html";
-    mimeTypes[".mp4"] = "video/mp4";
-
-    size_t dotPos = filePath.find_last_of('.');
-    if (dotPos != std::string::npos)
-    {
-        std::string extension = filePath.substr(dotPos);
-        if (mimeTypes.count(extension) > 0)
-            return mimeTypes[extension];
-    }
-
-    return "application/octet-stream";
+    return config.getMimeType(filePath);
 }
 
+// A script may start its output with CGI header lines ("Status:",
+// "Content-Type:", "Cache-Control:", ...) and a blank line; anything else
+// is sent as a text/html body.
 std::string HttpRequest::constructCGIResponse(const std::string& output)
 {
-    std::ostringstream oss;
-    oss << output.size();
+    std::string status = "200 OK";
+    std::string contentType = "text/html";
+    std::string headers;
+    std::string body = output;
+
+    size_t headerEnd = output.find("\n\n");
+    size_t separator = 2;
+    size_t crlfEnd = output.find("\r\n\r\n");
+    if (crlfEnd != std::string::npos && (headerEnd == std::string::npos || crlfEnd < headerEnd))
+    {
+        headerEnd = crlfEnd;
+        separator = 4;
+    }
+    if (headerEnd != std::string::npos)
+    {
+        std::istringstream lines(output.substr(0, headerEnd));
+        std::string line;
+        std::string parsed;
+        std::string parsedStatus = status;
+        std::string parsedType = contentType;
+        bool isHeaderBlock = true;
+        while (isHeaderBlock && std::getline(lines, line))
+        {
+            if (!line.empty() && line[line.size() - 1] == '\r')
+                line.erase(line.size() - 1);
+            size_t colon = line.find(':');
+            if (colon == 0 || colon == std::string::npos
+                || line.find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-") != colon)
+            {
+                isHeaderBlock = false;
+                break;
+            }
+            std::string name = line.substr(0, colon);
+            std::string value = line.substr(colon + 1);
+            value.erase(0, value.find_first_not_of(" \t"));
+            if (strcasecmp(name.c_str(), "Status") == 0)
+                parsedStatus = value;
+            else if (strcasecmp(name.c_str(), "Content-Type") == 0)
+                parsedType = value;
+            else if (strcasecmp(name.c_str(), "Content-Length") != 0)
+                parsed += name + ": " + value + "\r\n";
+        }
+        if (isHeaderBlock)
+        {
+            status = parsedStatus;
+            contentType = parsedType;
+            headers = parsed;
+            body = output.substr(headerEnd + separator);
+        }
+    }
 
-    std::string response = "HTTP/1.1 200 OK\r\n";
-    response += "Content-Length: " + oss.str() + "\r\n";
-    response += "Content-Type: text/html\r\n";
+    std::string response;
+    response.reserve(256 + headers.size() + body.size());
+    response += "HTTP/1.1 ";
+    response += status;
+    response += "\r\n";
+    response += HttpFormat::commonHeaders();
+    response += "Content-Length: ";
+    HttpFormat::appendUnsigned(response, body.size());
+    response += "\r\nContent-Type: ";
+    response += contentType;
+    response += "\r\n";
+    response += headers;
     response += "\r\n";
-    response += output;
+    response += body;
 
     return response;
 }
@@ -114,7 +134,7 @@ std::vector<char*> HttpRequest::setupCGIEnvironment(const std::string& scriptPat
     envVars.push_back("REQUEST_METHOD=" + _method);
     envVars.push_back("SCRIPT_FILENAME=" + scriptPath);
     envVars.push_back("CONTENT_LENGTH=" + intToString(_body.size()));
-    envVars.push_back("CONTENT_TYPE=" + _headers["Content-Type"]);
+    envVars.push_back("CONTENT_TYPE=" + getHeaderValue("Content-Type"));
     envVars.push_back("GATEWAY_INTERFACE=CGI/1.1");
     envVars.push_back("SERVER_PROTOCOL=HTTP/1.1");
     envVars.push_back("REDIRECT_STATUS=200");
@@ -151,70 +171,92 @@ std::string  HttpRequest::extractJsonValue(const std::string& json, const std::s
     return json.substr(valueStart, valueEnd - valueStart);
 }
 
-bool  HttpRequest::ensureUploadDirectoryExists()
+bool  HttpRequest::ensureUploadDirectoryExists(const std::string& directory)
 {
     struct stat info;
-    if (stat("var/www/upload", &info) != 0)
+    if (stat(directory.c_str(), &info) != 0)
     {
-        if (mkdir("var/www/upload", 0755) != 0)
+        if (mkdir(directory.c_str(), 0755) != 0)
             return false;
     }
-    else if (!(info.st_mode & S_IFDIR))
+    else if (!S_ISDIR(info.st_mode))
         return false;
     return true;
 }
 
-std::string HttpRequest::uploadTxt(ServerConfig& config, std::string response)
+// Stored in the upload_store of the location the request was sent to,
+// var/www/upload by default.
+std::string HttpRequest::storeUpload(ServerConfig& config, const std::string& fileName, const char* data, size_t length)
 {
-    std::string fileName = extractJsonValue(this->_body, "fileName");
-    std::string fileContent = extractJsonValue(this->_body, "fileContent");
-
-    if (fileName.empty() || fileContent.empty())
+    if (!UploadSink::isValidName(fileName))
         return findErrorPage(config, 400);
 
-    if (!ensureUploadDirectoryExists())
+    std::string directory = "var/www/upload";
+    UploadSink::SyncPolicy sync = UploadSink::SYNC_OFF;
+    bool direct = false;
+    const ServerLocation* location = config.findLocation(_path);
+    if (location)
+    {
+        if (!location->getUploadStore().empty())
+            directory = location->getUploadStore();
+        sync = location->getUploadSync();
+        direct = location->getUploadDirect();
+    }
+    if (!ensureUploadDirectoryExists(directory))
         return findErrorPage(config, 500);
 
-    std::string targetPath = "var/www/upload/" + fileName;
-    std::ofstream outFile(targetPath.c_str(), std::ios::binary);
-    if (!outFile.is_open())
+    UploadSink sink;
+    if (!sink.open(directory, fileName, length, sync, direct) || !sink.write(data, length) || !sink.commit())
         return findErrorPage(config, 500);
+    if (!directory.empty() && directory[directory.size() - 1] == '/')
+        directory.erase(directory.size() - 1);
+    OpenFileCache::invalidate(directory + "/" + fileName);
 
-    outFile.write(fileContent.c_str(), fileContent.size());
-    outFile.close();
-
-    response = "HTTP/1.1 201 Created\r\n";
+    std::string response = "HTTP/1.1 201 Created\r\n";
+    response += HttpFormat::commonHeaders();
     response += "Content-Length: 0\r\n";
     response += "Content-Type: text/plain\r\n";
     response += "\r\n";
     return response;
 }
 
-std::string HttpRequest::uploadFile(ServerConfig& config, std::string response, std::string contentType)
+std::string HttpRequest::uploadTxt(ServerConfig& config)
 {
-    std::string boundary = "--" + contentType.substr(contentType.find("boundary=") + 9);
+    std::string fileName = extractJsonValue(this->_body, "fileName");
+    std::string fileContent = extractJsonValue(this->_body, "fileContent");
+
+    if (fileName.empty() || fileContent.empty())
+        return findErrorPage(config, 400);
+    return storeUpload(config, fileName, fileContent.data(), fileContent.size());
+}
+
+std::string HttpRequest::uploadFile(ServerConfig& config, const std::string& contentType)
+{
+    size_t boundaryPos = contentType.find("boundary=");
+    if (boundaryPos == std::string::npos)
+        return findErrorPage(config, 400);
+    std::string boundary = contentType.substr(boundaryPos + 9);
+    boundary = boundary.substr(0, boundary.find_first_of("; \t\r"));
+    if (boundary.size() > 1 && boundary[0] == '"' && boundary[boundary.size() - 1] == '"')
+        boundary = boundary.substr(1, boundary.size() - 2);
+    if (boundary.empty())
+        return findErrorPage(config, 400);
+
     size_t fileStartPos = _body.find("filename=\"");
     if (fileStartPos == std::string::npos)
         return findErrorPage(config, 400);
-
     fileStartPos += 10;
     size_t fileNameEndPos = _body.find("\"", fileStartPos);
-    std::string fileName = _body.substr(fileStartPos, fileNameEndPos - fileStartPos);
-    size_t contentStart = _body.find("\r\n\r\n", fileNameEndPos) + 4;
-    size_t contentEnd = _body.find(boundary, contentStart) - 2;
-    std::string fileContent = _body.substr(contentStart, contentEnd - contentStart);
-    std::string targetPath = "var/www/upload/" + fileName;
-    std::ofstream outFile(targetPath.c_str(), std::ios::binary);
-    if (!outFile.is_open())
-        return findErrorPage(config, 500);
-    outFile.write(fileContent.c_str(), fileContent.size() - 46);
-    outFile.close();
+    size_t contentStart = _body.find("\r\n\r\n", fileNameEndPos);
+    if (fileNameEndPos == std::string::npos || contentStart == std::string::npos)
+        return findErrorPage(config, 400);
+    contentStart += 4;
+    size_t contentEnd = _body.find("\r\n--" + boundary, contentStart);
+    if (contentEnd == std::string::npos)
+        return findErrorPage(config, 400);
 
-    response = "HTTP/1.1 201 Created\r\n";
-    response += "Content-Length: 0\r\n";
-    response += "Content-Type: text/plain\r\n";
-    response += "\r\n";
-    return response;
+    std::string fileName = _body.substr(fileStartPos, fileNameEndPos - fileStartPos);
+    return storeUpload(config, fileName, _body.data() + contentStart, contentEnd - contentStart);
 }
 
 int HttpRequest::extractStatusCode(const std::string& response)
@@ -232,29 +274,38 @@ int HttpRequest::extractStatusCode(const std::string& response)
 
 std::string HttpRequest::generateDefaultErrorPage(int errorCode)
 {
-    std::ostringstream response;
-    response << "<html><body><h1>Error " << errorCode << "</h1></body></html>";
+    static const char prefix[] = "<html><body><h1>Error ";
+    static const char suffix[] = "</h1></body></html>";
+    char code[HttpFormat::MAX_DIGITS + 1];
+    size_t codeLength = HttpFormat::formatSigned(errorCode, code);
+
+    std::string response = "HTTP/1.1 ";
+    response.append(code, codeLength);
+    response += " Error\r\n";
+    response += HttpFormat::commonHeaders();
+    response += "Content-Type: text/html\r\nContent-Length: ";
+    HttpFormat::appendUnsigned(response, sizeof(prefix) - 1 + codeLength + sizeof(suffix) - 1);
+    response += "\r\n\r\n";
+    response += prefix;
+    response.append(code, codeLength);
+    response += suffix;
+    return response;
+}
 
-    std::ostringstream httpResponse;
-    httpResponse << "HTTP/1.1 " << errorCode << " Error\r\n";
-    httpResponse << "Content-Type: text/html\r\n";
-    httpResponse << "Content-Length: " << response.str().size() << "\r\n";
-    httpResponse << "\r\n";
-    httpResponse << response.str();
+std::string HttpRequest::getHeaderValue(const std::string& headerName) const
+{
+    const Header* header = findHeader(headerName.c_str());
+    return header ? std::string(header->value, header->valueLength) : "";
+}
 
-    return httpResponse.str();
+// The value in place, NUL-terminated, or NULL when the header is absent.
+const char* HttpRequest::headerValue(KnownHeader id) const
+{
+    return _known[id] ? _known[id]->value : NULL;
 }
 
-std::string HttpRequest::getHeaderValue(const std::string& headerName) const
+const char* HttpRequest::headerValue(const char* name) const
 {
-    std::map<std::string, std::string>::const_iterator it = _headers.find(headerName);
-    if (it != _headers.end())
-    {
-        std::string value = it->second;
-        if (!value.empty() && (value[value.size() - 1] == '\n' || value[value.size() - 1] == '\r')) {
-            value.erase(value.size() - 1);
-        }
-        return value;
-    }
-    return "";
+    const Header* header = findHeader(name);
+    return header ? header->value : NULL;
 }
@@ -1,10 +1,12 @@
 #include "Server.hpp"
 #include "HttpRequest.hpp"
 #include "ServerConfig.hpp"
+#include <fcntl.h>
 
-Server::Server(const std::string configFile) : running(false)
+Server::Server(const std::string configFile) : running(false), _configFile(configFile), _binaryPath("./webserv"), _generation(1), _draining(false), _drainDeadline(0), _upgradePid(-1), _nextStreamHandle(-2), _reserveFd(-1)
 {
     logMessage("INFO", "Initializing the server...");
+    _reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
     try
     {
         if (!parseConfigFile(configFile))
@@ -12,7 +14,14 @@ Server::Server(const std::string configFile) : running(false)
         validateServerConfigurations();
         if (_configs.empty())
             throw std::runtime_error("Failed to parse configuration file: 0 valid config");
+        _virtualHosts.build(_configs);
+        buildUpstreams(_upstreams);
+        buildTlsContexts(_tlsContexts);
+        applyGlobalConfig();
+        adoptInheritedListeners();
         initSockets();
+        openSignalPipe();
+        notifyUpgradeParent();
     }
     catch (const std::exception& e)
     {
@@ -30,16 +39,138 @@ Server::~Server()
 void Server::cleanup()
 {
     logMessage("INFO", "Cleaning up resources...");
+    for (std::map<std::string, Upstream>::iterator it = _upstreams.begin(); it != _upstreams.end(); ++it)
+        it->second.closeIdle();
     _configs.clear();
     cleanupSockets();
 }
 
+void Server::reloadConfiguration()
+{
+    logMessage("INFO", "Reloading configuration from " + _configFile + "...");
+
+    std::vector<ServerConfig> previousConfigs;
+    std::vector<ConfigNode> previousBlocks;
+    GlobalConfig previousGlobal = _global;
+    previousConfigs.swap(_configs);
+    previousBlocks.swap(serverBlocks);
+    _global = GlobalConfig();
+
+    std::map<std::string, Upstream> upstreams;
+    std::map<std::string, TlsContext> tlsContexts;
+    bool parsed = false;
+    try
+    {
+        parsed = parseConfigFile(_configFile);
+        if (parsed)
+        {
+            validateServerConfigurations();
+            buildUpstreams(upstreams);
+            buildTlsContexts(tlsContexts);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        logMessage("ERROR", e.what());
+        parsed = false;
+    }
+    if (!parsed || _configs.empty())
+    {
+        logMessage("ERROR", "Reload failed, keeping configuration generation " + intToString(_generation));
+        _configs.swap(previousConfigs);
+        serverBlocks.swap(previousBlocks);
+        _global = previousGlobal;
+        return;
+    }
+
+    for (std::map<std::string, Upstream>::iterator it = _upstreams.begin(); it != _upstreams.end(); ++it)
+        it->second.closeIdle();
+    _upstreams.swap(upstreams);
+    _tlsContexts.swap(tlsContexts);
+    _virtualHosts.build(_configs);
+    applyGlobalConfig();
+    initSockets();
+    for (std::map<int, int>::iterator it = _clientToServer.begin(); it != _clientToServer.end(); ++it)
+    {
+        std::map<int, ServerConfig*>::iterator listener = _socketToConfig.find(it->second);
+        if (listener != _socketToConfig.end())
+            _socketToConfig[it->first] = listener->second;
+        else
+            _socketToConfig.erase(it->first);
+    }
+    if (!_clientToServer.empty())
+    {
+        _retiredConfigs.push_back(RetiredConfig());
+        RetiredConfig& retired = _retiredConfigs.back();
+        retired.generation = _generation;
+        retired.configs.swap(previousConfigs);
+        retired.blocks.swap(previousBlocks);
+        retired.upstreams.swap(upstreams);
+        for (std::map<int, int>::iterator it = _clientToServer.begin(); it != _clientToServer.end(); ++it)
+            retired.clients.insert(it->first);
+    }
+    ++_generation;
+    logMessage("INFO", "Configuration generation " + intToString(_generation) + " loaded.");
+}
+
+void Server::releaseRetiredConfigs(int client_fd)
+{
+    std::list<RetiredConfig>::iterator it = _retiredConfigs.begin();
+    while (it != _retiredConfigs.end())
+    {
+        if (!it->clients.erase(client_fd) || !it->clients.empty())
+        {
+            ++it;
+            continue;
+        }
+        for (std::map<std::string, Upstream>::iterator upstream = it->upstreams.begin(); upstream != it->upstreams.end(); ++upstream)
+            upstream->second.closeIdle();
+        logMessage("INFO", "Configuration generation " + intToString(it->generation) + " released.");
+        it = _retiredConfigs.erase(it);
+    }
+}
+
+// Builds the runtime state of every upstream {} block, plus an implicit
+// single-server upstream for each "proxy_pass http://host:port".
+void Server::buildUpstreams(std::map<std::string, Upstream>& upstreams)
+{
+    const std::map<std::string, UpstreamConfig>& configured = _global.getUpstreams();
+    for (std::map<std::string, UpstreamConfig>::const_iterator it = configured.begin(); it != configured.end(); ++it)
+        upstreams[it->first] = Upstream(it->second);
+
+    for (size_t i = 0; i < _configs.size(); ++i)
+    {
+        const std::vector<ServerLocation>& locations = _configs[i].getLocations();
+        for (size_t j = 0; j < locations.size(); ++j)
+        {
+            const std::string& target = locations[j].getProxyPass();
+            if (target.empty() || upstreams.find(target) != upstreams.end())
+                continue;
+            if (target.find(':') == std::string::npos)
+                throw std::runtime_error("Unknown upstream '" + target + "' in proxy_pass");
+            UpstreamConfig implicit;
+            implicit.name = target;
+            implicit.servers.push_back(UpstreamConfig::parseServer(target));
+            upstreams[target] = Upstream(implicit);
+        }
+    }
+}
+
+void Server::applyGlobalConfig()
+{
+    _limiter.configure(_global.getLimitConnPerIp(), _global.getLimitReqRate(), _global.getLimitReqBurst());
+    if (!_cache.configure(_global.getCacheMemSize(), _global.getCachePath(), _global.getCacheMaxSize()))
+        logMessage("WARNING", "cache_path " + _global.getCachePath() + " is not usable, disk cache disabled");
+    OpenFileCache::configure(_global.getOpenFileCacheMax(), _global.getOpenFileCacheInactive(), _global.getOpenFileCacheValid());
+}
+
 bool Server::parseConfigFile(std::string configFile)
 {
     if (parseFileInBlock(configFile) == false)
         return false;
 
-    for (std::vector<std::string>::iterator it = serverBlocks.begin(); it != serverBlocks.end(); ++it)
+    _configs.reserve(_configs.size() + serverBlocks.size());
+    for (std::vector<ConfigNode>::iterator it = serverBlocks.begin(); it != serverBlocks.end(); ++it)
     {
         ServerConfig config;
         try
@@ -57,123 +188,115 @@ bool Server::parseConfigFile(std::string configFile)
     return !_configs.empty();
 }
 
+// Every (address, server_name) pair of every block is sorted once, so
+// conflicts sit next to each other. Blocks without a name sharing an
+// address are all dropped; for a name claimed twice on an address, the
+// first block keeps it and the later ones are dropped.
 void Server::validateServerConfigurations()
 {
+    std::vector<std::pair<std::pair<std::string, std::string>, size_t> > claims;
     for (size_t i = 0; i < _configs.size(); ++i)
     {
-        const std::string& host1 = _configs[i].getHost();
-        const std::vector<int>& ports1 = _configs[i].getPorts();
-        const std::string& serverName1 = _configs[i].getServerName();
-
-        bool shouldEraseI = false;  // Déclaration ici (en dehors de la boucle j)
-
-        for (size_t j = i + 1; j < _configs.size();)
+        const std::vector<ListenOptions>& listens = _configs[i].getListens();
+        const std::vector<std::string>& names = _configs[i].getServerNames();
+        for (size_t j = 0; j < listens.size(); ++j)
         {
-            const std::string& host2 = _configs[j].getHost();
-            const std::vector<int>& ports2 = _configs[j].getPorts();
-            const std::string& serverName2 = _configs[j].getServerName();
-
-            bool shouldEraseJ = false;
+            std::string address = listens[j].address();
+            if (names.empty())
+                claims.push_back(std::make_pair(std::make_pair(address, std::string()), i));
+            for (size_t k = 0; k < names.size(); ++k)
+                claims.push_back(std::make_pair(std::make_pair(address, names[k]), i));
+        }
+    }
+    std::sort(claims.begin(), claims.end());
 
-            for (size_t p1 = 0; p1 < ports1.size(); ++p1)
-            {
-                for (size_t p2 = 0; p2 < ports2.size(); ++p2)
-                {
-                    if (ports1[p1] == ports2[p2] && host1 == host2)
-                    {
-                        if (serverName1.empty() && serverName2.empty())
-                        {
-                            std::cout << "Multiple servers on the same host ("
-                                      << host1 << ") and port (" << intToString(ports1[p1])
-                                      << ") without server_name." << std::endl;
-                            shouldEraseI = true;
-                            shouldEraseJ = true;
-                        }
-                        else if (!serverName1.empty() && !serverName2.empty() && serverName1 == serverName2)
-                        {
-                            std::cout << "Duplicate server_name (" << serverName1
-                                      << ") on the same host (" << host1
-                                      << ") and port (" << intToString(ports1[p1]) << ")." << std::endl;
-                            shouldEraseJ = true;
-                        }
-                    }
-                }
-            }
-            if (shouldEraseJ)
+    std::vector<bool> dropped(_configs.size(), false);
+    for (size_t first = 0; first < claims.size();)
+    {
+        size_t last = first + 1;
+        while (last < claims.size() && claims[last].first == claims[first].first)
+            ++last;
+        const std::string& address = claims[first].first.first;
+        const std::string& name = claims[first].first.second;
+        for (size_t k = first + 1; k < last; ++k)
+        {
+            if (claims[k].second == claims[k - 1].second)
+                continue;
+            if (name.empty())
             {
-                _configs.erase(_configs.begin() + j);
-                continue;  // Ne pas incrémenter j, car l'élément suivant prend sa place
+                std::cout << "Multiple servers on the same address (" << address << ") without server_name." << std::endl;
+                dropped[claims[first].second] = true;
             }
-            ++j;  // Incrément si pas de suppression
-        }
-        if (shouldEraseI)
-        {
-            _configs.erase(_configs.begin() + i);
-            --i;  // Revenir en arrière car l'élément i a été supprimé
+            else
+                std::cout << "Duplicate server_name (" << name << ") on the same address (" << address << ")." << std::endl;
+            dropped[claims[k].second] = true;
         }
+        first = last;
     }
-}
-
-
 
+    size_t kept = 0;
+    for (size_t i = 0; i < _configs.size(); ++i)
+    {
+        if (dropped[i])
+            continue;
+        if (kept != i)
+            _configs[kept] = _configs[i];
+        ++kept;
+    }
+    _configs.resize(kept);
+}
 
 bool Server::parseFileInBlock(std::string configFile)
 {
-    std::ifstream file(configFile.c_str());
-    if (!file.is_open())
+    ConfigNode root;
+    try
+    {
+        if (ConfigParser::load(configFile, root))
+            logMessage("INFO", "Using compiled configuration for " + configFile);
+    }
+    catch (const std::exception& e)
     {
-        std::cerr << "Error: Unable to open config file: " << configFile << std::endl;
+        std::cerr << e.what() << std::endl;
         return false;
     }
 
-    std::string line;
-    std::string currentBlock;
-    bool inServerBlock = false;
-    int braceCount = 0;
-
-    while (std::getline(file, line))
+    for (size_t i = 0; i < root.children.size(); ++i)
     {
-        std::string trimmedLine = line;
-        trimmedLine.erase(0, trimmedLine.find_first_not_of(" \t"));
-        trimmedLine.erase(trimmedLine.find_last_not_of(" \t") + 1);
-
-        if (trimmedLine.empty() || trimmedLine[0] == '#')
-            continue;
-
-        if (trimmedLine.find("server {") == 0)
-        {
-            inServerBlock = true;
-            braceCount = 1;
-            currentBlock = "server {\n";
-            continue;
-        }
-
-        if (inServerBlock)
+        ConfigNode& directive = root.children[i];
+        try
         {
-            currentBlock += line + "\n";
-            for (size_t i = 0; i < line.length(); ++i)
+            if (directive.name == "server")
             {
-                if (line[i] == '{') ++braceCount;
-                if (line[i] == '}') --braceCount;
+                if (!directive.block || !directive.args.empty())
+                    throw std::runtime_error("Error: Expected 'server {'");
+                serverBlocks.push_back(ConfigNode());
+                ConfigNode& block = serverBlocks.back();
+                block.children.swap(directive.children);
+                block.name = directive.name;
+                block.block = true;
+                block.file = directive.file;
+                block.line = directive.line;
+                block.column = directive.column;
             }
-            if (braceCount == 0)
+            else if (directive.name == "upstream")
             {
-                inServerBlock = false;
-                serverBlocks.push_back(currentBlock);
-                currentBlock.clear();
-            }
-            else if (braceCount < 0)
-            {
-                std::cerr << "Error: Mismatched braces in configuration file." << std::endl;
-                return false;
+                if (!directive.block)
+                    throw std::runtime_error("Error: Expected '{' after 'upstream " + directive.value() + "'");
+                _global.parseUpstreamBlock(directive);
             }
+            else if (directive.block)
+                throw std::runtime_error("Error: Unexpected block '" + directive.name + "'");
+            else
+                _global.parseDirective(directive);
+        }
+        catch (const std::exception& e)
+        {
+            std::string message = e.what();
+            if (message.compare(0, directive.file.size(), directive.file) != 0)
+                message = directive.where() + ": " + message;
+            std::cerr << message << std::endl;
+            return false;
         }
-    }
-
-    if (inServerBlock)
-    {
-        std::cerr << "Error: Unclosed server block at end of file." << std::endl;
-        return false;
     }
     return true;
 }
@@ -228,9 +351,7 @@ void Server::logResponseDetails(const std::string& response, const std::string&
 
 std::string Server::intToString(int value)
 {
-    std::ostringstream oss;
-    oss << value;
-    return oss.str();
+    return HttpFormat::toString(value);
 }
 
 void Server::printServerBlocks() const
@@ -243,7 +364,7 @@ void Server::printServerBlocks() const
 
     for (size_t i = 0; i < serverBlocks.size(); ++i) {
         std::cout << "Server Block " << i + 1 << ":\n";
-        std::cout << serverBlocks[i] << std::endl;
+        std::cout << serverBlocks[i].toString() << std::endl;
         std::cout << "-----------------------------------" << std::endl;
     }
 }
\ No newline at end of file
@@ -0,0 +1,188 @@
+#include "Server.hpp"
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <climits>
+
+// Signals only raise flags (see Server::signalHandler); the actual work
+// happens here, from the event loop, where it is safe to log and touch
+// the poll set.
+bool Server::handleSignals()
+{
+    bool handled = false;
+
+    if (_upgradePid > 0 && waitpid(_upgradePid, NULL, WNOHANG) == _upgradePid)
+    {
+        logMessage("ERROR", "Upgraded binary exited early, still serving with pid " + intToString(getpid()));
+        _upgradePid = -1;
+    }
+    if (child_exited)
+    {
+        child_exited = 0;
+        reapCgiSessions();
+    }
+    if (signal_received)
+    {
+        signal_received = 0;
+        stop();
+        return true;
+    }
+    if (upgrade_requested)
+    {
+        upgrade_requested = 0;
+        spawnUpgrade();
+        handled = true;
+    }
+    if (drain_requested)
+    {
+        drain_requested = 0;
+        if (!_draining)
+            beginDrain();
+        handled = true;
+    }
+    if (reload_requested)
+    {
+        reload_requested = 0;
+        if (!_draining)
+            reloadConfiguration();
+        handled = true;
+    }
+    return handled;
+}
+
+// The handler also writes a byte to the pipe, so a signal that lands
+// after handleSignals() ran still wakes the next poll().
+void Server::openSignalPipe()
+{
+    if (pipe2(signal_pipe, O_NONBLOCK | O_CLOEXEC) != 0)
+        throw std::runtime_error("Failed to create the signal pipe: " + std::string(std::strerror(errno)));
+    addToPoll(signal_pipe[0], POLLIN);
+}
+
+void Server::drainSignalPipe()
+{
+    char buffer[64];
+    while (read(signal_pipe[0], buffer, sizeof(buffer)) > 0)
+        ;
+}
+
+void Server::beginDrain()
+{
+    logMessage("INFO", "Graceful shutdown: no longer accepting connections, draining " + intToString(_clientToServer.size()) + " connection(s)...");
+    _draining = true;
+    _drainDeadline = std::time(NULL) + DRAIN_TIMEOUT;
+
+    while (!_server_fds.empty())
+        closeListener(_server_fds.back());
+    _listeners.clear();
+
+    for (size_t i = 0; i < _poll_fds.size(); ++i)
+    {
+        int fd = _poll_fds[i].fd;
+        if (_idleClients.count(fd) && responseBuffer.find(fd) == responseBuffer.end())
+            removeClient(i);
+    }
+    for (std::map<int, Http2Connection>::iterator it = _h2Connections.begin(); it != _h2Connections.end(); ++it)
+    {
+        it->second.goAway();
+        flushHttp2(it->first);
+    }
+}
+
+void Server::spawnUpgrade()
+{
+    if (_upgradePid > 0)
+    {
+        logMessage("WARNING", "Binary upgrade already in progress (pid " + intToString(_upgradePid) + ").");
+        return;
+    }
+
+    std::string inherited;
+    for (std::map<std::pair<std::string, int>, int>::const_iterator it = _listeners.begin(); it != _listeners.end(); ++it)
+    {
+        if (!inherited.empty())
+            inherited += ";";
+        inherited += intToString(it->second) + "," + it->first.first + "," + intToString(it->first.second);
+    }
+    std::string parentPid = intToString(getpid());
+
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        logMessage("ERROR", "Binary upgrade failed: fork() failed.");
+        return;
+    }
+    if (pid == 0)
+    {
+        for (size_t i = 0; i < _poll_fds.size(); ++i)
+        {
+            if (isServerSocket(_poll_fds[i].fd))
+                fcntl(_poll_fds[i].fd, F_SETFD, 0);
+            else
+                close(_poll_fds[i].fd);
+        }
+        setenv(LISTEN_FDS_ENV, inherited.c_str(), 1);
+        setenv(PARENT_PID_ENV, parentPid.c_str(), 1);
+        char* args[] = {(char*)_binaryPath.c_str(), (char*)_configFile.c_str(), NULL};
+        execv(_binaryPath.c_str(), args);
+        perror("webserv: binary upgrade execv failed");
+        _exit(1);
+    }
+    _upgradePid = pid;
+    logMessage("INFO", "Binary upgrade: started " + _binaryPath + " as pid " + intToString(pid) + " with inherited listeners.");
+}
+
+void Server::adoptInheritedListeners()
+{
+    const char* inherited = std::getenv(LISTEN_FDS_ENV);
+    if (!inherited)
+        return;
+
+    std::istringstream entries(inherited);
+    std::string entry;
+    while (std::getline(entries, entry, ';'))
+    {
+        size_t first = entry.find(',');
+        size_t last = entry.rfind(',');
+        if (first == std::string::npos || first == last)
+            continue;
+        int fd = std::atoi(entry.c_str());
+        std::string host = entry.substr(first + 1, last - first - 1);
+        int port = std::atoi(entry.c_str() + last + 1);
+        if (fd < 0 || fcntl(fd, F_GETFD) == -1)
+            continue;
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        _listeners[std::make_pair(host, port)] = fd;
+        addServerSocketToPoll(fd);
+        logMessage("INFO", "Inherited listener " + host + (port ? ":" + intToString(port) : "") + " (fd " + intToString(fd) + ")");
+    }
+    unsetenv(LISTEN_FDS_ENV);
+}
+
+void Server::notifyUpgradeParent()
+{
+    const char* parent = std::getenv(PARENT_PID_ENV);
+    if (!parent)
+        return;
+
+    pid_t parentPid = std::atoi(parent);
+    unsetenv(PARENT_PID_ENV);
+    if (parentPid > 1 && parentPid == getppid())
+    {
+        logMessage("INFO", "Binary upgrade complete, asking pid " + intToString(parentPid) + " to drain.");
+        kill(parentPid, SIGQUIT);
+    }
+}
+
+// argv[0] only names the binary relative to PATH or the starting
+// directory, so the upgrade execs what /proc/self/exe pointed to at
+// startup; the new binary is expected at that same path.
+void Server::setBinaryPath(const std::string& path)
+{
+    char resolved[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", resolved, sizeof(resolved) - 1);
+    if (length > 0)
+        _binaryPath.assign(resolved, length);
+    else
+        _binaryPath = path;
+}
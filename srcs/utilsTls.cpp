@@ -0,0 +1,109 @@
+#include "Server.hpp"
+#include <openssl/err.h>
+
+// One context per certificate/key pair; server blocks sharing a pair
+// share its session cache.
+void Server::buildTlsContexts(std::map<std::string, TlsContext>& contexts)
+{
+    for (size_t i = 0; i < _configs.size(); ++i)
+    {
+        if (!_configs[i].hasSslListener())
+            continue;
+        std::string key = _configs[i].getSslCertificate() + "\n" + _configs[i].getSslCertificateKey();
+        if (contexts.find(key) != contexts.end())
+            continue;
+        contexts[key] = TlsContext(_configs[i].getSslCertificate(), _configs[i].getSslCertificateKey(),
+            _global.getSslSessionCache(), _global.getSslSessionTimeout(), _global.getSslSessionTickets());
+    }
+}
+
+// The listener takes the certificate of the first server block bound to
+// it; there is no SNI-based selection between blocks sharing a port.
+void Server::attachTlsListener(int server_fd, const ServerConfig& config, const ListenOptions& options)
+{
+    if (!options.ssl)
+    {
+        _tlsListeners.erase(server_fd);
+        return;
+    }
+    std::map<std::string, TlsContext>::iterator context = _tlsContexts.find(config.getSslCertificate() + "\n" + config.getSslCertificateKey());
+    if (context != _tlsContexts.end())
+        _tlsListeners[server_fd] = context->second;
+}
+
+bool Server::startTls(int client_fd, int server_fd)
+{
+    SSL* ssl = _tlsListeners[server_fd].accept(client_fd, _h2Listeners.count(server_fd) > 0);
+    if (!ssl)
+    {
+        logMessage("ERROR", "Failed to start TLS for client " + intToString(client_fd) + ": " + TlsContext::lastError());
+        return false;
+    }
+    _tlsClients[client_fd] = ssl;
+    return true;
+}
+
+// Drives the handshake from poll events; the header timer armed at
+// accept bounds how long it may take.
+void Server::continueTlsHandshake(int clientIndex)
+{
+    int client_fd = _poll_fds[clientIndex].fd;
+    SSL* ssl = _tlsClients[client_fd];
+
+    ERR_clear_error();
+    int result = SSL_do_handshake(ssl);
+    if (result == 1)
+    {
+        _poll_fds[clientIndex].events = POLLIN;
+        if (TlsContext::negotiatedHttp2(ssl))
+            startHttp2(clientIndex, "");
+        return;
+    }
+    int error = SSL_get_error(ssl, result);
+    if (error == SSL_ERROR_WANT_READ)
+        _poll_fds[clientIndex].events = POLLIN;
+    else if (error == SSL_ERROR_WANT_WRITE)
+        _poll_fds[clientIndex].events = POLLOUT;
+    else
+    {
+        logMessage("WARNING", "TLS handshake failed for client " + intToString(client_fd) + ": " + TlsContext::lastError());
+        removeClient(clientIndex);
+    }
+}
+
+// Plaintext already decrypted inside OpenSSL does not make the socket
+// readable, so such clients are reported as readable by hand.
+int Server::markTlsPending()
+{
+    int marked = 0;
+    for (std::set<int>::iterator it = _tlsPending.begin(); it != _tlsPending.end(); ++it)
+    {
+        int index = findPollIndex(*it);
+        if (index < 0)
+            continue;
+        if (!(_poll_fds[index].revents & POLLIN))
+            ++marked;
+        _poll_fds[index].revents |= POLLIN;
+    }
+    _tlsPending.clear();
+    return marked;
+}
+
+ssize_t Server::clientRecv(int client_fd, char* buffer, size_t length)
+{
+    std::map<int, SSL*>::iterator tls = _tlsClients.find(client_fd);
+    if (tls == _tlsClients.end())
+        return recv(client_fd, buffer, length, MSG_DONTWAIT);
+    ssize_t n = TlsContext::read(tls->second, buffer, length);
+    if (n > 0 && SSL_pending(tls->second) > 0)
+        _tlsPending.insert(client_fd);
+    return n;
+}
+
+ssize_t Server::clientSend(int client_fd, const char* data, size_t length)
+{
+    std::map<int, SSL*>::iterator tls = _tlsClients.find(client_fd);
+    if (tls == _tlsClients.end())
+        return send(client_fd, data, length, MSG_DONTWAIT | MSG_NOSIGNAL);
+    return TlsContext::write(tls->second, data, length);
+}